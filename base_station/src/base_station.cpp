@@ -21,6 +21,7 @@
 #include <sys/ioctl.h>
 #include <sys/reboot.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #if defined(__linux__) || defined (__unix__)
 #include <sys/sysinfo.h>
 #endif
@@ -36,14 +37,14 @@
 
 #define MESSAGE_SIZE    (64)
 
-#define STATE_FILE_PATH     "/var/lib/base_station.state"
-
 #define CHECK_STALE_CONN_PERIOD     (5 * 60 * 1000)     /* in milliseconds */
 #define CHECK_WIFI_PERIOD           (60 * 1000)         /* in milliseconds */
 #define WIFI_ERROR_THRESHOLD        (15)
-#define CHECK_LOST_DEVICES_PERIOD   (60 * 60 * 1000)    /* in milliseconds */
+#define CHECK_LOST_DEVICES_PERIOD   (5 * 1000)          /* in milliseconds */
 #define NETWORK_INTERFACE_NAME      "wlan0"
 #define DEVICE_LOST_THRESHOLD       (24 * 60 * 60)  /* in seconds */
+#define DEVICE_LOST_THRESHOLD_MIN   (5)             /* in minutes */
+#define DEVICE_LOST_THRESHOLD_MAX   (7 * 24 * 60)   /* in minutes */
 #define CHECK_3G_PERIOD             (5 * 60 * 1000)     /* in milliseconds */
 #define MODULE_3G_ERROR_THRESHOLD   (6)
 #define FALLBACK_HEATER_STATE       (HEATER_DEFROST)
@@ -51,6 +52,14 @@
 #define DAEMON_ERROR_THRESHOLD      (6)
 #define SEND_BOOT_MSG_PERIOD        (30 * 1000)
 #define CLEANUP_SMS_PERIOD          (60 * 60 * 1000)   /* in milliseconds */
+#define HEATER_MAX_POWER            (10000)             /* in watts */
+#define SCHEDULE_TIMER_MAX_PERIOD   (60 * 1000)         /* in milliseconds */
+#define POLL_PERIOD                 (60)                /* in seconds */
+#define POLL_PERIOD_MIN             (5)                 /* in seconds */
+#define POLL_PERIOD_MAX             (0xFFFE)            /* in seconds */
+#define FAST_POLL_PERIOD            (15)                /* in seconds */
+#define FAST_POLL_DURATION          (5 * 60)            /* in seconds */
+#define QUIET_POLL_PERIOD           (10 * 60)           /* in seconds */
 
 struct __attribute__((packed)) message_header_t {
     uint8_t version;
@@ -81,6 +90,14 @@ bool ends_with(std::string const & value, std::string const & ending)
     return std::equal(ending.rbegin(), ending.rend(), value.rbegin());
 }
 
+void trim(std::string &s)
+{
+    s.erase(s.begin(), std::find_if(s.begin(), s.end(),
+        [] (unsigned char c){ return !std::isspace(c); }));
+    s.erase(std::find_if(s.rbegin(), s.rend(),
+        [] (unsigned char c){ return !std::isspace(c); }).base(), s.end());
+}
+
 bool check_heater_name(const std::string &name)
 {
     if (name.empty())
@@ -98,6 +115,80 @@ bool check_heater_name(const std::string &name)
     return true;
 }
 
+/*
+ * Upper bound of energy used, assuming heater runs at full power
+ * whenever it is in COMFORT or ECO state. Actual consumption depends
+ * on the heater thermostat.
+ */
+double estimate_energy(const history_usage_t &usage, unsigned int power)
+{
+    return power * (usage.seconds[HEATER_COMFORT] + usage.seconds[HEATER_ECO]) / 3600. / 1000.;
+}
+
+std::string usage_str(const history_usage_t &usage, unsigned int power)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "COMFORT %.1fh, ECO %.1fh, DEFROST %.1fh",
+             usage.seconds[HEATER_COMFORT] / 3600.,
+             usage.seconds[HEATER_ECO] / 3600.,
+             usage.seconds[HEATER_DEFROST] / 3600.);
+    std::string str(buf);
+
+    if (power > 0) {
+        snprintf(buf, sizeof(buf), ", up to %.1fkWh", estimate_energy(usage, power));
+        str += buf;
+    }
+
+    return str;
+}
+
+std::string next_transition_str(const Schedule &schedule)
+{
+    HeaterState state;
+    time_t t = schedule.getNextTransition(time(nullptr), state);
+    struct tm tm;
+    localtime_r(&t, &tm);
+    char buf[32];
+    strftime(buf, sizeof(buf), "%a %H:%M", &tm);
+
+    std::string str = std::string("Next: ") + buf + " " + state_to_str(state);
+    for (auto & c: str) c = toupper(c);
+    return str;
+}
+
+/* Parse "HH:MM" into minutes since midnight */
+bool parse_time_of_day(const std::string &str, unsigned int &minutes)
+{
+    unsigned int hours, mins;
+    char c;
+    std::istringstream iss(str);
+    if (!(iss >> hours >> c >> mins) || c != ':' || !iss.eof())
+        return false;
+    if (hours > 23 || mins > 59)
+        return false;
+
+    minutes = hours * 60 + mins;
+    return true;
+}
+
+std::string time_of_day_str(unsigned int minutes)
+{
+    char buf[16];
+    sprintf(buf, "%02u:%02u", minutes / 60, minutes % 60);
+    return buf;
+}
+
+/*
+ * Delay from now until the first slot of a heater at least min_delay
+ * seconds away. Slots of a heater are one period apart, at an offset
+ * derived from its MAC address.
+ */
+unsigned int slot_delay(uint64_t mac, time_t now, unsigned int min_delay, unsigned int period)
+{
+    unsigned int slot = mac % period;
+    return min_delay + (slot + period - (now + min_delay) % period) % period;
+}
+
 std::stringstream& macToStr(std::stringstream &ss, uint8_t mac[6])
 {
     char buf[32];
@@ -112,15 +203,8 @@ std::stringstream& macToStr(std::stringstream &ss, uint8_t mac[6])
     return ss;
 }
 
-std::string get_uptime_str()
+std::string duration_str(unsigned int secs)
 {
-#if defined(__linux__) || defined (__unix__)
-    struct sysinfo s_info;
-    int ret = sysinfo(&s_info);
-    if (ret)
-        return "unknown";
-
-    unsigned int secs = s_info.uptime;
     unsigned int days = secs / (60 * 60 * 24);
     secs -= days * (60 * 60 * 24);
     unsigned int hours = secs / (60 * 60);
@@ -135,6 +219,17 @@ std::string get_uptime_str()
         ss << days << " days ";
     ss << hours << "h " << minutes << "m " << secs << "s";
     return ss.str();
+}
+
+std::string get_uptime_str()
+{
+#if defined(__linux__) || defined (__unix__)
+    struct sysinfo s_info;
+    int ret = sysinfo(&s_info);
+    if (ret)
+        return "unknown";
+
+    return duration_str(s_info.uptime);
 #else
     return "feature not supported";
 #endif
@@ -349,6 +444,68 @@ bool is_process_running(const std::string &name)
     return false;
 }
 
+/*
+ * Commands that only report system information by running a program.
+ * They may block for a while (curl has no timeout) and do not touch the
+ * user state, so they are run without holding the user state mutex.
+ */
+bool execute_system_command(const std::string &content, std::vector<std::string> &lines)
+{
+    if (content == "GET IP") {
+        std::array<char, 128> buffer;
+        std::string result;
+        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("curl ifconfig.me", "r"), pclose);
+        if (!pipe) {
+            lines.push_back("Fail to get public IP");
+        } else {
+            while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr)
+                result += buffer.data();
+            if (result.size() > 64)
+                result.resize(64);
+            if (result.empty())
+                lines.push_back("Unable to get public IP");
+            else
+                lines.push_back(result);
+        }
+    } else if (content == "DEBUG WIFI") {
+        std::array<char, 512> buffer;
+        std::string result;
+        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("iwconfig wlan0", "r"), pclose);
+        if (!pipe) {
+            lines.push_back("Fail to get wifi connection info");
+        } else {
+            while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr)
+                result += buffer.data();
+            if (result.size() > 512)
+                result.resize(512);
+            if (result.empty())
+                lines.push_back("Unable to get wifi connection info");
+            else
+                lines.push_back(result);
+        }
+    } else if (content == "DEBUG LOG") {
+        /* Read logs from base_station.service */
+        std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("journalctl --unit=basestation.service --no-pager", "r"), pclose);
+        if (!pipe) {
+            lines.push_back("Fail to get basestation logs");
+        } else {
+            std::array<char, 1024> buffer;
+            std::string result;
+            /* Limit how much logs we are sending to 1KiB */
+            while (result.size() < 1024 && fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr)
+                result += buffer.data();
+            if (result.empty())
+                lines.push_back("Unable to get basestation logs");
+            else
+                lines.push_back(result);
+        }
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
 #if defined(__linux__) || defined (__unix__)
 bool get_mac_address(uint8_t* mac_addr, const char* if_name)
 {
@@ -398,23 +555,122 @@ enum MessageType {
     HEATER_STATE_REPLY  = 2,
 };
 
-BaseStation::BaseStation():
+/* Telemetry fields following the name in REQ_HEATER_STATE */
+enum TelemetryType {
+    TELEMETRY_PAD               = 0x00,
+    TELEMETRY_RSSI              = 0x01,
+    TELEMETRY_UPTIME            = 0x02,
+    TELEMETRY_FAILURES          = 0x03,
+    TELEMETRY_LAST_RTT          = 0x04,
+    TELEMETRY_FIRMWARE_VERSION  = 0x05,
+    TELEMETRY_END               = 0xFF,
+};
+
+/*
+ * Unknown fields are skipped, so that heater controllers can send new
+ * ones. Integers are stored in little endian.
+ */
+static void parseTelemetry(const uint8_t *data, size_t len, HeaterTelemetry &telemetry)
+{
+    size_t i = 0;
+    while (i < len && data[i] != TELEMETRY_END) {
+        if (data[i] == TELEMETRY_PAD) {
+            ++i;
+            continue;
+        }
+        if (i + 2 > len || i + 2 + data[i + 1] > len)
+            break;
+
+        uint8_t type = data[i];
+        uint8_t field_len = data[i + 1];
+        const uint8_t *value = &data[i + 2];
+        i += 2 + field_len;
+
+        uint32_t n = 0;
+        if (field_len >= 1 && field_len <= 4) {
+            for (int j = field_len - 1; j >= 0; --j)
+                n = (n << 8) | value[j];
+        }
+
+        switch (type) {
+        case TELEMETRY_RSSI:
+            if (field_len == 1) {
+                telemetry.has_rssi = true;
+                telemetry.rssi = (int8_t)value[0];
+            }
+            break;
+        case TELEMETRY_UPTIME:
+            if (field_len >= 1 && field_len <= 4) {
+                telemetry.has_uptime = true;
+                telemetry.uptime = n;
+            }
+            break;
+        case TELEMETRY_FAILURES:
+            if (field_len >= 1 && field_len <= 4) {
+                telemetry.has_failures = true;
+                telemetry.failures = n;
+            }
+            break;
+        case TELEMETRY_LAST_RTT:
+            if (field_len >= 1 && field_len <= 4) {
+                telemetry.has_rtt = true;
+                telemetry.rtt = n;
+            }
+            break;
+        case TELEMETRY_FIRMWARE_VERSION:
+            /* Shown in web page, only keep characters of a git hash */
+            telemetry.firmware_version.clear();
+            for (unsigned int j = 0; j < field_len; ++j) {
+                if (isalnum(value[j]) || value[j] == '-' || value[j] == '.')
+                    telemetry.firmware_version += value[j];
+            }
+            break;
+        default:
+            break;
+        }
+    }
+}
+
+BaseStation::UserState::UserState():
+heater_default_state(HEATER_DEFROST),
+heater_state(),
+heater_power(),
+heater_lost_threshold(),
+default_schedule(),
+heater_schedules(),
+groups(),
+heater_index(),
+heater_names(),
+quiet_start(0),
+quiet_end(0),
+locked(false),
+phone_whitelist(),
+emergency_phone()
+{
+
+}
+
+BaseStation::BaseStation(const std::string &state_file_path, const std::string &history_dir):
+m_state_file_path(state_file_path),
 m_connections(),
 m_connections_mutex(),
 m_commands(),
 m_commands_mutex(),
 m_stale_timer(),
-m_heater_default_state(HEATER_DEFROST),
-m_heater_state(),
-m_locked(false),
-m_phone_whitelist(),
-m_emergency_phone(),
+m_user(),
+m_user_mutex(),
+m_schedule_events(),
+m_schedule_timer(),
+m_fast_poll_until(0),
 m_check_wifi_timer(),
 m_wifi_error_counter(0),
 m_message_counter(0),
 m_heater_counter(),
 m_heaters(),
 m_heaters_mutex(),
+m_history(),
+m_seen_lists(),
+m_seen(),
 m_lost_devices_timer(),
 m_check_3g_timer(),
 m_3g_error_counter(0),
@@ -422,8 +678,19 @@ m_check_daemon_timer(),
 m_daemon_error_counter(0),
 m_send_boot_msg()
 {
-    if (!loadState())
-        saveState();
+    m_history.open(history_dir);
+
+    {
+        std::lock_guard<std::mutex> guard(m_user_mutex);
+
+        struct stat st;
+        bool has_state_file = stat(m_state_file_path.c_str(), &st) == 0;
+        if (!loadState())
+            saveState();
+        else if (has_state_file)
+            catchUpSchedules(st.st_mtime);
+    }
+    armSchedules();
 
     /* Start stale timer */
     m_stale_timer.start(CHECK_STALE_CONN_PERIOD, true);
@@ -472,6 +739,7 @@ void BaseStation::process()
     checkSMSDaemon();
     sendBootMsg();
     cleanupSMS();
+    checkSchedules();
 }
 
 /*
@@ -501,6 +769,13 @@ std::string BaseStation::buildWebpage()
 {
     std::stringstream ss;
 
+    /* Main thread may modify user state while the page is built */
+    UserState user;
+    {
+        std::lock_guard<std::mutex> guard(m_user_mutex);
+        user = m_user;
+    }
+
     ss << "<html><head>\
         <style>\
         table, td, th {\
@@ -547,9 +822,11 @@ std::string BaseStation::buildWebpage()
         ss << "SMS daemon: running";
     else
         ss << "SMS daemon: <span style=\"color:red\">not running</span>";
+    ss << "<br>";
+    ss << "SMS waiting to be sent: " << SMSSender::instance().getQueueDepth();
     ss << "<h2>Heaters</h2>";
     ss << "Default heater state: ";
-    switch (m_heater_default_state) {
+    switch (user.heater_default_state) {
     case HEATER_OFF: ss << "OFF"; break;
     case HEATER_DEFROST: ss << "DEFROST"; break;
     case HEATER_ECO: ss << "ECO"; break;
@@ -557,14 +834,30 @@ std::string BaseStation::buildWebpage()
     default: ss << "<span style=\"color:red\">UNKNOWN</span>"; break;
     }
     ss << "<br>";
+    if (!user.default_schedule.empty()) {
+        ss << "Default schedule: " << user.default_schedule.toString()
+           << " (" << next_transition_str(user.default_schedule) << ")<br>";
+    }
+    for (const auto &e : user.heater_schedules) {
+        ss << "Schedule of heater " << e.first << ": " << e.second.toString()
+           << " (" << next_transition_str(e.second) << ")<br>";
+    }
 
     ss << "<table>";
     ss << "<tr>";
     ss << "<th>Name</th>";
     ss << "<th>MAC address</th>";
     ss << "<th>IP address</th>";
+    ss << "<th>Groups</th>";
     ss << "<th>State</th>";
     ss << "<th>Last request timestamp</th>";
+    ss << "<th>Today</th>";
+    ss << "<th>This month</th>";
+    ss << "<th>RSSI (last/avg/min)</th>";
+    ss << "<th>Round trip (last/avg/max)</th>";
+    ss << "<th>Failures (since boot/last " << TELEMETRY_WINDOW << " requests)</th>";
+    ss << "<th>Uptime</th>";
+    ss << "<th>Firmware</th>";
     ss << "</tr>";
 
     {
@@ -572,7 +865,7 @@ std::string BaseStation::buildWebpage()
 
     for (const auto& it : m_heaters) {
         uint64_t mac = it.first;
-        Heater h = it.second;
+        const Heater &h = it.second;
 
         ss << "<tr>";
         if (!h.getName().empty())
@@ -593,6 +886,7 @@ std::string BaseStation::buildWebpage()
         }
 
         ss << "<td><a href=\"http://" << h.getLastIPAddress() << "\">" << h.getLastIPAddress() << "</a></td>";
+        ss << "<td>" << getHeaterGroups(user, h.getName()) << "</td>";
 
         switch (h.getState()) {
         case HEATER_OFF: ss << "<td>OFF</td>"; break;
@@ -609,6 +903,45 @@ std::string BaseStation::buildWebpage()
             ss << "<td>" << buf << "</td>";
         }
 
+        {
+            unsigned int power = 0;
+            auto p = user.heater_power.find(h.getName());
+            if (p != user.heater_power.end())
+                power = p->second;
+
+            history_usage_t usage;
+            if (m_history.getUsage(mac, HISTORY_DAILY, time(nullptr), usage))
+                ss << "<td>" << usage_str(usage, power) << "</td>";
+            else
+                ss << "<td></td>";
+            if (m_history.getUsage(mac, HISTORY_MONTHLY, time(nullptr), usage))
+                ss << "<td>" << usage_str(usage, power) << "</td>";
+            else
+                ss << "<td></td>";
+        }
+
+        {
+            const HeaterTelemetry &t = h.getLastTelemetry();
+            const TelemetryAggregates &a = h.getTelemetryAggregates();
+
+            ss << "<td>";
+            if (t.has_rssi)
+                ss << t.rssi << "/" << a.rssi_avg << "/" << a.rssi_min << " dBm";
+            ss << "</td><td>";
+            if (t.has_rtt)
+                ss << t.rtt << "/" << a.rtt_avg << "/" << a.rtt_max << " ms";
+            ss << "</td><td>";
+            if (t.has_failures)
+                ss << t.failures << "/" << a.failures;
+            ss << "</td><td>";
+            if (t.has_uptime) {
+                ss << duration_str(t.uptime);
+                if (a.reboots > 0)
+                    ss << " (" << a.reboots << " reboots)";
+            }
+            ss << "</td><td>" << t.firmware_version << "</td>";
+        }
+
         ss << "</tr>";
     }
     }
@@ -620,6 +953,14 @@ std::string BaseStation::buildWebpage()
     return ss.str();
 }
 
+/*
+ * Beware this function is called from web server context !
+ */
+std::string BaseStation::buildHistory(const std::string &heater, time_t from, time_t to, HistoryResolution resolution)
+{
+    return m_history.queryJSON(heater, from, to, resolution);
+}
+
 void BaseStation::handleConnections()
 {
     struct pollfd *fds;
@@ -749,12 +1090,16 @@ void BaseStation::parseMessage(DeviceConnection &conn, uint8_t *data)
     if (header.type == MessageType::REQ_HEATER_STATE) {
         conn.last_seen = std::chrono::steady_clock::now();
 
-        /* Parse optional name */
+        /* Parse optional name, followed by optional telemetry */
         std::string name;
+        HeaterTelemetry telemetry;
         {
+            const unsigned int data_len = MESSAGE_SIZE - sizeof(struct message_header_t);
             unsigned int i = 0;
-            while (data[i] != 0xFF && data[i] != '\0')
+            while (i < data_len && data[i] != 0xFF && data[i] != '\0')
                 name += toupper(data[i++]);
+            if (i < data_len && data[i] == '\0')
+                parseTelemetry(&data[i + 1], data_len - i - 1, telemetry);
 
             if (!name.empty()) {
                 if (!check_heater_name(name)) {
@@ -799,15 +1144,15 @@ void BaseStation::parseMessage(DeviceConnection &conn, uint8_t *data)
                     ss << name << " MAC=";
                 macToStr(ss, header.mac_addr);
                 ss << " rebooted.",
-                SMSSender::instance().sendSMS(m_emergency_phone, ss.str());
+                SMSSender::instance().sendSMS(m_user.emergency_phone, ss.str(), SMS_PRIORITY_ALERT);
             }
         }
         m_heater_counter[mac_addr] = header.counter;
 
-        HeaterState state = m_heater_default_state;
+        HeaterState state = m_user.heater_default_state;
         if (!name.empty()) {
-            auto it = m_heater_state.find(name);
-            if (it != m_heater_state.end())
+            auto it = m_user.heater_state.find(name);
+            if (it != m_user.heater_state.end())
                 state = it->second;
         }
         {
@@ -817,10 +1162,14 @@ void BaseStation::parseMessage(DeviceConnection &conn, uint8_t *data)
             char dst[32];
             inet_ntop(AF_INET, &addr.sin_addr, dst, sizeof(dst));
             std::lock_guard<std::mutex> guard(m_heaters_mutex);
-            m_heaters[mac_addr] = Heater(name, dst);
-            m_heaters[mac_addr].update(state);
+            Heater &h = m_heaters[mac_addr];
+            h.setAddress(name, dst);
+            h.update(state);
+            h.updateTelemetry(telemetry);
         }
-        sendHeaterState(conn.fd, state);
+        trackHeater(mac_addr, name);
+        sendHeaterState(conn.fd, state, getPollPeriod(mac_addr, name));
+        m_history.record(mac_addr, name, state, time(nullptr));
     } else if (header.type == MessageType::HEATER_STATE_REPLY) {
         std::stringstream ss;
         ss << "Ignoring HEATER_STATE_REPLY message from device ";
@@ -865,7 +1214,7 @@ void BaseStation::parseCommands()
         m_commands.pop();
 
         /* Check phone belongs to whitelist */
-        if (m_locked && !m_phone_whitelist.empty() && m_phone_whitelist.find(from) == m_phone_whitelist.end()) {
+        if (m_user.locked && !m_user.phone_whitelist.empty() && m_user.phone_whitelist.find(from) == m_user.phone_whitelist.end()) {
             std::stringstream ss;
             ss << "Received SMS from phone number \"" << from << "\" not in whitelist";
             Logger::warn(ss.str());
@@ -879,374 +1228,693 @@ void BaseStation::parseCommands()
             return;
         }
 
-        /* Trim content */
-        content.erase(content.begin(), std::find_if(content.begin(), content.end(), [] (unsigned char c){ return !std::isspace(c); }));
-        content.erase(std::find_if(content.rbegin(), content.rend(),
-                      [] (unsigned char c){ return !std::isspace(c); }).base(), content.end());
-
         /* Convert all lowercase characters to uppercase */
         for (auto & c: content) c = toupper(c);
 
-        if (content == "PING")
-            SMSSender::instance().sendSMS(from, "PONG");
-        else if (content == "VERSION")
-            sendVersion(from);
-        else if (content == "ALL OFF") {
-            m_heater_default_state = HEATER_OFF;
-            for (auto &e : m_heater_state)
-                e.second = HEATER_OFF;
-            saveState();
-            SMSSender::instance().sendSMS(from, "ALL OFF");
-        } else if (content == "ALL ECO") {
-            m_heater_default_state = HEATER_ECO;
-            for (auto &e : m_heater_state)
-                e.second = HEATER_ECO;
-            saveState();
-            SMSSender::instance().sendSMS(from, "ALL ECO");
-        } else if (content == "ALL DEFROST") {
-            m_heater_default_state = HEATER_DEFROST;
-            for (auto &e : m_heater_state)
-                e.second = HEATER_DEFROST;
-            saveState();
-            SMSSender::instance().sendSMS(from, "ALL DEFROST");
-        } else if (content == "ALL COMFORT") {
-            m_heater_default_state = HEATER_COMFORT;
-            for (auto &e : m_heater_state)
-                e.second = HEATER_COMFORT;
-            saveState();
-            SMSSender::instance().sendSMS(from, "ALL COMFORT");
-        } else if (content == "ALL ON") {
-            m_heater_default_state = HEATER_COMFORT;
-            for (auto &e : m_heater_state)
-                e.second = HEATER_COMFORT;
-            saveState();
-            SMSSender::instance().sendSMS(from, "ALL ON");
-        } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " OFF")) {
-            std::string name;
-            name = content.substr(7);
-            name = name.substr(0, name.length() - 4);
-
-            if (check_heater_name(name)) {
-                m_heater_state[name] = HEATER_OFF;
-                saveState();
-                std::stringstream reply;
-                reply << "HEATER " << name << " OFF";
-                SMSSender::instance().sendSMS(from, reply.str());
-            } else {
-                SMSSender::instance().sendSMS(from, "Invalid heater name");
-            }
-        } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " ECO")) {
-            std::string name;
-            name = content.substr(7);
-            name = name.substr(0, name.length() - 4);
-
-            std::stringstream m;
-            m << '\"' << name << '\"' << '\n';
-            Logger::debug(m.str());
-
-            if (check_heater_name(name)) {
-                m_heater_state[name] = HEATER_ECO;
-                saveState();
-                std::stringstream reply;
-                reply << "HEATER " << name << " ECO";
-                SMSSender::instance().sendSMS(from, reply.str());
-            } else {
-                SMSSender::instance().sendSMS(from, "Invalid heater name");
+        /*
+         * A text message may contain several commands separated by ';'.
+         * For instance: "HEATER KITCHEN ECO; HEATER BED OFF; GET DEFAULT"
+         */
+        std::vector<std::string> commands;
+        {
+            std::istringstream iss(content);
+            std::string command;
+            while (std::getline(iss, command, ';')) {
+                trim(command);
+                if (!command.empty())
+                    commands.push_back(command);
             }
-        } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " DEFROST")) {
-            std::string name;
-            name = content.substr(7);
-            name = name.substr(0, name.length() - 8);
-
-            if (check_heater_name(name)) {
-                m_heater_state[name] = HEATER_DEFROST;
-                saveState();
-                std::stringstream reply;
-                reply << "HEATER " << name << " DEFROST";
-                SMSSender::instance().sendSMS(from, reply.str());
-            } else {
-                SMSSender::instance().sendSMS(from, "Invalid heater name");
+        }
+        if (commands.empty())
+            commands.push_back(std::string());
+
+        /* Run these before taking m_user_mutex, so that the web server is not blocked meanwhile */
+        std::vector<std::vector<std::string>> system_lines(commands.size());
+        std::vector<bool> system_command(commands.size());
+        for (size_t i = 0; i < commands.size(); ++i)
+            system_command[i] = execute_system_command(commands[i], system_lines[i]);
+
+        /*
+         * Commands are applied in order. If one of them fails, the state
+         * is restored to what it was before the first one so that a batch
+         * is either fully applied or not applied at all.
+         */
+        std::unique_lock<std::mutex> user_lock(m_user_mutex);
+        UserState old_user = m_user;
+
+        SMSPriority priority = SMS_PRIORITY_DEBUG;
+        CommandReply reply;
+        reply.state_changed = false;
+        reply.reboot = false;
+        for (size_t i = 0; i < commands.size(); ++i) {
+            const std::string &command = commands[i];
+
+            /* Replies made only of debug information are sent last */
+            if (command.rfind("DEBUG ", 0) != 0)
+                priority = SMS_PRIORITY_REPLY;
+
+            if (system_command[i]) {
+                reply.lines.insert(reply.lines.end(), system_lines[i].begin(), system_lines[i].end());
+                continue;
             }
-        } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " COMFORT")) {
-            std::string name;
-            name = content.substr(7);
-            name = name.substr(0, name.length() - 8);
 
-            if (check_heater_name(name)) {
-                m_heater_state[name] = HEATER_COMFORT;
-                saveState();
-                std::stringstream reply;
-                reply << "HEATER " << name << " COMFORT";
-                SMSSender::instance().sendSMS(from, reply.str());
-            } else  {
-                SMSSender::instance().sendSMS(from, "Invalid heater name");
-            }
-        } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " ON")) {
-            std::string name;
-            name = content.substr(7);
-            name = name.substr(0, name.length() - 3);
+            size_t first_line = reply.lines.size();
+            if (executeCommand(from, command, reply))
+                continue;
 
-            if (check_heater_name(name)) {
-                m_heater_state[name] = HEATER_COMFORT;
-                saveState();
-                std::stringstream reply;
-                reply << "HEATER " << name << " ON";
-                SMSSender::instance().sendSMS(from, reply.str());
-            } else {
-                SMSSender::instance().sendSMS(from, "Invalid heater name");
-            }
-        } else if (content == "GET DEFAULT") {
-            switch (m_heater_default_state) {
-            case HEATER_OFF:
-                SMSSender::instance().sendSMS(from, "DEFAULT: OFF");
-                break;
-            case HEATER_DEFROST:
-                SMSSender::instance().sendSMS(from, "DEFAULT: DEFROST");
-                break;
-            case HEATER_ECO:
-                SMSSender::instance().sendSMS(from, "DEFAULT: ECO");
-                break;
-            case HEATER_COMFORT:
-                SMSSender::instance().sendSMS(from, "DEFAULT: COMFORT/ON");
-                break;
+            /* Only report the error of the failing command */
+            reply.lines.erase(reply.lines.begin(), reply.lines.begin() + first_line);
+            if (commands.size() > 1) {
+                std::stringstream ss;
+                ss << "Command \"" << command << "\" failed. No command applied.";
+                reply.lines.push_back(ss.str());
             }
-        } else if (content.rfind("GET HEATER ", 0) == 0) {
-            std::string name;
 
-            name = content.substr(11);
+            m_user = old_user;
+            reply.state_changed = false;
+            reply.reboot = false;
+            break;
+        }
+        user_lock.unlock();
 
-            if (check_heater_name(name)) {
-                for (unsigned int i = 0; i < name.length(); ++i)
-                    name[i] = toupper(name[i]);
+        /* Persist state once for the whole batch */
+        if (reply.state_changed) {
+            saveState();
+            armSchedules();
+            updateLostThresholds();
 
-                auto it = m_heater_state.find(name);
-                HeaterState state;
-                if (it != m_heater_state.end())
-                    state = it->second;
-                else
-                    state = m_heater_default_state;
+            /* User is likely to check the result or send more commands */
+            m_fast_poll_until = time(nullptr) + FAST_POLL_DURATION;
+        }
 
-                std::stringstream msg;
-                switch (state) {
-                case HEATER_OFF: msg << "HEATER " << name << " OFF"; break;
-                case HEATER_DEFROST: msg << "HEATER " << name << " DEFROST"; break;
-                case HEATER_ECO: msg << "HEATER " << name << " ECO"; break;
-                case HEATER_COMFORT: msg << "HEATER " << name << " COMFORT/ON"; break;
-                }
-                SMSSender::instance().sendSMS(from, msg.str());
-            } else {
-                SMSSender::instance().sendSMS(from, "Invalid name");
-            }
-        } else if (content == "GET IP") {
-            std::array<char, 128> buffer;
-            std::string result;
-            std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("curl ifconfig.me", "r"), pclose);
-            if (!pipe) {
-                SMSSender::instance().sendSMS(from, "Fail to get public IP");
-            } else {
-                while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr)
-                    result += buffer.data();
-                if (result.size() > 64)
-                    result.resize(64);
-                if (result.empty())
-                    SMSSender::instance().sendSMS(from, "Unable to get public IP");
-                else
-                    SMSSender::instance().sendSMS(from, result);
-            }
-        } else if (content == "LOCK") {
-            if (m_phone_whitelist.find(from) != m_phone_whitelist.end()) {
-                SMSSender::instance().sendSMS(from, "LOCKED");
-                m_locked = true;
-            } else {
-                SMSSender::instance().sendSMS(from, "Cannot lock: phone number is not whitelisted. Use ADD PHONE command.");
-            }
-        } else if (content.rfind("UNLOCK ", 0) == 0) {
-            std::istringstream iss(content);
-            std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
-                                            std::istream_iterator<std::string>{}};
-            Logger::debug(tokens[1]);
-            if (tokens.size() >= 2) {
-                if (tokens[1] == BASE_STATION_PIN) {
-                    SMSSender::instance().sendSMS(from, "UNLOCKED");
-                    m_locked = false;
-                } else {
-                    SMSSender::instance().sendSMS(from, "Wrong PIN");
-                }
-            }
-        } else if (content.rfind("ADD PHONE ", 0) == 0) {
-            if (!m_locked) {
-                std::istringstream iss(content);
-                std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
-                                                std::istream_iterator<std::string>{}};
-                if (tokens.size() == 3) {
-                    std::string phone_number = tokens[2];
-                    if (check_phone_number_format(phone_number)) {
-                        m_phone_whitelist.insert(phone_number);
-                        std::stringstream ss;
-                        ss << "Phone number \"" << phone_number << "\" added to whitelist";
-                        SMSSender::instance().sendSMS(from, ss.str());
-                        saveState();
-                    } else {
-                        std::stringstream ss;
-                        ss << "Phone number \"" << phone_number << "\" is not valid. Phone numbers must follow this format: (country code)(9-10 digits). Example: 3310203040506";
-                        SMSSender::instance().sendSMS(from, ss.str());
-                    }
-                }
-            }
-        } else if (content.rfind("REMOVE PHONE ", 0) == 0) {
-            if (!m_locked) {
-                std::istringstream iss(content);
-                std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
-                                                std::istream_iterator<std::string>{}};
-                if (tokens.size() == 3) {
-                    m_phone_whitelist.erase(tokens[2]);
-                    std::stringstream ss;
-                    ss << "Phone number \"" << tokens[2] << "\" removed from whitelist";
-                    SMSSender::instance().sendSMS(from, ss.str());
-                    saveState();
-                }
-            }
-        } else if (content.rfind("SET EMERGENCY PHONE ", 0) == 0) {
-            std::istringstream iss(content);
-            std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
-                                            std::istream_iterator<std::string>{}};
-            if (tokens.size() == 4) {
-                std::string phone_number = tokens[3];
-                if (check_phone_number_format(phone_number)) {
-                    m_emergency_phone = phone_number;
-                    std::stringstream ss;
-                    ss << phone_number << " set as emergency phone number.";
-                    SMSSender::instance().sendSMS(from, ss.str());
-                    saveState();
-                } else {
-                    std::stringstream ss;
-                    ss << "Phone number \"" << phone_number << "\" is not valid. Phone numbers must follow this format: (country code)(9-10 digits). Example: 3310203040506";
-                    SMSSender::instance().sendSMS(from, ss.str());
-                }
-            }
-        } else if (content == "REMOVE EMERGENCY PHONE") {
-            if (!m_emergency_phone.empty()) {
-                Logger::info("Removed emergency phone");
-                SMSSender::instance().sendSMS(from, "Emergency phone removed");
-            }
-            m_emergency_phone.clear();
-        } else if (content.rfind("HELP") == 0) {
-            std::stringstream ss;
-            ss << "Basic commands:\n";
-            ss << "ALL OFF\n";
-            ss << "ALL ECO\n";
-            ss << "ALL COMFORT\n";
-            ss << "ALL DEFROST\n";
-            SMSSender::instance().sendSMS(from, ss.str());
-        } else if (content == "DEBUG FILESTATE") {
-            std::ifstream file(STATE_FILE_PATH);
-            std::string line;
-            std::stringstream msg;
-            while(std::getline(file, line)) {
-                msg << line << '\n';
-            }
-            SMSSender::instance().sendSMS(from, msg.str());
-        } else if (content == "DEBUG STATE") {
-            std::stringstream msg;
-            switch (m_heater_default_state) {
-            case HEATER_OFF: msg << "DEFAULT: OFF\n"; break;
-            case HEATER_DEFROST: msg << "DEFAULT: DEFROST\n"; break;
-            case HEATER_ECO: msg << "DEFAULT: ECO\n"; break;
-            case HEATER_COMFORT: msg << "DEFAULT: COMFORT/ON\n"; break;
-            }
+        /* Send one consolidated reply */
+        std::string result;
+        for (const auto &line : reply.lines) {
+            if (!result.empty() && result.back() != '\n')
+                result += '\n';
+            result += line;
+        }
+        while (!result.empty()) {
+            /* Split reply in SMS that smstools sends as a whole */
+            std::string msg = result.substr(0, SMS_MAX_LENGTH);
+            result.erase(0, SMS_MAX_LENGTH);
+            SMSSender::instance().sendSMS(from, msg, priority);
+        }
 
-            for (auto &e : m_heater_state) {
-                switch (e.second) {
-                case HEATER_OFF: msg << "HEATER " << e.first << ": OFF\n"; break;
-                case HEATER_DEFROST: msg << "HEATER " << e.first << ": DEFROST\n"; break;
-                case HEATER_ECO: msg << "HEATER " << e.first << ": ECO\n"; break;
-                case HEATER_COMFORT: msg << "HEATER " << e.first << ": COMFORT/ON\n"; break;
-                }
-            }
-            SMSSender::instance().sendSMS(from, msg.str());
-        } else if (content == "DEBUG REBOOT") {
+        if (reply.reboot) {
+            /* Reply waits in memory for its coalescing window otherwise */
+            SMSSender::instance().flush();
             sync();
             reboot(RB_AUTOBOOT);
-        } else if (content == "DEBUG WIFI") {
-            std::array<char, 512> buffer;
-            std::string result;
-            std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("iwconfig wlan0", "r"), pclose);
-            if (!pipe) {
-                SMSSender::instance().sendSMS(from, "Fail to get wifi connection info");
-            } else {
-                while (fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr)
-                    result += buffer.data();
-                if (result.size() > 512)
-                    result.resize(512);
-                if (result.empty())
-                    SMSSender::instance().sendSMS(from, "Unable to get wifi connection info");
-                else
-                    SMSSender::instance().sendSMS(from, result);
-            }
-        } else if (content == "DEBUG LOG") {
-            /* Read logs from base_station.service */
-            std::unique_ptr<FILE, decltype(&pclose)> pipe(popen("journalctl --unit=basestation.service --no-pager", "r"), pclose);
-            if (!pipe) {
-                SMSSender::instance().sendSMS(from, "Fail to get basestation logs");
-            } else {
-                std::array<char, 1024> buffer;
-                std::string result;
-                /* Limit how much logs we are sending to 1KiB */
-                while (result.size() < 1024 && fgets(buffer.data(), buffer.size(), pipe.get()) != nullptr)
-                    result += buffer.data();
-                if (result.empty()) {
-                    SMSSender::instance().sendSMS(from, "Unable to get basestation logs");
-                } else {
-                    std::string msg;
-                    while (!result.empty()) {
-                        msg = result.substr(0, 512);
-                        result.erase(0, 512);
-                        SMSSender::instance().sendSMS(from, msg);
-                    }
-                }
-            }
-        } else if (content == "DEBUG UPTIME") {
-            SMSSender::instance().sendSMS(from, get_uptime_str());
-        } else {
-            std::stringstream ss;
-            ss << "Received invalid message from: " << from;
-            Logger::warn(ss.str());
-            SMSSender::instance().sendSMS(from, "Received invalid command");
         }
     }
 }
 
-void BaseStation::sendVersion(const std::string &to)
+bool BaseStation::executeCommand(const std::string &from, const std::string &content, CommandReply &reply)
 {
-    SMSSender::instance().sendSMS(to, get_version_str());
-}
+    if (content == "PING")
+        reply.lines.push_back("PONG");
+    else if (content == "VERSION")
+        reply.lines.push_back(get_version_str());
+    else if (content == "ALL OFF") {
+        m_user.heater_default_state = HEATER_OFF;
+        for (auto &e : m_user.heater_state)
+            e.second = HEATER_OFF;
+        reply.state_changed = true;
+        reply.lines.push_back("ALL OFF");
+    } else if (content == "ALL ECO") {
+        m_user.heater_default_state = HEATER_ECO;
+        for (auto &e : m_user.heater_state)
+            e.second = HEATER_ECO;
+        reply.state_changed = true;
+        reply.lines.push_back("ALL ECO");
+    } else if (content == "ALL DEFROST") {
+        m_user.heater_default_state = HEATER_DEFROST;
+        for (auto &e : m_user.heater_state)
+            e.second = HEATER_DEFROST;
+        reply.state_changed = true;
+        reply.lines.push_back("ALL DEFROST");
+    } else if (content == "ALL COMFORT") {
+        m_user.heater_default_state = HEATER_COMFORT;
+        for (auto &e : m_user.heater_state)
+            e.second = HEATER_COMFORT;
+        reply.state_changed = true;
+        reply.lines.push_back("ALL COMFORT");
+    } else if (content == "ALL ON") {
+        m_user.heater_default_state = HEATER_COMFORT;
+        for (auto &e : m_user.heater_state)
+            e.second = HEATER_COMFORT;
+        reply.state_changed = true;
+        reply.lines.push_back("ALL ON");
+    } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " OFF")) {
+        std::string name;
+        name = content.substr(7);
+        name = name.substr(0, name.length() - 4);
 
-void BaseStation::sendHeaterState(int fd, HeaterState state)
-{
-    message_header_t header;
-    header.version = 1;
-    header.type = MessageType::HEATER_STATE_REPLY;
+        if (check_heater_name(name)) {
+            m_user.heater_state[name] = HEATER_OFF;
+            reply.state_changed = true;
+            std::stringstream ss;
+            ss << "HEATER " << name << " OFF";
+            reply.lines.push_back(ss.str());
+        } else {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+    } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " ECO")) {
+        std::string name;
+        name = content.substr(7);
+        name = name.substr(0, name.length() - 4);
 
-    if (!get_mac_address(header.mac_addr, NETWORK_INTERFACE_NAME))
-        memset(header.mac_addr, 0, sizeof(header.mac_addr));
-    header.counter = m_message_counter++;
+        std::stringstream m;
+        m << '\"' << name << '\"' << '\n';
+        Logger::debug(m.str());
 
-    uint8_t data[MESSAGE_SIZE];
-    memset(data, 0xFF, sizeof(data));
-    memcpy(data, &header, sizeof(header));
-    data[sizeof(header)] = state;
+        if (check_heater_name(name)) {
+            m_user.heater_state[name] = HEATER_ECO;
+            reply.state_changed = true;
+            std::stringstream ss;
+            ss << "HEATER " << name << " ECO";
+            reply.lines.push_back(ss.str());
+        } else {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+    } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " DEFROST")) {
+        std::string name;
+        name = content.substr(7);
+        name = name.substr(0, name.length() - 8);
 
-    int sent = 0;
-    while (sent < MESSAGE_SIZE) {
-        int ret = write(fd, &data[sent], MESSAGE_SIZE - sent);
-        if (ret <= 0)
-            break;
-        sent += ret;
-    }
-    if (sent != MESSAGE_SIZE)
-        Logger::err("Failed to send heater state");
-    else
-        Logger::debug("Sent heater state reply to heater controller");
+        if (check_heater_name(name)) {
+            m_user.heater_state[name] = HEATER_DEFROST;
+            reply.state_changed = true;
+            std::stringstream ss;
+            ss << "HEATER " << name << " DEFROST";
+            reply.lines.push_back(ss.str());
+        } else {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+    } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " COMFORT")) {
+        std::string name;
+        name = content.substr(7);
+        name = name.substr(0, name.length() - 8);
+
+        if (check_heater_name(name)) {
+            m_user.heater_state[name] = HEATER_COMFORT;
+            reply.state_changed = true;
+            std::stringstream ss;
+            ss << "HEATER " << name << " COMFORT";
+            reply.lines.push_back(ss.str());
+        } else  {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+    } else if (content.rfind("HEATER ", 0) == 0 && ends_with(content, " ON")) {
+        std::string name;
+        name = content.substr(7);
+        name = name.substr(0, name.length() - 3);
+
+        if (check_heater_name(name)) {
+            m_user.heater_state[name] = HEATER_COMFORT;
+            reply.state_changed = true;
+            std::stringstream ss;
+            ss << "HEATER " << name << " ON";
+            reply.lines.push_back(ss.str());
+        } else {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+    } else if (content == "GET DEFAULT") {
+        switch (m_user.heater_default_state) {
+        case HEATER_OFF:
+            reply.lines.push_back("DEFAULT: OFF");
+            break;
+        case HEATER_DEFROST:
+            reply.lines.push_back("DEFAULT: DEFROST");
+            break;
+        case HEATER_ECO:
+            reply.lines.push_back("DEFAULT: ECO");
+            break;
+        case HEATER_COMFORT:
+            reply.lines.push_back("DEFAULT: COMFORT/ON");
+            break;
+        }
+    } else if (content.rfind("GET HEATER ", 0) == 0) {
+        std::string name;
+
+        name = content.substr(11);
+
+        if (check_heater_name(name)) {
+            for (unsigned int i = 0; i < name.length(); ++i)
+                name[i] = toupper(name[i]);
+
+            auto it = m_user.heater_state.find(name);
+            HeaterState state;
+            if (it != m_user.heater_state.end())
+                state = it->second;
+            else
+                state = m_user.heater_default_state;
+
+            std::stringstream msg;
+            switch (state) {
+            case HEATER_OFF: msg << "HEATER " << name << " OFF"; break;
+            case HEATER_DEFROST: msg << "HEATER " << name << " DEFROST"; break;
+            case HEATER_ECO: msg << "HEATER " << name << " ECO"; break;
+            case HEATER_COMFORT: msg << "HEATER " << name << " COMFORT/ON"; break;
+            }
+            reply.lines.push_back(msg.str());
+        } else {
+            reply.lines.push_back("Invalid name");
+            return false;
+        }
+    } else if (content.rfind("SET POWER ", 0) == 0) {
+        std::istringstream iss(content.substr(10));
+        std::string name, extra;
+        int power;
+
+        if (!(iss >> name) || !check_heater_name(name)) {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+        if (!(iss >> power) || (iss >> extra) || power < 0 || power > HEATER_MAX_POWER) {
+            reply.lines.push_back("Invalid power");
+            return false;
+        }
+
+        if (power == 0)
+            m_user.heater_power.erase(name);
+        else
+            m_user.heater_power[name] = power;
+        reply.state_changed = true;
+
+        std::stringstream ss;
+        ss << "POWER " << name << " " << power << "W";
+        reply.lines.push_back(ss.str());
+    } else if (content.rfind("SET LOST THRESHOLD ", 0) == 0) {
+        std::istringstream iss(content.substr(19));
+        std::string name, extra;
+        int minutes;
+
+        if (!(iss >> name) || !check_heater_name(name)) {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+        if (!(iss >> minutes) || (iss >> extra)
+        ||  (minutes != 0 && (minutes < DEVICE_LOST_THRESHOLD_MIN || minutes > DEVICE_LOST_THRESHOLD_MAX))) {
+            std::stringstream ss;
+            ss << "Invalid threshold, must be between " << DEVICE_LOST_THRESHOLD_MIN
+               << " and " << DEVICE_LOST_THRESHOLD_MAX << " minutes";
+            reply.lines.push_back(ss.str());
+            return false;
+        }
+
+        if (minutes == 0)
+            m_user.heater_lost_threshold.erase(name);
+        else
+            m_user.heater_lost_threshold[name] = minutes * 60;
+        reply.state_changed = true;
+
+        std::stringstream ss;
+        ss << "LOST THRESHOLD " << name << " " << getLostThreshold(name) / 60 << "min";
+        reply.lines.push_back(ss.str());
+    } else if (content == "SET QUIET HOURS OFF") {
+        m_user.quiet_start = 0;
+        m_user.quiet_end = 0;
+        reply.state_changed = true;
+        reply.lines.push_back("QUIET HOURS OFF");
+    } else if (content.rfind("SET QUIET HOURS ", 0) == 0) {
+        std::istringstream iss(content.substr(16));
+        std::string start, end, extra;
+        unsigned int start_minutes, end_minutes;
+
+        if (!(iss >> start >> end) || (iss >> extra)
+        ||  !parse_time_of_day(start, start_minutes) || !parse_time_of_day(end, end_minutes)
+        ||  start_minutes == end_minutes) {
+            reply.lines.push_back("Invalid quiet hours, expected SET QUIET HOURS <HH:MM> <HH:MM>");
+            return false;
+        }
+
+        m_user.quiet_start = start_minutes;
+        m_user.quiet_end = end_minutes;
+        reply.state_changed = true;
+        reply.lines.push_back("QUIET HOURS " + time_of_day_str(m_user.quiet_start) + "-" + time_of_day_str(m_user.quiet_end));
+    } else if (content.rfind("GET USAGE ", 0) == 0) {
+        std::string name = content.substr(10);
+        uint64_t mac;
+
+        if (!check_heater_name(name)) {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+        if (!m_history.findHeater(name, mac)) {
+            reply.lines.push_back("No history for heater " + name);
+            return false;
+        }
+
+        unsigned int power = 0;
+        auto it = m_user.heater_power.find(name);
+        if (it != m_user.heater_power.end())
+            power = it->second;
+
+        history_usage_t today, yesterday, month, last_month;
+        m_history.getUsage(mac, HISTORY_DAILY, time(nullptr), today);
+        m_history.getUsage(mac, HISTORY_DAILY, today.timestamp - 1, yesterday);
+        m_history.getUsage(mac, HISTORY_MONTHLY, time(nullptr), month);
+        m_history.getUsage(mac, HISTORY_MONTHLY, month.timestamp - 1, last_month);
+
+        std::stringstream ss;
+        ss << "HEATER " << name << " USAGE\n"
+           << "Today: " << usage_str(today, power) << "\n"
+           << "Yesterday: " << usage_str(yesterday, power) << "\n"
+           << "This month: " << usage_str(month, power) << "\n"
+           << "Last month: " << usage_str(last_month, power);
+        reply.lines.push_back(ss.str());
+    } else if (content.rfind("GROUP ", 0) == 0) {
+        std::istringstream iss(content.substr(6));
+        std::string group, action, name, extra;
+        iss >> group >> action;
+
+        if (!check_heater_name(group)) {
+            reply.lines.push_back("Invalid group name");
+            return false;
+        }
+
+        if (action == "ADD" || action == "REMOVE") {
+            if (!(iss >> name) || (iss >> extra) || !check_heater_name(name)) {
+                reply.lines.push_back("Invalid heater name");
+                return false;
+            }
+
+            if (action == "ADD") {
+                int index = addHeaterIndex(name);
+                if (index < 0) {
+                    reply.lines.push_back("Too many heaters in groups");
+                    return false;
+                }
+                m_user.groups[group].set(index);
+                reply.lines.push_back("Heater " + name + " added to group " + group);
+            } else {
+                auto it = m_user.groups.find(group);
+                int index = getHeaterIndex(name);
+                if (it == m_user.groups.end() || index < 0 || !it->second.test(index)) {
+                    reply.lines.push_back("Heater " + name + " is not in group " + group);
+                    return false;
+                }
+                it->second.reset(index);
+                if (it->second.none())
+                    m_user.groups.erase(it);
+                removeHeaterIndex(name);
+                reply.lines.push_back("Heater " + name + " removed from group " + group);
+            }
+        } else {
+            HeaterState state;
+            if ((iss >> extra) || !str_to_state(action, state)) {
+                reply.lines.push_back("Received invalid command");
+                return false;
+            }
+
+            auto it = m_user.groups.find(group);
+            if (it == m_user.groups.end()) {
+                reply.lines.push_back("Unknown group " + group);
+                return false;
+            }
+
+            for (unsigned int i = 0; i < m_user.heater_names.size(); ++i) {
+                if (it->second.test(i))
+                    m_user.heater_state[m_user.heater_names[i]] = state;
+            }
+            reply.lines.push_back("GROUP " + group + " " + action);
+        }
+        reply.state_changed = true;
+    } else if (content.rfind("GET GROUP ", 0) == 0) {
+        std::string group = content.substr(10);
+
+        auto it = m_user.groups.find(group);
+        if (it == m_user.groups.end()) {
+            reply.lines.push_back("Unknown group " + group);
+            return false;
+        }
+
+        std::stringstream msg;
+        msg << "GROUP " << group << ":";
+        for (unsigned int i = 0; i < m_user.heater_names.size(); ++i) {
+            if (it->second.test(i))
+                msg << " " << m_user.heater_names[i];
+        }
+        reply.lines.push_back(msg.str());
+    } else if (content.rfind("SCHEDULE DEFAULT ", 0) == 0) {
+        Schedule schedule;
+        if (!schedule.parse(content.substr(17))) {
+            reply.lines.push_back("Invalid schedule");
+            return false;
+        }
+
+        m_user.default_schedule = schedule;
+        reply.state_changed = true;
+        reply.lines.push_back("SCHEDULE DEFAULT " + schedule.toString());
+        reply.lines.push_back(next_transition_str(schedule));
+    } else if (content.rfind("SCHEDULE HEATER ", 0) == 0) {
+        std::string name = content.substr(16);
+        std::string spec;
+        size_t pos = name.find(' ');
+        if (pos != std::string::npos) {
+            spec = name.substr(pos + 1);
+            name = name.substr(0, pos);
+        }
+
+        if (!check_heater_name(name)) {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+
+        Schedule schedule;
+        if (!schedule.parse(spec)) {
+            reply.lines.push_back("Invalid schedule");
+            return false;
+        }
+
+        m_user.heater_schedules[name] = schedule;
+        reply.state_changed = true;
+        reply.lines.push_back("SCHEDULE HEATER " + name + " " + schedule.toString());
+        reply.lines.push_back(next_transition_str(schedule));
+    } else if (content == "GET SCHEDULE DEFAULT") {
+        if (m_user.default_schedule.empty()) {
+            reply.lines.push_back("No default schedule");
+        } else {
+            reply.lines.push_back("SCHEDULE DEFAULT " + m_user.default_schedule.toString());
+            reply.lines.push_back(next_transition_str(m_user.default_schedule));
+        }
+    } else if (content.rfind("GET SCHEDULE HEATER ", 0) == 0) {
+        std::string name = content.substr(20);
+
+        if (!check_heater_name(name)) {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+
+        auto it = m_user.heater_schedules.find(name);
+        if (it == m_user.heater_schedules.end()) {
+            reply.lines.push_back("No schedule for heater " + name);
+        } else {
+            reply.lines.push_back("SCHEDULE HEATER " + name + " " + it->second.toString());
+            reply.lines.push_back(next_transition_str(it->second));
+        }
+    } else if (content == "CLEAR SCHEDULE DEFAULT") {
+        m_user.default_schedule = Schedule();
+        reply.state_changed = true;
+        reply.lines.push_back("Default schedule removed");
+    } else if (content.rfind("CLEAR SCHEDULE HEATER ", 0) == 0) {
+        std::string name = content.substr(22);
+
+        if (!check_heater_name(name)) {
+            reply.lines.push_back("Invalid heater name");
+            return false;
+        }
+
+        m_user.heater_schedules.erase(name);
+        reply.state_changed = true;
+        reply.lines.push_back("Schedule of heater " + name + " removed");
+    } else if (content == "LOCK") {
+        if (m_user.phone_whitelist.find(from) != m_user.phone_whitelist.end()) {
+            reply.lines.push_back("LOCKED");
+            m_user.locked = true;
+        } else {
+            reply.lines.push_back("Cannot lock: phone number is not whitelisted. Use ADD PHONE command.");
+            return false;
+        }
+    } else if (content.rfind("UNLOCK ", 0) == 0) {
+        std::istringstream iss(content);
+        std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
+                                        std::istream_iterator<std::string>{}};
+        Logger::debug(tokens[1]);
+        if (tokens.size() >= 2) {
+            if (tokens[1] == BASE_STATION_PIN) {
+                reply.lines.push_back("UNLOCKED");
+                m_user.locked = false;
+            } else {
+                reply.lines.push_back("Wrong PIN");
+                return false;
+            }
+        }
+    } else if (content.rfind("ADD PHONE ", 0) == 0) {
+        if (!m_user.locked) {
+            std::istringstream iss(content);
+            std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
+                                            std::istream_iterator<std::string>{}};
+            if (tokens.size() == 3) {
+                std::string phone_number = tokens[2];
+                if (check_phone_number_format(phone_number)) {
+                    m_user.phone_whitelist.insert(phone_number);
+                    std::stringstream ss;
+                    ss << "Phone number \"" << phone_number << "\" added to whitelist";
+                    reply.lines.push_back(ss.str());
+                    reply.state_changed = true;
+                } else {
+                    std::stringstream ss;
+                    ss << "Phone number \"" << phone_number << "\" is not valid. Phone numbers must follow this format: (country code)(9-10 digits). Example: 3310203040506";
+                    reply.lines.push_back(ss.str());
+                    return false;
+                }
+            }
+        }
+    } else if (content.rfind("REMOVE PHONE ", 0) == 0) {
+        if (!m_user.locked) {
+            std::istringstream iss(content);
+            std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
+                                            std::istream_iterator<std::string>{}};
+            if (tokens.size() == 3) {
+                m_user.phone_whitelist.erase(tokens[2]);
+                std::stringstream ss;
+                ss << "Phone number \"" << tokens[2] << "\" removed from whitelist";
+                reply.lines.push_back(ss.str());
+                reply.state_changed = true;
+            }
+        }
+    } else if (content.rfind("SET EMERGENCY PHONE ", 0) == 0) {
+        std::istringstream iss(content);
+        std::vector<std::string> tokens{std::istream_iterator<std::string>{iss},
+                                        std::istream_iterator<std::string>{}};
+        if (tokens.size() == 4) {
+            std::string phone_number = tokens[3];
+            if (check_phone_number_format(phone_number)) {
+                m_user.emergency_phone = phone_number;
+                std::stringstream ss;
+                ss << phone_number << " set as emergency phone number.";
+                reply.lines.push_back(ss.str());
+                reply.state_changed = true;
+            } else {
+                std::stringstream ss;
+                ss << "Phone number \"" << phone_number << "\" is not valid. Phone numbers must follow this format: (country code)(9-10 digits). Example: 3310203040506";
+                reply.lines.push_back(ss.str());
+                return false;
+            }
+        }
+    } else if (content == "REMOVE EMERGENCY PHONE") {
+        if (!m_user.emergency_phone.empty()) {
+            Logger::info("Removed emergency phone");
+            reply.lines.push_back("Emergency phone removed");
+        }
+        m_user.emergency_phone.clear();
+    } else if (content.rfind("HELP") == 0) {
+        std::stringstream ss;
+        ss << "Basic commands:\n";
+        ss << "ALL OFF\n";
+        ss << "ALL ECO\n";
+        ss << "ALL COMFORT\n";
+        ss << "ALL DEFROST\n";
+        ss << "Separate commands with ';' to send several at once.\n";
+        reply.lines.push_back(ss.str());
+    } else if (content == "DEBUG FILESTATE") {
+        std::ifstream file(m_state_file_path);
+        std::string line;
+        std::stringstream msg;
+        while(std::getline(file, line)) {
+            msg << line << '\n';
+        }
+        reply.lines.push_back(msg.str());
+    } else if (content == "DEBUG STATE") {
+        std::stringstream msg;
+        switch (m_user.heater_default_state) {
+        case HEATER_OFF: msg << "DEFAULT: OFF\n"; break;
+        case HEATER_DEFROST: msg << "DEFAULT: DEFROST\n"; break;
+        case HEATER_ECO: msg << "DEFAULT: ECO\n"; break;
+        case HEATER_COMFORT: msg << "DEFAULT: COMFORT/ON\n"; break;
+        }
+
+        for (auto &e : m_user.heater_state) {
+            switch (e.second) {
+            case HEATER_OFF: msg << "HEATER " << e.first << ": OFF\n"; break;
+            case HEATER_DEFROST: msg << "HEATER " << e.first << ": DEFROST\n"; break;
+            case HEATER_ECO: msg << "HEATER " << e.first << ": ECO\n"; break;
+            case HEATER_COMFORT: msg << "HEATER " << e.first << ": COMFORT/ON\n"; break;
+            }
+        }
+
+        for (auto &e : m_user.groups) {
+            msg << "GROUP " << e.first << ":";
+            for (unsigned int i = 0; i < m_user.heater_names.size(); ++i) {
+                if (e.second.test(i))
+                    msg << " " << m_user.heater_names[i];
+            }
+            msg << '\n';
+        }
+
+        for (auto &e : m_user.heater_lost_threshold)
+            msg << "LOST THRESHOLD " << e.first << ": " << e.second / 60 << "min\n";
+
+        if (m_user.quiet_start != m_user.quiet_end)
+            msg << "QUIET HOURS: " << time_of_day_str(m_user.quiet_start) << "-" << time_of_day_str(m_user.quiet_end) << '\n';
+
+        if (!m_user.default_schedule.empty())
+            msg << "SCHEDULE DEFAULT: " << m_user.default_schedule.toString() << '\n';
+        for (auto &e : m_user.heater_schedules)
+            msg << "SCHEDULE HEATER " << e.first << ": " << e.second.toString() << '\n';
+        reply.lines.push_back(msg.str());
+    } else if (content == "DEBUG REBOOT") {
+        /* Reboot once the whole batch has been applied and saved */
+        reply.reboot = true;
+    } else if (content == "DEBUG UPTIME") {
+        reply.lines.push_back(get_uptime_str());
+    } else {
+        std::stringstream ss;
+        ss << "Received invalid message from: " << from;
+        Logger::warn(ss.str());
+        reply.lines.push_back("Received invalid command");
+        return false;
+    }
+
+    return true;
+}
+
+void BaseStation::sendHeaterState(int fd, HeaterState state, unsigned int poll_period)
+{
+    message_header_t header;
+    header.version = 1;
+    header.type = MessageType::HEATER_STATE_REPLY;
+
+    if (!get_mac_address(header.mac_addr, NETWORK_INTERFACE_NAME))
+        memset(header.mac_addr, 0, sizeof(header.mac_addr));
+    header.counter = m_message_counter++;
+
+    uint8_t data[MESSAGE_SIZE];
+    memset(data, 0xFF, sizeof(data));
+    memcpy(data, &header, sizeof(header));
+    data[sizeof(header)] = state;
+    data[sizeof(header) + 1] = poll_period & 0xFF;
+    data[sizeof(header) + 2] = (poll_period >> 8) & 0xFF;
+
+    int sent = 0;
+    while (sent < MESSAGE_SIZE) {
+        int ret = write(fd, &data[sent], MESSAGE_SIZE - sent);
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+    if (sent != MESSAGE_SIZE)
+        Logger::err("Failed to send heater state");
+    else
+        Logger::debug("Sent heater state reply to heater controller");
 }
 
 void BaseStation::checkWifi()
@@ -1282,19 +1950,19 @@ void BaseStation::checkWifi()
                     ss << "Lost WiFi connection for past " << hours << 'h' << mins << 'm' << secs << 's';
                     Logger::err(ss.str());
 
-                    if (!m_emergency_phone.empty()) {
+                    if (!m_user.emergency_phone.empty()) {
                         std::stringstream ss;
                         ss << "Error! Base station lost WiFi connection for past ";
                         ss << hours << 'h' << mins << 'm' << secs << "s. ";
                         ss << "Heaters cannot be controlled (they will switch to DEFROST mode automatically).";
-                        SMSSender::instance().sendSMS(m_emergency_phone, ss.str());
+                        SMSSender::instance().sendSMS(m_user.emergency_phone, ss.str(), SMS_PRIORITY_ALERT);
                     }
                 }
             } else {
                 if (m_wifi_error_counter) {
                     Logger::info("WiFi connection restored");
-                    if (!m_emergency_phone.empty())
-                        SMSSender::instance().sendSMS(m_emergency_phone, "Base station restored WiFi connection. System is now running ok.");
+                    if (!m_user.emergency_phone.empty())
+                        SMSSender::instance().sendSMS(m_user.emergency_phone, "Base station restored WiFi connection. System is now running ok.", SMS_PRIORITY_ALERT);
                 }
                 m_wifi_error_counter = 0;
             }
@@ -1321,24 +1989,37 @@ void BaseStation::checkLostDevices()
     read(fds[0].fd, &_, sizeof(_));
 
     time_t now = time(NULL);
-    std::map<uint64_t, std::string> lost_devices;
+    std::map<uint64_t, std::pair<std::string, unsigned int>> lost_devices;    /* MAC -> name, threshold */
     {
         std::lock_guard<std::mutex> guard(m_heaters_mutex);
-        auto it = m_heaters.begin();
-        while (it != m_heaters.end()) {
-            if (now - it->second.getLastRequestTimestamp() < DEVICE_LOST_THRESHOLD) {
-                ++it;
-                continue;
+        auto list_it = m_seen_lists.begin();
+        while (list_it != m_seen_lists.end()) {
+            unsigned int threshold = list_it->first;
+            std::list<uint64_t> &seen = list_it->second;
+
+            /* List is sorted, stop at the first heater seen recently */
+            while (!seen.empty()) {
+                uint64_t mac = seen.front();
+                auto it = m_heaters.find(mac);
+                if (now - it->second.getLastRequestTimestamp() < threshold)
+                    break;
+
+                lost_devices[mac] = std::make_pair(it->second.getName(), threshold);
+                m_heaters.erase(it);
+                m_seen.erase(mac);
+                seen.pop_front();
             }
 
-            lost_devices[it->first] = it->second.getName();
-            it = m_heaters.erase(it);
+            if (seen.empty())
+                list_it = m_seen_lists.erase(list_it);
+            else
+                ++list_it;
         }
     }
 
     for (const auto& it : lost_devices) {
         uint64_t mac = it.first;
-        const std::string &name = it.second;
+        const std::string &name = it.second.first;
 
         uint8_t mac_addr[6];
         mac_addr[0] = mac >> 40;
@@ -1356,7 +2037,7 @@ void BaseStation::checkLostDevices()
         macToStr(ss, mac_addr);
         ss << " for more than ";
 
-        unsigned int secs = DEVICE_LOST_THRESHOLD;
+        unsigned int secs = it.second.second;
         unsigned int hours = secs / (60 * 60);
         secs -= hours * 60 * 60;
         unsigned int mins = secs / 60;
@@ -1365,16 +2046,16 @@ void BaseStation::checkLostDevices()
         Logger::warn(ss.str());
     }
 
-    if (!m_emergency_phone.empty() && !lost_devices.empty()) {
+    if (!m_user.emergency_phone.empty() && !lost_devices.empty()) {
         std::stringstream ss;
         if (lost_devices.size() > 1)
-            ss << "WARNING! Lost connection with %d devices: ";
+            ss << "WARNING! Lost connection with " << lost_devices.size() << " devices: ";
         else
             ss << "WARNING! Lost connection with one device: ";
 
         auto it = lost_devices.begin();
         while (it != lost_devices.end()) {
-            const std::string &name = it->second;
+            const std::string &name = it->second.first;
             if (!name.empty()) {
                 ss << name;
             } else {
@@ -1394,7 +2075,132 @@ void BaseStation::checkLostDevices()
                 ss << ", ";
         }
 
-        SMSSender::instance().sendSMS(m_emergency_phone, ss.str());
+        SMSSender::instance().sendSMS(m_user.emergency_phone, ss.str(), SMS_PRIORITY_ALERT);
+    }
+}
+
+unsigned int BaseStation::getLostThreshold(const std::string &name) const
+{
+    auto it = m_user.heater_lost_threshold.find(name);
+    if (it != m_user.heater_lost_threshold.end())
+        return it->second;
+
+    return DEVICE_LOST_THRESHOLD;
+}
+
+/* Seconds left until the end of quiet hours, 0 if not in quiet hours */
+unsigned int BaseStation::getQuietTimeLeft(time_t now) const
+{
+    if (m_user.quiet_start == m_user.quiet_end)
+        return 0;
+
+    struct tm tm;
+    localtime_r(&now, &tm);
+    unsigned int minute = tm.tm_hour * 60 + tm.tm_min;
+    unsigned int since_start = (minute + 24 * 60 - m_user.quiet_start) % (24 * 60);
+    unsigned int length = (m_user.quiet_end + 24 * 60 - m_user.quiet_start) % (24 * 60);
+    if (since_start >= length)
+        return 0;
+
+    return (length - since_start) * 60 - tm.tm_sec;
+}
+
+/*
+ * Delay before the next request of a heater, sent in HEATER_STATE_REPLY.
+ * Heaters poll faster for a while after a command and slower during
+ * quiet hours. Each heater polls in its own slot of the period so that
+ * requests are spread out, even after a power cut.
+ */
+unsigned int BaseStation::getPollPeriod(uint64_t mac, const std::string &name) const
+{
+    time_t now = time(nullptr);
+    if (now < m_fast_poll_until)
+        return FAST_POLL_PERIOD;
+
+    unsigned int delay;
+    unsigned int quiet_time_left = getQuietTimeLeft(now);
+    if (quiet_time_left > 0) {
+        /* Heater must not be reported lost because it was told to wait */
+        unsigned int period = std::min((unsigned int)QUIET_POLL_PERIOD, getLostThreshold(name) / 2);
+        delay = slot_delay(mac, now, period / 2, period);
+
+        /* Back to normal period once quiet hours are over */
+        if (delay > quiet_time_left)
+            delay = slot_delay(mac, now, quiet_time_left, POLL_PERIOD);
+    } else {
+        delay = slot_delay(mac, now, POLL_PERIOD / 2, POLL_PERIOD);
+    }
+
+    /* Poll right after the next scheduled transition */
+    const Schedule *schedule = &m_user.default_schedule;
+    auto it = m_user.heater_schedules.find(name);
+    if (it != m_user.heater_schedules.end())
+        schedule = &it->second;
+    if (!schedule->empty()) {
+        HeaterState state;
+        time_t next = schedule->getNextTransition(now, state);
+        if (next - now + 1 < delay)
+            delay = next - now + 1;
+    }
+
+    if (delay < POLL_PERIOD_MIN)
+        delay = POLL_PERIOD_MIN;
+    if (delay > POLL_PERIOD_MAX)
+        delay = POLL_PERIOD_MAX;
+
+    return delay;
+}
+
+/* Move heater to the back of the list matching its lost threshold */
+void BaseStation::trackHeater(uint64_t mac, const std::string &name)
+{
+    unsigned int threshold = getLostThreshold(name);
+    std::list<uint64_t> &seen = m_seen_lists[threshold];
+
+    auto it = m_seen.find(mac);
+    if (it == m_seen.end()) {
+        SeenEntry entry;
+        entry.threshold = threshold;
+        entry.pos = seen.insert(seen.end(), mac);
+        m_seen[mac] = entry;
+        return;
+    }
+
+    std::list<uint64_t> &old_seen = m_seen_lists[it->second.threshold];
+    seen.splice(seen.end(), old_seen, it->second.pos);
+    if (old_seen.empty())
+        m_seen_lists.erase(it->second.threshold);
+    it->second.threshold = threshold;
+}
+
+/*
+ * Move heaters whose lost threshold was changed to their new list,
+ * keeping it sorted by last request timestamp.
+ */
+void BaseStation::updateLostThresholds()
+{
+    std::lock_guard<std::mutex> guard(m_heaters_mutex);
+
+    for (auto &e : m_seen) {
+        const Heater &h = m_heaters[e.first];
+        unsigned int threshold = getLostThreshold(h.getName());
+        if (threshold == e.second.threshold)
+            continue;
+
+        std::list<uint64_t> &old_seen = m_seen_lists[e.second.threshold];
+        std::list<uint64_t> &seen = m_seen_lists[threshold];
+        auto pos = seen.end();
+        while (pos != seen.begin()) {
+            auto prev = std::prev(pos);
+            if (m_heaters[*prev].getLastRequestTimestamp() <= h.getLastRequestTimestamp())
+                break;
+            pos = prev;
+        }
+
+        seen.splice(pos, old_seen, e.second.pos);
+        if (old_seen.empty())
+            m_seen_lists.erase(e.second.threshold);
+        e.second.threshold = threshold;
     }
 }
 
@@ -1428,9 +2234,12 @@ void BaseStation::check3G()
                 Logger::err(ss.str());
             }
 
-            m_heater_default_state = FALLBACK_HEATER_STATE;
-            for (auto &it : m_heater_state)
-                it.second = FALLBACK_HEATER_STATE;
+            {
+                std::lock_guard<std::mutex> guard(m_user_mutex);
+                m_user.heater_default_state = FALLBACK_HEATER_STATE;
+                for (auto &it : m_user.heater_state)
+                    it.second = FALLBACK_HEATER_STATE;
+            }
 
             {
                 std::stringstream ss;
@@ -1462,7 +2271,7 @@ void BaseStation::check3G()
 
                 ss << " mode due to earlier 3G module errors";
                 Logger::info(ss.str());
-                SMSSender::instance().sendSMS(m_emergency_phone, ss.str());
+                SMSSender::instance().sendSMS(m_user.emergency_phone, ss.str(), SMS_PRIORITY_ALERT);
             }
 
             m_3g_error_counter = 0;
@@ -1501,9 +2310,12 @@ void BaseStation::checkSMSDaemon()
                 Logger::err(ss.str());
             }
 
-            m_heater_default_state = FALLBACK_HEATER_STATE;
-            for (auto &it : m_heater_state)
-                it.second = FALLBACK_HEATER_STATE;
+            {
+                std::lock_guard<std::mutex> guard(m_user_mutex);
+                m_user.heater_default_state = FALLBACK_HEATER_STATE;
+                for (auto &it : m_user.heater_state)
+                    it.second = FALLBACK_HEATER_STATE;
+            }
 
             {
                 std::stringstream ss;
@@ -1533,8 +2345,8 @@ void BaseStation::checkSMSDaemon()
 
                 ss << " mode due to earlier 3G module errors";
                 Logger::info(ss.str());
-                if (!m_emergency_phone.empty())
-                    SMSSender::instance().sendSMS(m_emergency_phone, ss.str());
+                if (!m_user.emergency_phone.empty())
+                    SMSSender::instance().sendSMS(m_user.emergency_phone, ss.str(), SMS_PRIORITY_ALERT);
         }
         m_daemon_error_counter = 0;
     }
@@ -1555,11 +2367,11 @@ void BaseStation::sendBootMsg()
     uint64_t _;
     read(fds[0].fd, &_, sizeof(_));
 
-    if (!m_emergency_phone.empty()) {
+    if (!m_user.emergency_phone.empty()) {
         std::stringstream msg;
         msg << "INFO! Base station software started\n";
         msg << "Default heater state: ";
-        switch (m_heater_default_state) {
+        switch (m_user.heater_default_state) {
         case HEATER_OFF: msg << "OFF"; break;
         case HEATER_DEFROST: msg << "DEFROST"; break;
         case HEATER_ECO: msg << "ECO"; break;
@@ -1567,7 +2379,7 @@ void BaseStation::sendBootMsg()
         default: msg << "UNKNOWN"; break;
         }
         msg << '\n';
-        for (const auto& it : m_heater_state) {
+        for (const auto& it : m_user.heater_state) {
             msg << "Heater " << it.first << " state: ";
             switch (it.second) {
             case HEATER_OFF: msg << "OFF"; break;
@@ -1578,7 +2390,7 @@ void BaseStation::sendBootMsg()
             }
             msg << '\n';
         }
-        SMSSender::instance().sendSMS(m_emergency_phone, msg.str());
+        SMSSender::instance().sendSMS(m_user.emergency_phone, msg.str(), SMS_PRIORITY_ALERT);
     }
 }
 
@@ -1600,11 +2412,215 @@ void BaseStation::cleanupSMS()
     SMSSender::instance().cleanupSMS();
 }
 
+/*
+ * Only the next transition of each schedule is queued, so checking
+ * schedules is a look at the front of m_schedule_events.
+ */
+void BaseStation::armSchedules()
+{
+    time_t now = time(nullptr);
+    HeaterState state;
+
+    m_schedule_events.clear();
+    if (!m_user.default_schedule.empty())
+        m_schedule_events.emplace(m_user.default_schedule.getNextTransition(now, state), std::string());
+    for (auto &e : m_user.heater_schedules)
+        m_schedule_events.emplace(e.second.getNextTransition(now, state), e.first);
+
+    armScheduleTimer();
+}
+
+void BaseStation::armScheduleTimer()
+{
+    if (m_schedule_events.empty()) {
+        m_schedule_timer.stop();
+        return;
+    }
+
+    /*
+     * Wake up at least every minute to follow changes of the
+     * system time (i.e. after NTP synchronisation at boot).
+     */
+    time_t now = time(nullptr);
+    time_t next = m_schedule_events.begin()->first;
+    unsigned int delay = SCHEDULE_TIMER_MAX_PERIOD;
+    if (next <= now)
+        delay = 1;
+    else if (next - now < SCHEDULE_TIMER_MAX_PERIOD / 1000)
+        delay = (next - now) * 1000;
+
+    m_schedule_timer.start(delay, false);
+}
+
+void BaseStation::checkSchedules()
+{
+    struct pollfd fds[1];
+
+    fds[0].fd = m_schedule_timer.getFD();
+    fds[0].events = POLLIN;
+
+    int ret = poll(fds, sizeof(fds)/sizeof(fds[0]), 0);
+    if (ret <= 0)
+        return;
+
+    /* Dummy read with timer fd to clear event */
+    uint64_t _;
+    read(fds[0].fd, &_, sizeof(_));
+
+    std::lock_guard<std::mutex> guard(m_user_mutex);
+    time_t now = time(nullptr);
+    bool state_changed = false;
+    while (!m_schedule_events.empty() && m_schedule_events.begin()->first <= now) {
+        std::string name = m_schedule_events.begin()->second;
+        m_schedule_events.erase(m_schedule_events.begin());
+
+        const Schedule *schedule = &m_user.default_schedule;
+        if (!name.empty()) {
+            auto it = m_user.heater_schedules.find(name);
+            if (it == m_user.heater_schedules.end())
+                continue;
+            schedule = &it->second;
+        }
+
+        /*
+         * If the system time jumped, skip transitions that
+         * are already over and only apply the last one.
+         */
+        HeaterState state;
+        schedule->getPreviousTransition(now, state);
+        applyScheduledState(name, state);
+        state_changed = true;
+
+        m_schedule_events.emplace(schedule->getNextTransition(now, state), name);
+    }
+
+    if (state_changed)
+        saveState();
+
+    armScheduleTimer();
+}
+
+/*
+ * Apply transitions that happened while the base station was not
+ * running, that is since the state file was last saved.
+ */
+void BaseStation::catchUpSchedules(time_t since)
+{
+    time_t now = time(nullptr);
+    bool state_changed = false;
+    HeaterState state;
+
+    if (!m_user.default_schedule.empty() && m_user.default_schedule.getPreviousTransition(now, state) > since) {
+        applyScheduledState(std::string(), state);
+        state_changed = true;
+    }
+
+    for (auto &e : m_user.heater_schedules) {
+        if (e.second.getPreviousTransition(now, state) > since) {
+            applyScheduledState(e.first, state);
+            state_changed = true;
+        }
+    }
+
+    if (state_changed)
+        saveState();
+}
+
+/*
+ * A scheduled transition overrides the state set by SMS. The default
+ * schedule behaves like ALL commands for heaters without their own
+ * schedule.
+ */
+void BaseStation::applyScheduledState(const std::string &name, HeaterState state)
+{
+    std::stringstream ss;
+    if (name.empty()) {
+        m_user.heater_default_state = state;
+        for (auto &e : m_user.heater_state) {
+            if (m_user.heater_schedules.find(e.first) == m_user.heater_schedules.end())
+                e.second = state;
+        }
+        ss << "Scheduled transition: ALL " << state_to_str(state);
+    } else {
+        m_user.heater_state[name] = state;
+        ss << "Scheduled transition: HEATER " << name << " " << state_to_str(state);
+    }
+    Logger::info(ss.str());
+}
+
+int BaseStation::getHeaterIndex(const std::string &name) const
+{
+    auto it = m_user.heater_index.find(name);
+    if (it == m_user.heater_index.end())
+        return -1;
+
+    return it->second;
+}
+
+/* Return index of heater, assigning one if needed, or -1 if no index is left */
+int BaseStation::addHeaterIndex(const std::string &name)
+{
+    int index = getHeaterIndex(name);
+    if (index >= 0)
+        return index;
+
+    /* Reuse index of a heater that left all groups */
+    auto it = std::find(m_user.heater_names.begin(), m_user.heater_names.end(), std::string());
+    if (it != m_user.heater_names.end()) {
+        index = it - m_user.heater_names.begin();
+        *it = name;
+    } else if (m_user.heater_names.size() < GROUP_MAX_HEATER_COUNT) {
+        index = m_user.heater_names.size();
+        m_user.heater_names.push_back(name);
+    } else {
+        return -1;
+    }
+
+    m_user.heater_index[name] = index;
+    return index;
+}
+
+/* Release index of heater once it does not belong to any group */
+void BaseStation::removeHeaterIndex(const std::string &name)
+{
+    int index = getHeaterIndex(name);
+    if (index < 0)
+        return;
+
+    for (auto &e : m_user.groups) {
+        if (e.second.test(index))
+            return;
+    }
+
+    m_user.heater_index.erase(name);
+    m_user.heater_names[index].clear();
+}
+
+/* Takes user state as the web server thread works on a copy */
+std::string BaseStation::getHeaterGroups(const UserState &user, const std::string &name)
+{
+    auto it = user.heater_index.find(name);
+    if (it == user.heater_index.end())
+        return std::string();
+
+    unsigned int index = it->second;
+    std::string groups;
+    for (auto &e : user.groups) {
+        if (e.second.test(index)) {
+            if (!groups.empty())
+                groups += ", ";
+            groups += e.first;
+        }
+    }
+
+    return groups;
+}
+
 bool BaseStation::loadState()
 {
-    std::ifstream file(STATE_FILE_PATH);
+    std::ifstream file(m_state_file_path);
     if (!file) {
-        Logger::err("Could not load state from file " STATE_FILE_PATH);
+        Logger::err("Could not load state from file " + m_state_file_path);
         return false;
     }
 
@@ -1627,15 +2643,15 @@ bool BaseStation::loadState()
             [] (unsigned char c){ return !std::isspace(c); }).base(), val.end());
         if (key == "default_heater_state") {
             if (val == "off")
-                m_heater_default_state = HEATER_OFF;
+                m_user.heater_default_state = HEATER_OFF;
             else if (val == "defrost")
-                m_heater_default_state = HEATER_DEFROST;
+                m_user.heater_default_state = HEATER_DEFROST;
             else if (val == "eco")
-                m_heater_default_state = HEATER_ECO;
+                m_user.heater_default_state = HEATER_ECO;
             else if (val == "comfort")
-                m_heater_default_state = HEATER_COMFORT;
+                m_user.heater_default_state = HEATER_COMFORT;
             else {
-                m_heater_default_state = HEATER_DEFROST;
+                m_user.heater_default_state = HEATER_DEFROST;
                 Logger::err("Invalid value for default_heater_state key. Setting default_heater_state to DEFROST.");
             }
         } else if (key.rfind("heater_", 0) == 0
@@ -1647,13 +2663,13 @@ bool BaseStation::loadState()
                     name[i] = toupper(name[i]);
 
                 if (val == "off")
-                    m_heater_state[name] = HEATER_OFF;
+                    m_user.heater_state[name] = HEATER_OFF;
                 else if (val == "defrost")
-                    m_heater_state[name] = HEATER_DEFROST;
+                    m_user.heater_state[name] = HEATER_DEFROST;
                 else if (val == "eco")
-                    m_heater_state[name] = HEATER_ECO;
+                    m_user.heater_state[name] = HEATER_ECO;
                 else if (val == "comfort")
-                    m_heater_state[name] = HEATER_COMFORT;
+                    m_user.heater_state[name] = HEATER_COMFORT;
                 else {
                     std::stringstream msg;
                     msg << "Invalid value \"" << val << "\" for heater " << name;
@@ -1664,12 +2680,123 @@ bool BaseStation::loadState()
                 msg << "Invalid heater name \"" << name << "\".";
                 Logger::warn(msg.str());
             }
+        } else if (key.rfind("heater_", 0) == 0
+                && ends_with(key, "_lost_threshold")) {
+            std::string name = key.substr(7, key.length() - 7 - 15);
+
+            if (check_heater_name(name)) {
+                for (unsigned int i = 0; i < name.length(); ++i)
+                    name[i] = toupper(name[i]);
+
+                char *end;
+                long threshold = strtol(val.c_str(), &end, 10);
+                if (!val.empty() && *end == '\0'
+                &&  threshold >= DEVICE_LOST_THRESHOLD_MIN * 60 && threshold <= DEVICE_LOST_THRESHOLD_MAX * 60) {
+                    m_user.heater_lost_threshold[name] = threshold;
+                } else {
+                    std::stringstream msg;
+                    msg << "Invalid lost threshold \"" << val << "\" for heater " << name;
+                    Logger::warn(msg.str());
+                }
+            } else {
+                std::stringstream msg;
+                msg << "Invalid heater name \"" << name << "\".";
+                Logger::warn(msg.str());
+            }
+        } else if (key.rfind("heater_", 0) == 0
+                && ends_with(key, "_power")) {
+            std::string name = key.substr(7, key.length() - 7 - 6);
+
+            if (check_heater_name(name)) {
+                for (unsigned int i = 0; i < name.length(); ++i)
+                    name[i] = toupper(name[i]);
+
+                char *end;
+                long power = strtol(val.c_str(), &end, 10);
+                if (!val.empty() && *end == '\0' && power > 0 && power <= HEATER_MAX_POWER) {
+                    m_user.heater_power[name] = power;
+                } else {
+                    std::stringstream msg;
+                    msg << "Invalid power \"" << val << "\" for heater " << name;
+                    Logger::warn(msg.str());
+                }
+            } else {
+                std::stringstream msg;
+                msg << "Invalid heater name \"" << name << "\".";
+                Logger::warn(msg.str());
+            }
+        } else if (key == "quiet_hours") {
+            size_t sep = val.find('-');
+            unsigned int start, end;
+            if (sep != std::string::npos
+            &&  parse_time_of_day(val.substr(0, sep), start)
+            &&  parse_time_of_day(val.substr(sep + 1), end)) {
+                m_user.quiet_start = start;
+                m_user.quiet_end = end;
+            } else {
+                std::stringstream msg;
+                msg << "Invalid quiet hours \"" << val << "\"";
+                Logger::warn(msg.str());
+            }
+        } else if (key == "default_schedule") {
+            for (auto & c: val) c = toupper(c);
+            if (!m_user.default_schedule.parse(val)) {
+                std::stringstream msg;
+                msg << "Invalid default schedule \"" << val << "\"";
+                Logger::warn(msg.str());
+            }
+        } else if (key.rfind("heater_", 0) == 0
+                && ends_with(key, "_schedule")) {
+            std::string name = key.substr(7, key.length() - 7 - 9);
+
+            if (check_heater_name(name)) {
+                for (unsigned int i = 0; i < name.length(); ++i)
+                    name[i] = toupper(name[i]);
+                for (auto & c: val) c = toupper(c);
+
+                Schedule schedule;
+                if (schedule.parse(val)) {
+                    m_user.heater_schedules[name] = schedule;
+                } else {
+                    std::stringstream msg;
+                    msg << "Invalid schedule \"" << val << "\" for heater " << name;
+                    Logger::warn(msg.str());
+                }
+            } else {
+                std::stringstream msg;
+                msg << "Invalid heater name \"" << name << "\".";
+                Logger::warn(msg.str());
+            }
+        } else if (key.rfind("group_", 0) == 0) {
+            std::string group = key.substr(6);
+            for (auto & c: group) c = toupper(c);
+            for (auto & c: val) c = toupper(c);
+
+            if (!check_heater_name(group)) {
+                std::stringstream msg;
+                msg << "Invalid group name \"" << group << "\".";
+                Logger::warn(msg.str());
+                continue;
+            }
+
+            std::istringstream iss(val);
+            std::string name;
+            while (std::getline(iss, name, ',')) {
+                int index = check_heater_name(name) ? addHeaterIndex(name) : -1;
+                if (index >= 0) {
+                    m_user.groups[group].set(index);
+                } else {
+                    std::stringstream msg;
+                    msg << "Cannot add heater \"" << name << "\" to group " << group;
+                    Logger::warn(msg.str());
+                }
+            }
         } else if (key == "whitelist") {
             std::istringstream iss(val);
             std::string item;
             while (std::getline(iss, item, ',')) {
                 if (check_phone_number_format(item)) {
-                    m_phone_whitelist.insert(item);
+                    m_user.phone_whitelist.insert(item);
                 } else {
                     std::stringstream msg;
                     msg << "Invalid phone number: " << item;
@@ -1678,7 +2805,7 @@ bool BaseStation::loadState()
             }
         } else if (key == "emergency_phone") {
             if (check_phone_number_format(val)) {
-                m_emergency_phone = val;
+                m_user.emergency_phone = val;
             } else {
                 std::stringstream msg;
                 msg << "Invalid emergency phone number: " << val;
@@ -1691,19 +2818,19 @@ bool BaseStation::loadState()
         }
     }
 
-    Logger::debug("Loaded state from file " STATE_FILE_PATH);
+    Logger::debug("Loaded state from file " + m_state_file_path);
 
     return true;
 }
 
 void BaseStation::saveState()
 {
-    std::ofstream file(STATE_FILE_PATH);
+    std::ofstream file(m_state_file_path);
     if (!file) {
-        Logger::err("Could not save state to file " STATE_FILE_PATH);
+        Logger::err("Could not save state to file " + m_state_file_path);
         return;
     }
-    switch (m_heater_default_state) {
+    switch (m_user.heater_default_state) {
     case HEATER_OFF:
         file << "default_heater_state=off\n";
         break;
@@ -1718,7 +2845,7 @@ void BaseStation::saveState()
         break;
     }
 
-    for (auto &e : m_heater_state) {
+    for (auto &e : m_user.heater_state) {
         switch (e.second) {
         case HEATER_OFF:
             file << "heater_" << e.first << "_state=off\n";
@@ -1735,17 +2862,45 @@ void BaseStation::saveState()
         }
     }
 
+    for (auto &e : m_user.heater_power)
+        file << "heater_" << e.first << "_power=" << e.second << '\n';
+
+    for (auto &e : m_user.heater_lost_threshold)
+        file << "heater_" << e.first << "_lost_threshold=" << e.second << '\n';
+
+    if (m_user.quiet_start != m_user.quiet_end)
+        file << "quiet_hours=" << time_of_day_str(m_user.quiet_start) << '-' << time_of_day_str(m_user.quiet_end) << '\n';
+
+    if (!m_user.default_schedule.empty())
+        file << "default_schedule=" << m_user.default_schedule.toString() << '\n';
+    for (auto &e : m_user.heater_schedules)
+        file << "heater_" << e.first << "_schedule=" << e.second.toString() << '\n';
+
+    for (auto &e : m_user.groups) {
+        file << "group_" << e.first << "=";
+        bool first = true;
+        for (unsigned int i = 0; i < m_user.heater_names.size(); ++i) {
+            if (!e.second.test(i))
+                continue;
+            if (!first)
+                file << ',';
+            file << m_user.heater_names[i];
+            first = false;
+        }
+        file << '\n';
+    }
+
     file << "whitelist=";
-    auto itor = m_phone_whitelist.begin();
-    while (itor != m_phone_whitelist.end()) {
+    auto itor = m_user.phone_whitelist.begin();
+    while (itor != m_user.phone_whitelist.end()) {
         file << *itor;
         ++itor;
-        if (itor != m_phone_whitelist.end())
+        if (itor != m_user.phone_whitelist.end())
             file << ',';
     }
     file << '\n';
 
-    file << "emergency_phone=" << m_emergency_phone << '\n';
+    file << "emergency_phone=" << m_user.emergency_phone << '\n';
 
-    Logger::debug("Saved state to file " STATE_FILE_PATH);
+    Logger::debug("Saved state to file " + m_state_file_path);
 }
@@ -2,7 +2,10 @@
 #define BASE_STATION_HPP
 
 #include "heater.hpp"
+#include "history_store.hpp"
+#include "schedule.hpp"
 #include "timer.hpp"
+#include <bitset>
 #include <cstdint>
 #include <ctime>
 #include <deque>
@@ -13,6 +16,11 @@
 #include <queue>
 #include <set>
 #include <string>
+#include <vector>
+
+#define GROUP_MAX_HEATER_COUNT  (64)
+
+typedef std::bitset<GROUP_MAX_HEATER_COUNT> HeaterSet;
 
 struct DeviceConnection {
     int fd;
@@ -21,7 +29,7 @@ struct DeviceConnection {
 
 class BaseStation {
 public:
-    BaseStation();
+    BaseStation(const std::string &state_file_path, const std::string &history_dir);
     ~BaseStation();
 
     void process();
@@ -29,25 +37,82 @@ public:
     void handleNewDevice(int fd);
     void handleSMSCommand(const std::string &from, const std::string &content);
     std::string buildWebpage();
+    std::string buildHistory(const std::string &heater, time_t from, time_t to, HistoryResolution resolution);
 
 private:
+    /* Outcome of the commands contained in one text message */
+    struct CommandReply {
+        std::vector<std::string> lines;
+        bool state_changed;
+        bool reboot;
+    };
+
+    /*
+     * State provided by the user, saved to the state file. A batch of
+     * commands is rolled back by restoring a copy of it.
+     */
+    struct UserState {
+        UserState();
+
+        HeaterState heater_default_state;
+        std::map<std::string, HeaterState> heater_state;
+        std::map<std::string, unsigned int> heater_power;  /* in watts */
+        std::map<std::string, unsigned int> heater_lost_threshold;   /* in seconds */
+        Schedule default_schedule;
+        std::map<std::string, Schedule> heater_schedules;
+
+        /*
+         * Group membership is a bitset over dense heater indices.
+         * Indices are assigned to heaters that belong to a group.
+         */
+        std::map<std::string, HeaterSet> groups;
+        std::map<std::string, unsigned int> heater_index;
+        std::vector<std::string> heater_names;    /* index -> name, empty if unused */
+
+        /* Quiet hours in minutes since midnight (local time), none if equal */
+        unsigned int quiet_start;
+        unsigned int quiet_end;
+
+        bool locked;
+        std::set<std::string> phone_whitelist;
+        std::string emergency_phone;
+    };
+
     void handleConnections();
 
     void parseMessage(DeviceConnection &conn, uint8_t *data);
     void parseCommands();
-    void sendVersion(const std::string &to);
+    bool executeCommand(const std::string &from, const std::string &content, CommandReply &reply);
     void checkStaleConnections();
-    void sendHeaterState(int fd, HeaterState state);
+    void sendHeaterState(int fd, HeaterState state, unsigned int poll_period);
     void checkWifi();
     void checkLostDevices();
+    void trackHeater(uint64_t mac, const std::string &name);
+    void updateLostThresholds();
+    unsigned int getLostThreshold(const std::string &name) const;
+    unsigned int getQuietTimeLeft(time_t now) const;
+    unsigned int getPollPeriod(uint64_t mac, const std::string &name) const;
     void check3G();
     void checkSMSDaemon();
     void sendBootMsg();
     void cleanupSMS();
 
+    void armSchedules();
+    void armScheduleTimer();
+    void checkSchedules();
+    void catchUpSchedules(time_t since);
+    void applyScheduledState(const std::string &name, HeaterState state);
+
+    int getHeaterIndex(const std::string &name) const;
+    int addHeaterIndex(const std::string &name);
+    void removeHeaterIndex(const std::string &name);
+    static std::string getHeaterGroups(const UserState &user, const std::string &name);
+
     bool loadState();
     void saveState();
 
+    std::string m_state_file_path;
+
     std::list<DeviceConnection> m_connections;
     std::mutex m_connections_mutex;
 
@@ -56,14 +121,20 @@ private:
 
     Timer m_stale_timer;
     
-    /* State provided by the user */
-    HeaterState m_heater_default_state;
-    std::map<std::string, HeaterState> m_heater_state;
+    UserState m_user;
+    /*
+     * Taken by the main thread while it modifies m_user, and by the web
+     * server thread while it copies it. The main thread reads m_user
+     * without it.
+     */
+    std::mutex m_user_mutex;
+
+    /* Next transition of each schedule -> heater name (empty for default schedule) */
+    std::multimap<time_t, std::string> m_schedule_events;
+    Timer m_schedule_timer;
 
-    bool m_locked;
-    std::set<std::string> m_phone_whitelist;
+    time_t m_fast_poll_until;
 
-    std::string m_emergency_phone;
     Timer m_check_wifi_timer;
     unsigned int m_wifi_error_counter;
 
@@ -71,6 +142,18 @@ private:
     std::map<uint64_t,uint64_t> m_heater_counter; /* MAC addr -> counter */
     std::map<uint64_t, Heater> m_heaters;   /* MAC -> Heater */
     std::mutex m_heaters_mutex;
+    HistoryStore m_history;
+
+    /*
+     * Heaters are kept in one list per lost threshold, least recently
+     * seen first, so that only the head of each list must be checked.
+     */
+    struct SeenEntry {
+        unsigned int threshold;
+        std::list<uint64_t>::iterator pos;
+    };
+    std::map<unsigned int, std::list<uint64_t>> m_seen_lists;   /* threshold -> MAC */
+    std::map<uint64_t, SeenEntry> m_seen;   /* MAC -> position in list */
     Timer m_lost_devices_timer;
 
     Timer m_check_3g_timer;
@@ -1,10 +1,48 @@
 #include "heater.hpp"
+#include <algorithm>
+
+const char *state_to_str(HeaterState state)
+{
+    switch (state) {
+    case HEATER_OFF: return "OFF";
+    case HEATER_DEFROST: return "DEFROST";
+    case HEATER_ECO: return "ECO";
+    case HEATER_COMFORT: return "COMFORT";
+    }
+
+    return "UNKNOWN";
+}
+
+bool str_to_state(const std::string &str, HeaterState &state)
+{
+    if (str == "OFF")
+        state = HEATER_OFF;
+    else if (str == "DEFROST")
+        state = HEATER_DEFROST;
+    else if (str == "ECO")
+        state = HEATER_ECO;
+    else if (str == "COMFORT" || str == "ON")
+        state = HEATER_COMFORT;
+    else
+        return false;
+
+    return true;
+}
+
+bool HeaterTelemetry::empty() const
+{
+    return !has_rssi && !has_uptime && !has_failures && !has_rtt && firmware_version.empty();
+}
 
 Heater::Heater(const std::string &name, const std::string &ip_addr):
 m_name(name),
 m_ip_addr(ip_addr),
 m_last_request_timestamp(0),
-m_state(HEATER_DEFROST)
+m_state(HEATER_DEFROST),
+m_telemetry(),
+m_aggregates(),
+m_rssi_sum(0),
+m_rtt_sum(0)
 {
 
 }
@@ -15,6 +53,93 @@ void Heater::update(HeaterState newState)
     m_state = newState;
 }
 
+void Heater::setAddress(const std::string &name, const std::string &ip_addr)
+{
+    m_name = name;
+    m_ip_addr = ip_addr;
+}
+
+void Heater::updateTelemetry(const HeaterTelemetry &telemetry)
+{
+    if (telemetry.empty())
+        return;
+
+    TelemetrySample sample = { telemetry, 0, false };
+    if (!m_telemetry.empty()) {
+        /* Counters restart from 0 when the heater controller reboots */
+        const HeaterTelemetry &prev = m_telemetry.back().telemetry;
+        if (prev.has_uptime && telemetry.has_uptime && telemetry.uptime < prev.uptime)
+            sample.reboot = true;
+        if (prev.has_failures && telemetry.has_failures)
+            sample.new_failures = telemetry.failures >= prev.failures ? telemetry.failures - prev.failures : telemetry.failures;
+    }
+
+    m_telemetry.push_back(sample);
+    m_aggregates.samples++;
+    m_aggregates.failures += sample.new_failures;
+    m_aggregates.reboots += sample.reboot ? 1 : 0;
+    if (telemetry.has_rssi) {
+        m_aggregates.rssi_min = m_aggregates.rssi_samples == 0 ? telemetry.rssi : std::min(m_aggregates.rssi_min, telemetry.rssi);
+        m_rssi_sum += telemetry.rssi;
+        m_aggregates.rssi_samples++;
+    }
+    if (telemetry.has_rtt) {
+        m_aggregates.rtt_max = std::max(m_aggregates.rtt_max, telemetry.rtt);
+        m_rtt_sum += telemetry.rtt;
+        m_aggregates.rtt_samples++;
+    }
+
+    bool range_evicted = false;
+    while (m_telemetry.size() > TELEMETRY_WINDOW) {
+        const HeaterTelemetry &oldest = m_telemetry.front().telemetry;
+        m_aggregates.samples--;
+        if (oldest.has_rssi) {
+            range_evicted = range_evicted || oldest.rssi == m_aggregates.rssi_min;
+            m_rssi_sum -= oldest.rssi;
+            m_aggregates.rssi_samples--;
+        }
+        if (oldest.has_rtt) {
+            range_evicted = range_evicted || oldest.rtt == m_aggregates.rtt_max;
+            m_rtt_sum -= oldest.rtt;
+            m_aggregates.rtt_samples--;
+        }
+        m_telemetry.pop_front();
+
+        /* Changes are counted on the newer sample of each pair, the new oldest one has no pair left */
+        TelemetrySample &front = m_telemetry.front();
+        m_aggregates.failures -= front.new_failures;
+        m_aggregates.reboots -= front.reboot ? 1 : 0;
+        front.new_failures = 0;
+        front.reboot = false;
+    }
+
+    /* Only rescan the window when the evicted sample held the minimum or maximum */
+    if (range_evicted)
+        updateTelemetryRange();
+
+    m_aggregates.rssi_avg = m_aggregates.rssi_samples > 0 ? m_rssi_sum / (long)m_aggregates.rssi_samples : 0;
+    m_aggregates.rtt_avg = m_aggregates.rtt_samples > 0 ? m_rtt_sum / m_aggregates.rtt_samples : 0;
+}
+
+void Heater::updateTelemetryRange()
+{
+    bool has_rssi = false;
+    m_aggregates.rtt_max = 0;
+
+    for (const auto &sample : m_telemetry) {
+        const HeaterTelemetry &t = sample.telemetry;
+        if (t.has_rssi) {
+            m_aggregates.rssi_min = has_rssi ? std::min(m_aggregates.rssi_min, t.rssi) : t.rssi;
+            has_rssi = true;
+        }
+        if (t.has_rtt)
+            m_aggregates.rtt_max = std::max(m_aggregates.rtt_max, t.rtt);
+    }
+
+    if (!has_rssi)
+        m_aggregates.rssi_min = 0;
+}
+
 std::string Heater::getName() const
 {
     return m_name;
@@ -34,3 +159,19 @@ HeaterState Heater::getState() const
 {
     return m_state;
 }
+
+bool Heater::hasTelemetry() const
+{
+    return !m_telemetry.empty();
+}
+
+const HeaterTelemetry &Heater::getLastTelemetry() const
+{
+    static const HeaterTelemetry none;
+    return m_telemetry.empty() ? none : m_telemetry.back().telemetry;
+}
+
+const TelemetryAggregates &Heater::getTelemetryAggregates() const
+{
+    return m_aggregates;
+}
@@ -1,7 +1,9 @@
 #ifndef HEATER_HPP
 #define HEATER_HPP
 
+#include <cstdint>
 #include <ctime>
+#include <deque>
 #include <string>
 
 enum HeaterState {
@@ -11,22 +13,79 @@ enum HeaterState {
     HEATER_COMFORT,
 };
 
+const char *state_to_str(HeaterState state);
+
+/* Accept "ON" as an alias of "COMFORT" */
+bool str_to_state(const std::string &str, HeaterState &state);
+
+/*
+ * Telemetry sent by a heater controller with each REQ_HEATER_STATE
+ * message. All fields are optional.
+ */
+struct HeaterTelemetry {
+    bool has_rssi = false;
+    int rssi = 0;                       /* in dBm */
+    bool has_uptime = false;
+    uint32_t uptime = 0;                /* in seconds */
+    bool has_failures = false;
+    unsigned int failures = 0;          /* since boot */
+    bool has_rtt = false;
+    unsigned int rtt = 0;               /* in milliseconds */
+    std::string firmware_version;       /* empty if unknown */
+
+    bool empty() const;
+};
+
+/* Aggregates over the last TELEMETRY_WINDOW requests */
+#define TELEMETRY_WINDOW    (60)
+
+struct TelemetryAggregates {
+    unsigned int samples = 0;
+    unsigned int rssi_samples = 0;
+    int rssi_min = 0;
+    int rssi_avg = 0;
+    unsigned int rtt_samples = 0;
+    unsigned int rtt_avg = 0;
+    unsigned int rtt_max = 0;
+    unsigned int failures = 0;          /* new failures over window */
+    unsigned int reboots = 0;           /* uptime went backward */
+};
+
 class Heater {
 public:
     explicit Heater(const std::string &name = std::string(), const std::string &ip_addr = std::string());
 
     void update(HeaterState newState);
+    void setAddress(const std::string &name, const std::string &ip_addr);
+    void updateTelemetry(const HeaterTelemetry &telemetry);
 
     std::string getName() const;
     std::string getLastIPAddress() const;
     time_t getLastRequestTimestamp() const;
     HeaterState getState() const;
+    bool hasTelemetry() const;
+    const HeaterTelemetry &getLastTelemetry() const;
+    const TelemetryAggregates &getTelemetryAggregates() const;
 
 private:
+    struct TelemetrySample {
+        HeaterTelemetry telemetry;
+        unsigned int new_failures;      /* since previous sample */
+        bool reboot;                    /* since previous sample */
+    };
+
+    void updateTelemetryRange();
+
     std::string m_name;
     std::string m_ip_addr;
     time_t m_last_request_timestamp;
     HeaterState m_state;
+    std::deque<TelemetrySample> m_telemetry;
+
+    /* Kept up to date by updateTelemetry so that rendering is O(1) */
+    TelemetryAggregates m_aggregates;
+    long m_rssi_sum;
+    unsigned long m_rtt_sum;
 };
 
 #endif
@@ -0,0 +1,619 @@
+#include "history_store.hpp"
+#include "logger.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sstream>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HISTORY_MAGIC               "HIST"
+#define HISTORY_VERSION             (2)
+#define HISTORY_RECORD_CAPACITY     (14 * 24 * 60)      /* two weeks of polls every minute */
+#define HISTORY_HOUR_CAPACITY       (5 * 366 * 24)      /* five years */
+#define HISTORY_DAY_CAPACITY        (10 * 366)          /* ten years */
+#define HISTORY_MONTH_CAPACITY      (10 * 12)           /* ten years */
+#define HISTORY_MAX_GAP             (15 * 60)           /* in seconds */
+#define HISTORY_QUERY_MAX_RECORDS   (10000)
+#define HISTORY_NO_STATE            (0xFF)
+#define SECONDS_PER_HOUR            (60 * 60)
+
+struct __attribute__((packed)) history_ring_t {
+    uint32_t capacity;
+    uint32_t head;              /* index of next entry */
+    uint32_t count;
+};
+
+struct __attribute__((packed)) history_file_header_t {
+    char magic[4];
+    uint16_t version;
+    uint16_t reserved;
+    history_ring_t record_ring;
+    history_ring_t hour_ring;
+    history_ring_t day_ring;
+    history_ring_t month_ring;
+    uint32_t last_timestamp;
+    uint8_t last_state;         /* HISTORY_NO_STATE if none */
+    uint8_t reserved2[3];
+    history_hour_t current;     /* hour being accumulated */
+    history_usage_t current_day;
+    history_usage_t current_month;
+    char name[32];
+};
+
+namespace {
+
+size_t get_file_size()
+{
+    return sizeof(history_file_header_t)
+         + HISTORY_RECORD_CAPACITY * sizeof(history_record_t)
+         + HISTORY_HOUR_CAPACITY * sizeof(history_hour_t)
+         + HISTORY_DAY_CAPACITY * sizeof(history_usage_t)
+         + HISTORY_MONTH_CAPACITY * sizeof(history_usage_t);
+}
+
+std::string mac_to_str(uint64_t mac)
+{
+    char buf[32];
+    sprintf(buf, "%02X:%02X:%02X:%02X:%02X:%02X",
+            (uint8_t)((mac >> 40) & 0xFF),
+            (uint8_t)((mac >> 32) & 0xFF),
+            (uint8_t)((mac >> 24) & 0xFF),
+            (uint8_t)((mac >> 16) & 0xFF),
+            (uint8_t)((mac >> 8) & 0xFF),
+            (uint8_t)(mac & 0xFF));
+    return buf;
+}
+
+/* Parse MAC address such as "AA:BB:CC:DD:EE:FF" */
+bool str_to_mac(const std::string &str, uint64_t &mac)
+{
+    if (str.length() != 17)
+        return false;
+
+    mac = 0;
+    for (unsigned int i = 0; i < str.length(); ++i) {
+        char c = str[i];
+        if (i % 3 == 2) {
+            if (c != ':')
+                return false;
+            continue;
+        }
+        if (!isxdigit(c))
+            return false;
+        mac = (mac << 4) | strtoul(std::string(1, c).c_str(), nullptr, 16);
+    }
+
+    return true;
+}
+
+const char *state_to_json(uint8_t state)
+{
+    switch (state) {
+    case HEATER_OFF: return "\"off\"";
+    case HEATER_DEFROST: return "\"defrost\"";
+    case HEATER_ECO: return "\"eco\"";
+    case HEATER_COMFORT: return "\"comfort\"";
+    default: return "null";
+    }
+}
+
+/* Start of day or month containing t, in local time */
+uint32_t get_period_start(uint32_t t, HistoryResolution resolution)
+{
+    time_t ts = t;
+    struct tm tm;
+    localtime_r(&ts, &tm);
+    tm.tm_sec = 0;
+    tm.tm_min = 0;
+    tm.tm_hour = 0;
+    if (resolution == HISTORY_MONTHLY)
+        tm.tm_mday = 1;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+template<typename T>
+void ring_push(history_ring_t &ring, T *entries, const T &entry)
+{
+    entries[ring.head] = entry;
+    ring.head = (ring.head + 1) % ring.capacity;
+    if (ring.count < ring.capacity)
+        ring.count++;
+}
+
+/* Entry i, counting from oldest entry */
+template<typename T>
+const T &ring_at(const history_ring_t &ring, const T *entries, uint32_t i)
+{
+    return entries[(ring.head + ring.capacity - ring.count + i) % ring.capacity];
+}
+
+/* Index, from oldest entry, of first entry at or after timestamp */
+template<typename T>
+uint32_t ring_lower_bound(const history_ring_t &ring, const T *entries, uint32_t timestamp)
+{
+    uint32_t first = 0;
+    uint32_t len = ring.count;
+    while (len > 0) {
+        uint32_t half = len / 2;
+        uint32_t mid = first + half;
+        if (ring_at(ring, entries, mid).timestamp < timestamp) {
+            first = mid + 1;
+            len -= half + 1;
+        } else {
+            len = half;
+        }
+    }
+
+    return first;
+}
+
+void add_hour_to_usage(history_usage_t &usage, const history_hour_t &hour)
+{
+    usage.poll_count += hour.poll_count;
+    usage.change_count += hour.change_count;
+    for (unsigned int i = 0; i < 4; ++i)
+        usage.seconds[i] += hour.seconds[i];
+}
+
+/* Add hour to day or month being accumulated, moving to next one if needed */
+void roll_up(history_ring_t &ring, history_usage_t *entries, history_usage_t &current,
+             const history_hour_t &hour, HistoryResolution resolution)
+{
+    uint32_t start = get_period_start(hour.timestamp, resolution);
+    if (current.timestamp != start) {
+        if (current.poll_count > 0)
+            ring_push(ring, entries, current);
+        memset(&current, 0, sizeof(current));
+        current.timestamp = start;
+    }
+
+    add_hour_to_usage(current, hour);
+}
+
+void hour_to_json(std::stringstream &ss, const history_hour_t &hour)
+{
+    ss << "{\"timestamp\":" << hour.timestamp
+       << ",\"polls\":" << hour.poll_count
+       << ",\"changes\":" << static_cast<unsigned int>(hour.change_count)
+       << ",\"state\":" << state_to_json(hour.state)
+       << ",\"off\":" << hour.seconds[HEATER_OFF]
+       << ",\"defrost\":" << hour.seconds[HEATER_DEFROST]
+       << ",\"eco\":" << hour.seconds[HEATER_ECO]
+       << ",\"comfort\":" << hour.seconds[HEATER_COMFORT]
+       << "}";
+}
+
+void usage_to_json(std::stringstream &ss, const history_usage_t &usage)
+{
+    ss << "{\"timestamp\":" << usage.timestamp
+       << ",\"polls\":" << usage.poll_count
+       << ",\"changes\":" << usage.change_count
+       << ",\"off\":" << usage.seconds[HEATER_OFF]
+       << ",\"defrost\":" << usage.seconds[HEATER_DEFROST]
+       << ",\"eco\":" << usage.seconds[HEATER_ECO]
+       << ",\"comfort\":" << usage.seconds[HEATER_COMFORT]
+       << "}";
+}
+
+}
+
+HistoryStore::HistoryStore():
+m_dir(),
+m_heaters(),
+m_mutex()
+{
+
+}
+
+HistoryStore::~HistoryStore()
+{
+    close();
+}
+
+bool HistoryStore::open(const std::string &dir)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (mkdir(dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        std::stringstream ss;
+        ss << "Failed to create history directory " << dir << ": " << strerror(errno);
+        Logger::err(ss.str());
+        return false;
+    }
+
+    DIR *d = opendir(dir.c_str());
+    if (!d) {
+        std::stringstream ss;
+        ss << "Failed to open history directory " << dir << ": " << strerror(errno);
+        Logger::err(ss.str());
+        return false;
+    }
+
+    m_dir = dir;
+
+    /* Files are named after the MAC address of the heater: 0123456789AB.hist */
+    struct dirent *entry;
+    while ((entry = readdir(d)) != nullptr) {
+        std::string filename(entry->d_name);
+        if (filename.length() != 17 || filename.substr(12) != ".hist")
+            continue;
+
+        char *end;
+        uint64_t mac = strtoull(filename.substr(0, 12).c_str(), &end, 16);
+        if (*end != '\0')
+            continue;
+
+        openFile(m_dir + "/" + filename, mac, false);
+    }
+    closedir(d);
+
+    std::stringstream ss;
+    ss << "Loaded history of " << m_heaters.size() << " heaters from " << m_dir;
+    Logger::debug(ss.str());
+
+    return true;
+}
+
+void HistoryStore::close()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    for (auto &e : m_heaters) {
+        munmap(e.second.header, get_file_size());
+        ::close(e.second.fd);
+    }
+    m_heaters.clear();
+    m_dir.clear();
+}
+
+HistoryStore::HeaterHistory *HistoryStore::openFile(const std::string &path, uint64_t mac, bool create)
+{
+    int fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT : 0), 0644);
+    if (fd < 0) {
+        std::stringstream ss;
+        ss << "Failed to open history file " << path << ": " << strerror(errno);
+        Logger::err(ss.str());
+        return nullptr;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        Logger::err("Failed to get size of history file " + path);
+        ::close(fd);
+        return nullptr;
+    }
+
+    /* Files written with another layout are started again */
+    bool is_new = static_cast<size_t>(st.st_size) != get_file_size();
+    if (is_new && st.st_size != 0)
+        Logger::warn("Resetting history file " + path + ": unexpected size");
+
+    /* The file is sparse until the rings are filled */
+    if (is_new && (ftruncate(fd, 0) < 0 || ftruncate(fd, get_file_size()) < 0)) {
+        Logger::err("Failed to allocate history file " + path);
+        ::close(fd);
+        return nullptr;
+    }
+
+    void *p = mmap(nullptr, get_file_size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        Logger::err("Failed to map history file " + path);
+        ::close(fd);
+        return nullptr;
+    }
+
+    HeaterHistory h;
+    h.fd = fd;
+    h.header = static_cast<history_file_header_t *>(p);
+    h.records = reinterpret_cast<history_record_t *>(h.header + 1);
+    h.hours = reinterpret_cast<history_hour_t *>(h.records + HISTORY_RECORD_CAPACITY);
+    h.days = reinterpret_cast<history_usage_t *>(h.hours + HISTORY_HOUR_CAPACITY);
+    h.months = h.days + HISTORY_DAY_CAPACITY;
+
+    if (!is_new
+    && (memcmp(h.header->magic, HISTORY_MAGIC, sizeof(h.header->magic))
+    ||  h.header->version != HISTORY_VERSION
+    ||  h.header->record_ring.capacity != HISTORY_RECORD_CAPACITY
+    ||  h.header->hour_ring.capacity != HISTORY_HOUR_CAPACITY
+    ||  h.header->day_ring.capacity != HISTORY_DAY_CAPACITY
+    ||  h.header->month_ring.capacity != HISTORY_MONTH_CAPACITY)) {
+        Logger::warn("Resetting history file " + path + ": invalid header");
+        memset(h.header, 0, sizeof(*h.header));
+        is_new = true;
+    }
+
+    if (is_new) {
+        memcpy(h.header->magic, HISTORY_MAGIC, sizeof(h.header->magic));
+        h.header->version = HISTORY_VERSION;
+        h.header->record_ring.capacity = HISTORY_RECORD_CAPACITY;
+        h.header->hour_ring.capacity = HISTORY_HOUR_CAPACITY;
+        h.header->day_ring.capacity = HISTORY_DAY_CAPACITY;
+        h.header->month_ring.capacity = HISTORY_MONTH_CAPACITY;
+        h.header->last_state = HISTORY_NO_STATE;
+        h.header->current.state = HISTORY_NO_STATE;
+    }
+
+    return &(m_heaters[mac] = h);
+}
+
+/* Look up heater by MAC address, then by name */
+std::map<uint64_t, HistoryStore::HeaterHistory>::iterator HistoryStore::find(const std::string &heater)
+{
+    uint64_t mac;
+    if (str_to_mac(heater, mac))
+        return m_heaters.find(mac);
+
+    auto found = m_heaters.end();
+    for (auto it = m_heaters.begin(); it != m_heaters.end(); ++it) {
+        const history_file_header_t *header = it->second.header;
+        if (strncasecmp(header->name, heater.c_str(), sizeof(header->name)))
+            continue;
+        if (found == m_heaters.end() || header->last_timestamp > found->second.header->last_timestamp)
+            found = it;
+    }
+
+    return found;
+}
+
+/*
+ * Adding an hour also rolls it up into the day and month being
+ * accumulated, so that daily and monthly records cost O(1) per hour.
+ */
+void HistoryStore::addHour(HeaterHistory &h)
+{
+    history_file_header_t *header = h.header;
+
+    ring_push(header->hour_ring, h.hours, header->current);
+    roll_up(header->day_ring, h.days, header->current_day, header->current, HISTORY_DAILY);
+    roll_up(header->month_ring, h.months, header->current_month, header->current, HISTORY_MONTHLY);
+}
+
+/* Add time spent in state to hourly records, starting new hours as needed */
+void HistoryStore::accumulate(HeaterHistory &h, uint32_t from, uint32_t to, uint8_t state)
+{
+    history_hour_t &current = h.header->current;
+
+    if (state > HEATER_COMFORT)
+        from = to;
+
+    while (true) {
+        uint32_t hour = from - from % SECONDS_PER_HOUR;
+        if (current.timestamp != hour) {
+            if (current.poll_count > 0)
+                addHour(h);
+            uint8_t last_state = current.state;
+            memset(&current, 0, sizeof(current));
+            current.timestamp = hour;
+            current.state = last_state;
+        }
+
+        if (from >= to)
+            break;
+
+        uint32_t end = std::min(to, hour + SECONDS_PER_HOUR);
+        current.seconds[state] += end - from;
+        from = end;
+    }
+}
+
+void HistoryStore::record(uint64_t mac, const std::string &name, HeaterState state, time_t t)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_dir.empty())
+        return;
+
+    HeaterHistory *h;
+    auto it = m_heaters.find(mac);
+    if (it != m_heaters.end()) {
+        h = &it->second;
+    } else {
+        char filename[32];
+        sprintf(filename, "/%012llX.hist", static_cast<unsigned long long>(mac));
+        h = openFile(m_dir + filename, mac, true);
+        if (!h)
+            return;
+    }
+
+    history_file_header_t *header = h->header;
+
+    /* Keep records in time order if system time goes backwards */
+    uint32_t timestamp = std::max(static_cast<uint32_t>(t), header->last_timestamp);
+
+    /* Do not guess state of heaters that stopped polling for a while */
+    uint32_t from = timestamp;
+    if (header->last_state != HISTORY_NO_STATE
+    &&  timestamp - header->last_timestamp <= HISTORY_MAX_GAP)
+        from = header->last_timestamp;
+    accumulate(*h, from, timestamp, header->last_state);
+
+    bool changed = header->last_state != state;
+    header->current.poll_count++;
+    if (changed && header->current.change_count < UINT8_MAX)
+        header->current.change_count++;
+    header->current.state = state;
+
+    history_record_t r;
+    r.timestamp = timestamp;
+    r.event = changed ? HISTORY_STATE_CHANGE : HISTORY_POLL;
+    r.state = state;
+    r.reserved = 0;
+    ring_push(header->record_ring, h->records, r);
+
+    header->last_timestamp = timestamp;
+    header->last_state = state;
+
+    if (!name.empty() && strncmp(header->name, name.c_str(), sizeof(header->name) - 1)) {
+        memset(header->name, 0, sizeof(header->name));
+        strncpy(header->name, name.c_str(), sizeof(header->name) - 1);
+    }
+}
+
+bool HistoryStore::findHeater(const std::string &heater, uint64_t &mac)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto it = find(heater);
+    if (it == m_heaters.end())
+        return false;
+
+    mac = it->first;
+    return true;
+}
+
+bool HistoryStore::getUsage(uint64_t mac, HistoryResolution resolution, time_t t, history_usage_t &usage)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    auto it = m_heaters.find(mac);
+    if (it == m_heaters.end() || (resolution != HISTORY_DAILY && resolution != HISTORY_MONTHLY))
+        return false;
+
+    const HeaterHistory &h = it->second;
+    const history_file_header_t *header = h.header;
+    const history_ring_t &ring = resolution == HISTORY_DAILY ? header->day_ring : header->month_ring;
+    const history_usage_t *entries = resolution == HISTORY_DAILY ? h.days : h.months;
+    const history_usage_t &current = resolution == HISTORY_DAILY ? header->current_day : header->current_month;
+    uint32_t start = get_period_start(t, resolution);
+
+    memset(&usage, 0, sizeof(usage));
+    if (current.timestamp == start) {
+        usage = current;
+    } else {
+        uint32_t i = ring_lower_bound(ring, entries, start);
+        if (i < ring.count && ring_at(ring, entries, i).timestamp == start)
+            usage = ring_at(ring, entries, i);
+    }
+    usage.timestamp = start;
+
+    /* Hour being accumulated is not rolled up yet */
+    if (header->current.poll_count > 0 && get_period_start(header->current.timestamp, resolution) == start)
+        add_hour_to_usage(usage, header->current);
+
+    return true;
+}
+
+std::string HistoryStore::queryJSON(const std::string &heater, time_t from, time_t to, HistoryResolution resolution)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    std::stringstream ss;
+
+    if (heater.empty()) {
+        ss << "{\"heaters\":[";
+        for (auto it = m_heaters.begin(); it != m_heaters.end(); ++it) {
+            if (it != m_heaters.begin())
+                ss << ',';
+            ss << "{\"mac\":\"" << mac_to_str(it->first) << "\""
+               << ",\"name\":\"" << it->second.header->name << "\""
+               << ",\"last_timestamp\":" << it->second.header->last_timestamp
+               << ",\"state\":" << state_to_json(it->second.header->last_state)
+               << "}";
+        }
+        ss << "]}";
+        return ss.str();
+    }
+
+    auto it = find(heater);
+    if (it == m_heaters.end())
+        return std::string();
+
+    const HeaterHistory &h = it->second;
+    const history_file_header_t *header = h.header;
+    uint32_t first = std::max(static_cast<time_t>(0), from);
+    uint32_t last = std::min(static_cast<time_t>(UINT32_MAX), to);
+    unsigned int n = 0;
+
+    ss << "{\"mac\":\"" << mac_to_str(it->first) << "\""
+       << ",\"name\":\"" << header->name << "\""
+       << ",\"from\":" << first
+       << ",\"to\":" << last;
+
+    if (resolution == HISTORY_RAW) {
+        ss << ",\"records\":[";
+        const history_ring_t &ring = header->record_ring;
+        uint32_t i = ring_lower_bound(ring, h.records, first);
+        for (; i < ring.count && n < HISTORY_QUERY_MAX_RECORDS; ++i, ++n) {
+            const history_record_t &r = ring_at(ring, h.records, i);
+            if (r.timestamp > last)
+                break;
+            if (n > 0)
+                ss << ',';
+            ss << "{\"timestamp\":" << r.timestamp
+               << ",\"event\":" << (r.event == HISTORY_STATE_CHANGE ? "\"state_change\"" : "\"poll\"")
+               << ",\"state\":" << state_to_json(r.state)
+               << "}";
+        }
+    } else if (resolution == HISTORY_HOURLY) {
+        ss << ",\"hours\":[";
+        const history_ring_t &ring = header->hour_ring;
+        uint32_t i = ring_lower_bound(ring, h.hours, first);
+        for (; i < ring.count && n < HISTORY_QUERY_MAX_RECORDS; ++i, ++n) {
+            const history_hour_t &hour = ring_at(ring, h.hours, i);
+            if (hour.timestamp > last)
+                break;
+            if (n > 0)
+                ss << ',';
+            hour_to_json(ss, hour);
+        }
+
+        /* Hour being accumulated */
+        if (header->current.poll_count > 0
+        &&  header->current.timestamp >= first && header->current.timestamp <= last
+        &&  n < HISTORY_QUERY_MAX_RECORDS) {
+            if (n > 0)
+                ss << ',';
+            hour_to_json(ss, header->current);
+            n++;
+        }
+    } else {
+        ss << (resolution == HISTORY_DAILY ? ",\"days\":[" : ",\"months\":[");
+        const history_ring_t &ring = resolution == HISTORY_DAILY ? header->day_ring : header->month_ring;
+        const history_usage_t *entries = resolution == HISTORY_DAILY ? h.days : h.months;
+        uint32_t i = ring_lower_bound(ring, entries, first);
+        for (; i < ring.count && n < HISTORY_QUERY_MAX_RECORDS; ++i, ++n) {
+            const history_usage_t &usage = ring_at(ring, entries, i);
+            if (usage.timestamp > last)
+                break;
+            if (n > 0)
+                ss << ',';
+            usage_to_json(ss, usage);
+        }
+
+        /*
+         * Day or month being accumulated, then the hour being accumulated
+         * which may already belong to the next one.
+         */
+        history_usage_t current = resolution == HISTORY_DAILY ? header->current_day : header->current_month;
+        history_usage_t next;
+        memset(&next, 0, sizeof(next));
+        if (header->current.poll_count > 0) {
+            uint32_t start = get_period_start(header->current.timestamp, resolution);
+            if (start == current.timestamp) {
+                add_hour_to_usage(current, header->current);
+            } else {
+                next.timestamp = start;
+                add_hour_to_usage(next, header->current);
+            }
+        }
+        for (const auto &usage : { current, next }) {
+            if (usage.poll_count == 0 || usage.timestamp < first || usage.timestamp > last
+            ||  n >= HISTORY_QUERY_MAX_RECORDS)
+                continue;
+            if (n > 0)
+                ss << ',';
+            usage_to_json(ss, usage);
+            n++;
+        }
+    }
+    ss << "],\"truncated\":" << (n == HISTORY_QUERY_MAX_RECORDS ? "true" : "false") << "}";
+
+    return ss.str();
+}
@@ -0,0 +1,97 @@
+#ifndef HISTORY_STORE_HPP
+#define HISTORY_STORE_HPP
+
+#include "heater.hpp"
+#include <cstdint>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <string>
+
+enum HistoryEvent {
+    HISTORY_POLL            = 0,    /* heater requested its state */
+    HISTORY_STATE_CHANGE    = 1,    /* heater requested its state and got a new one */
+};
+
+enum HistoryResolution {
+    HISTORY_RAW,
+    HISTORY_HOURLY,
+    HISTORY_DAILY,
+    HISTORY_MONTHLY,
+};
+
+struct __attribute__((packed)) history_record_t {
+    uint32_t timestamp;
+    uint8_t event;
+    uint8_t state;
+    uint16_t reserved;
+};
+
+/* Old data is downsampled to one record per hour */
+struct __attribute__((packed)) history_hour_t {
+    uint32_t timestamp;     /* start of hour */
+    uint16_t poll_count;
+    uint8_t state;          /* last state of the hour */
+    uint8_t change_count;
+    uint16_t seconds[4];    /* time spent in each heater state */
+};
+
+/* Hourly records are rolled up into daily and monthly records */
+struct __attribute__((packed)) history_usage_t {
+    uint32_t timestamp;     /* start of day or month, in local time */
+    uint32_t poll_count;
+    uint32_t change_count;
+    uint32_t seconds[4];    /* time spent in each heater state */
+};
+
+struct history_file_header_t;
+
+/*
+ * Append-only history of heater polls. Each heater has its own file,
+ * of fixed size, made of rings: recent records, hourly, daily and
+ * monthly records. Files are mapped in memory so that appending a
+ * record is cheap.
+ */
+class HistoryStore {
+public:
+    HistoryStore();
+    ~HistoryStore();
+
+    bool open(const std::string &dir);
+    void close();
+
+    void record(uint64_t mac, const std::string &name, HeaterState state, time_t t);
+
+    /* Find heater by name or MAC address. Most recent heater wins if a name is reused. */
+    bool findHeater(const std::string &heater, uint64_t &mac);
+
+    /* Time spent in each state during the day or month containing t */
+    bool getUsage(uint64_t mac, HistoryResolution resolution, time_t t, history_usage_t &usage);
+
+    /*
+     * Return records of heater (name or MAC address) between from and to
+     * as JSON. Return list of heaters if heater is empty.
+     */
+    std::string queryJSON(const std::string &heater, time_t from, time_t to, HistoryResolution resolution);
+
+private:
+    struct HeaterHistory {
+        int fd;
+        history_file_header_t *header;
+        history_record_t *records;
+        history_hour_t *hours;
+        history_usage_t *days;
+        history_usage_t *months;
+    };
+
+    HeaterHistory *openFile(const std::string &path, uint64_t mac, bool create);
+    std::map<uint64_t, HeaterHistory>::iterator find(const std::string &heater);
+    void addHour(HeaterHistory &h);
+    void accumulate(HeaterHistory &h, uint32_t from, uint32_t to, uint8_t state);
+
+    std::string m_dir;
+    std::map<uint64_t, HeaterHistory> m_heaters;   /* MAC -> history */
+    std::mutex m_mutex;
+};
+
+#endif
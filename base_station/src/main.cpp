@@ -5,16 +5,27 @@
 #include "logger.hpp"
 #include "device_server.hpp"
 #include "sms_receiver.hpp"
+#include "sms_sender.hpp"
 #include "version.hpp"
 #include "web_server.hpp"
 
 #define DEFAULT_DEVICE_SERVER_PORT  (32322)
+#define DEFAULT_WEB_SERVER_PORT     (80)
+#define DEFAULT_SMS_SPOOL_DIR       "/var/spool/sms"
+#define DEFAULT_MODEM_DEVPATH       "/dev/ttyUSB2"
+#define DEFAULT_STATE_FILE_PATH     "/var/lib/base_station.state"
+#define DEFAULT_HISTORY_DIR         "/var/lib/base_station_history"
 
 static void print_help(char *program_name)
 {
     std::cout << "Usage: " << program_name << " [options]\n"
               << "Options:\n"
               << "    --device-server-port <port>       Set device server port\n"
+              << "    --web-server-port <port>          Set web server port\n"
+              << "    --sms-spool-dir <dir>             Set smstools spool directory (default: " DEFAULT_SMS_SPOOL_DIR ")\n"
+              << "    --modem-devpath <path>            Set device used by smstools (default: " DEFAULT_MODEM_DEVPATH ")\n"
+              << "    --state-file <path>               Set state file (default: " DEFAULT_STATE_FILE_PATH ")\n"
+              << "    --history-dir <dir>               Set heater history directory (default: " DEFAULT_HISTORY_DIR ")\n"
               << "    --version, -v                     Print version\n"
               << "    --help, -h                        Print help\n"
               << std::flush;
@@ -33,6 +44,11 @@ int main(int argc, char **argv)
 {
     char *program_name = argv[0];
     int device_server_port = DEFAULT_DEVICE_SERVER_PORT;
+    int web_server_port = DEFAULT_WEB_SERVER_PORT;
+    std::string sms_spool_dir = DEFAULT_SMS_SPOOL_DIR;
+    std::string modem_devpath = DEFAULT_MODEM_DEVPATH;
+    std::string state_file_path = DEFAULT_STATE_FILE_PATH;
+    std::string history_dir = DEFAULT_HISTORY_DIR;
 
     argc--;
     argv++;
@@ -43,6 +59,27 @@ int main(int argc, char **argv)
             device_server_port = std::stoi(optarg);
             argc--;
             argv++;
+        } else if (opt == "--web-server-port" && argc >= 2) {
+            std::string optarg(argv[1]);
+            web_server_port = std::stoi(optarg);
+            argc--;
+            argv++;
+        } else if (opt == "--sms-spool-dir" && argc >= 2) {
+            sms_spool_dir = argv[1];
+            argc--;
+            argv++;
+        } else if (opt == "--modem-devpath" && argc >= 2) {
+            modem_devpath = argv[1];
+            argc--;
+            argv++;
+        } else if (opt == "--state-file" && argc >= 2) {
+            state_file_path = argv[1];
+            argc--;
+            argv++;
+        } else if (opt == "--history-dir" && argc >= 2) {
+            history_dir = argv[1];
+            argc--;
+            argv++;
         } else if (opt == "--help" || opt == "-h") {
             print_help(program_name);
             return 0;
@@ -67,15 +104,17 @@ int main(int argc, char **argv)
         Logger::info(ss.str());
     }
 
-    BaseStation base_station;
+    SMSSender::instance().start(sms_spool_dir, modem_devpath);
+
+    BaseStation base_station(state_file_path, history_dir);
     DeviceServer device_server(device_server_port,
                                std::bind(&BaseStation::handleNewDevice, &base_station, std::placeholders::_1));
     device_server.start();
 
-    SMSReceiver sms_receiver(std::bind(&BaseStation::handleSMSCommand, &base_station, std::placeholders::_1, std::placeholders::_2));
+    SMSReceiver sms_receiver(sms_spool_dir, std::bind(&BaseStation::handleSMSCommand, &base_station, std::placeholders::_1, std::placeholders::_2));
     sms_receiver.start();
 
-    WebServer web_server(&base_station);
+    WebServer web_server(&base_station, web_server_port);
     web_server.start();
 
     while (true) {
@@ -86,6 +125,7 @@ int main(int argc, char **argv)
     web_server.stop();
     sms_receiver.stop();
     device_server.stop();
+    SMSSender::instance().stop();
     Logger::instance().stopLogging();
 
     return 0;
@@ -0,0 +1,207 @@
+#include "schedule.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <map>
+#include <sstream>
+
+#define MINUTES_PER_DAY     (24 * 60)
+#define MINUTES_PER_WEEK    (7 * MINUTES_PER_DAY)
+
+namespace {
+
+const char *days[] = { "MON", "TUE", "WED", "THU", "FRI", "SAT", "SUN" };
+
+int parse_day(const std::string &str)
+{
+    for (int i = 0; i < 7; ++i) {
+        if (str == days[i])
+            return i;
+    }
+
+    return -1;
+}
+
+/* Parse "MON", "MON-FRI", "FRI-MON" or "DAILY" */
+bool parse_days(const std::string &str, std::vector<int> &result)
+{
+    if (str == "DAILY") {
+        for (int i = 0; i < 7; ++i)
+            result.push_back(i);
+        return true;
+    }
+
+    size_t pos = str.find('-');
+    if (pos == std::string::npos) {
+        int day = parse_day(str);
+        if (day < 0)
+            return false;
+        result.push_back(day);
+        return true;
+    }
+
+    int first = parse_day(str.substr(0, pos));
+    int last = parse_day(str.substr(pos + 1));
+    if (first < 0 || last < 0)
+        return false;
+
+    for (int day = first; ; day = (day + 1) % 7) {
+        result.push_back(day);
+        if (day == last)
+            break;
+    }
+
+    return true;
+}
+
+/* Parse "HH:MM" into minutes since midnight */
+bool parse_time(const std::string &str, unsigned int &minutes)
+{
+    unsigned int hours, mins;
+    char c;
+    std::istringstream iss(str);
+    if (!(iss >> hours >> c >> mins) || c != ':' || !iss.eof())
+        return false;
+    if (hours > 23 || mins > 59)
+        return false;
+
+    minutes = hours * 60 + mins;
+    return true;
+}
+
+/*
+ * Move t by a number of minutes in local time, at the start of the
+ * minute, so that transitions follow daylight saving time changes.
+ */
+time_t add_minutes(time_t t, int minutes)
+{
+    struct tm tm;
+    localtime_r(&t, &tm);
+    tm.tm_sec = 0;
+    tm.tm_min += minutes;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+unsigned int minute_of_week(time_t t)
+{
+    struct tm tm;
+    localtime_r(&t, &tm);
+    return ((tm.tm_wday + 6) % 7) * MINUTES_PER_DAY + tm.tm_hour * 60 + tm.tm_min;
+}
+
+}
+
+Schedule::Schedule():
+m_transitions(),
+m_spec()
+{
+
+}
+
+bool Schedule::parse(const std::string &spec)
+{
+    std::map<unsigned int, HeaterState> transitions;
+    std::stringstream normalized;
+
+    std::istringstream groups(spec);
+    std::string group;
+    while (std::getline(groups, group, ',')) {
+        std::istringstream iss(group);
+        std::string token;
+        std::vector<int> group_days;
+
+        if (!(iss >> token) || !parse_days(token, group_days))
+            return false;
+        if (normalized.tellp() > 0)
+            normalized << ", ";
+        normalized << token;
+
+        unsigned int count = 0;
+        std::string time_str, state_str;
+        while (iss >> time_str) {
+            unsigned int minutes;
+            HeaterState state;
+            if (!(iss >> state_str)
+            ||  !parse_time(time_str, minutes)
+            ||  !str_to_state(state_str, state))
+                return false;
+
+            for (auto day : group_days) {
+                /* A minute cannot have two transitions */
+                if (!transitions.emplace(day * MINUTES_PER_DAY + minutes, state).second)
+                    return false;
+            }
+
+            char buf[16];
+            snprintf(buf, sizeof(buf), " %02u:%02u ", minutes / 60, minutes % 60);
+            normalized << buf << state_to_str(state);
+            count++;
+        }
+
+        if (count == 0)
+            return false;
+    }
+
+    if (transitions.empty())
+        return false;
+
+    m_transitions.clear();
+    for (auto &e : transitions) {
+        Transition t;
+        t.minute = e.first;
+        t.state = e.second;
+        m_transitions.push_back(t);
+    }
+    m_spec = normalized.str();
+
+    return true;
+}
+
+bool Schedule::empty() const
+{
+    return m_transitions.empty();
+}
+
+std::string Schedule::toString() const
+{
+    return m_spec;
+}
+
+time_t Schedule::getPreviousTransition(time_t t, HeaterState &state) const
+{
+    unsigned int now = minute_of_week(t);
+    auto it = std::upper_bound(m_transitions.begin(), m_transitions.end(), now,
+        [] (unsigned int minute, const Transition &tr) { return minute < tr.minute; });
+
+    /* Wrap around to the end of previous week */
+    int delta;
+    if (it == m_transitions.begin()) {
+        it = m_transitions.end() - 1;
+        delta = now + MINUTES_PER_WEEK - it->minute;
+    } else {
+        --it;
+        delta = now - it->minute;
+    }
+
+    state = it->state;
+    return add_minutes(t, -delta);
+}
+
+time_t Schedule::getNextTransition(time_t t, HeaterState &state) const
+{
+    unsigned int now = minute_of_week(t);
+    auto it = std::upper_bound(m_transitions.begin(), m_transitions.end(), now,
+        [] (unsigned int minute, const Transition &tr) { return minute < tr.minute; });
+
+    /* Wrap around to the beginning of next week */
+    int delta;
+    if (it == m_transitions.end()) {
+        it = m_transitions.begin();
+        delta = it->minute + MINUTES_PER_WEEK - now;
+    } else {
+        delta = it->minute - now;
+    }
+
+    state = it->state;
+    return add_minutes(t, delta);
+}
@@ -0,0 +1,43 @@
+#ifndef SCHEDULE_HPP
+#define SCHEDULE_HPP
+
+#include "heater.hpp"
+#include <ctime>
+#include <string>
+#include <vector>
+
+/*
+ * Weekly schedule, for instance:
+ *   "MON-FRI 07:00 COMFORT 22:00 ECO, SAT-SUN 09:00 COMFORT 23:00 ECO"
+ *
+ * It is compiled into a table of transitions sorted by minute of the
+ * week (local time) so that finding the state in force or the next
+ * transition is a binary search.
+ */
+class Schedule {
+public:
+    Schedule();
+
+    /* Return false and leave schedule unchanged if spec is invalid */
+    bool parse(const std::string &spec);
+
+    bool empty() const;
+    std::string toString() const;
+
+    /* Last transition at or before t */
+    time_t getPreviousTransition(time_t t, HeaterState &state) const;
+
+    /* First transition strictly after t */
+    time_t getNextTransition(time_t t, HeaterState &state) const;
+
+private:
+    struct Transition {
+        unsigned int minute;    /* minute of the week, starting Monday 00:00 */
+        HeaterState state;
+    };
+
+    std::vector<Transition> m_transitions;
+    std::string m_spec;
+};
+
+#endif
@@ -1,5 +1,9 @@
 #include "logger.hpp"
 #include "sms_receiver.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <ctime>
+#include <dirent.h>
 #include <fcntl.h>
 #include <climits>
 #include <poll.h>
@@ -9,14 +13,20 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <vector>
 
-#define SMSTOOL_INCOMING_DIR    "/var/spool/sms/incoming/"
-#define BUF_LEN                 (sizeof(struct inotify_event) + NAME_MAX + 1)
+#define BUF_LEN                 (64 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+#define SMS_BACKLOG_MAX_AGE     (60 * 60)   /* in seconds */
+#define PROCESSED_SMS_MAX_AGE   (7 * 24 * 60 * 60)  /* in seconds */
+#define CLEANUP_PERIOD          (60 * 60)   /* in seconds */
 
-SMSReceiver::SMSReceiver(SMSReceiverCallback cb):
+SMSReceiver::SMSReceiver(const std::string &spool_dir, SMSReceiverCallback cb):
+m_incoming_dir(spool_dir + "/incoming/"),
+m_processed_dir(spool_dir + "/processed/"),
 m_callback(cb),
 m_thread(nullptr),
-m_running(false)
+m_running(false),
+m_handled_files()
 {
 
 }
@@ -64,7 +74,12 @@ void SMSReceiver::run()
         Logger::err("inotify_init failed");
         throw std::runtime_error("inotify_init failed");
     }
-    wd = inotify_add_watch(fds[0].fd, SMSTOOL_INCOMING_DIR, IN_MODIFY);
+
+    /*
+     * Only look at files once smstools is done writing them
+     * or once they are moved into the incoming directory.
+     */
+    wd = inotify_add_watch(fds[0].fd, m_incoming_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
     if (wd < 0) {
         close(fds[0].fd);
         Logger::err("inotify_add_watch failed");
@@ -72,11 +87,25 @@ void SMSReceiver::run()
     }
     fds[0].events = POLLIN;
 
+    if (mkdir(m_processed_dir.c_str(), 0755) < 0 && errno != EEXIST)
+        Logger::err("Failed to create directory " + m_processed_dir);
+
+    /*
+     * Handle SMS received while the base station was not running.
+     * This is done after adding the watch so that no SMS is missed.
+     */
+    scanIncomingDir();
+
+    time_t last_cleanup = 0;
     while (m_running) {
-        struct inotify_event *event;
-        char __attribute__ ((aligned(8))) buf[BUF_LEN] ;
+        char __attribute__ ((aligned(8))) buf[BUF_LEN];
         ssize_t ret;
 
+        if (time(NULL) - last_cleanup >= CLEANUP_PERIOD) {
+            cleanProcessedDir();
+            last_cleanup = time(NULL);
+        }
+
         ret = poll(fds, 1, 100);
         if (ret < 0) {
             std::stringstream ss;
@@ -93,16 +122,126 @@ void SMSReceiver::run()
             continue;
         }
 
-        event = (struct inotify_event *) buf;
-        std::stringstream ss;
-        ss << SMSTOOL_INCOMING_DIR << event->name;
-        parseSMS(ss.str());
+        /* One read may return several events */
+        ssize_t i = 0;
+        while (i < ret) {
+            struct inotify_event *event = reinterpret_cast<struct inotify_event *>(&buf[i]);
+            i += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW) {
+                Logger::warn("Too many SMS received at once. Scanning incoming directory.");
+                scanIncomingDir();
+                continue;
+            }
+
+            if (!event->len || (event->mask & IN_ISDIR))
+                continue;
+
+            handleSMSFile(event->name, false);
+        }
     }
 
     inotify_rm_watch(fds[0].fd, wd);
     close(fds[0].fd);
 }
 
+void SMSReceiver::scanIncomingDir()
+{
+    DIR *dir = opendir(m_incoming_dir.c_str());
+    if (dir == NULL) {
+        Logger::err("Failed to open directory " + m_incoming_dir);
+        return;
+    }
+
+    /* Handle SMS in the order they were received */
+    std::vector<std::pair<time_t, std::string>> files;
+    struct dirent *next_file;
+    while ((next_file = readdir(dir)) != NULL) {
+        if (next_file->d_type != DT_REG)
+            continue;
+
+        std::string path = m_incoming_dir;
+        path += next_file->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0)
+            continue;
+        files.push_back(std::make_pair(st.st_mtime, std::string(next_file->d_name)));
+    }
+    closedir(dir);
+
+    std::sort(files.begin(), files.end());
+    for (const auto &f : files)
+        handleSMSFile(f.second, true);
+}
+
+/* Handled SMS are kept for a while for troubleshooting */
+void SMSReceiver::cleanProcessedDir()
+{
+    DIR *dir = opendir(m_processed_dir.c_str());
+    if (dir == NULL) {
+        Logger::err("Failed to open directory " + m_processed_dir);
+        return;
+    }
+
+    unsigned int count = 0;
+    struct dirent *next_file;
+    while ((next_file = readdir(dir)) != NULL) {
+        if (next_file->d_type != DT_REG)
+            continue;
+
+        std::string path = m_processed_dir;
+        path += next_file->d_name;
+        struct stat st;
+        if (stat(path.c_str(), &st) < 0 || time(NULL) - st.st_mtime <= PROCESSED_SMS_MAX_AGE)
+            continue;
+        if (unlink(path.c_str()) == 0)
+            count++;
+    }
+    closedir(dir);
+
+    if (count > 0) {
+        std::stringstream ss;
+        ss << "Deleted " << count << " processed SMS files";
+        Logger::info(ss.str());
+    }
+}
+
+void SMSReceiver::handleSMSFile(const std::string &filename, bool backlog)
+{
+    std::string path = m_incoming_dir + filename;
+
+    /*
+     * Several events, or an event and the directory scan, can refer
+     * to the same file. Once handled, the file is moved out of the
+     * incoming directory: if it is gone, it was already handled.
+     */
+    struct stat st;
+    if (stat(path.c_str(), &st) < 0 || !S_ISREG(st.st_mode))
+        return;
+
+    auto id = std::make_pair(st.st_dev, st.st_ino);
+    if (m_handled_files.find(id) != m_handled_files.end())
+        return;
+
+    if (backlog && time(NULL) - st.st_mtime > SMS_BACKLOG_MAX_AGE) {
+        std::stringstream ss;
+        ss << "Ignoring SMS file \"" << path << "\" received too long ago";
+        Logger::warn(ss.str());
+    } else {
+        parseSMS(path);
+    }
+
+    std::string processed_path = m_processed_dir + filename;
+    if (rename(path.c_str(), processed_path.c_str()) < 0) {
+        std::stringstream ss;
+        ss << "Failed to move SMS file \"" << path << "\" to " << m_processed_dir;
+        Logger::err(ss.str());
+
+        /* Remember this file to not handle it again */
+        m_handled_files.insert(id);
+    }
+}
+
 void SMSReceiver::parseSMS(const std::string &path)
 {
     std::ifstream file(path);
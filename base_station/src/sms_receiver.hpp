@@ -2,15 +2,18 @@
 #define SMS_RECEIVER_HPP
 
 #include <functional>
+#include <set>
 #include <string>
+#include <sys/types.h>
 #include <thread>
+#include <utility>
 
 typedef std::function<void(const std::string&, const std::string&)> SMSReceiverCallback;
 
 class SMSReceiver {
 public:
 
-    explicit SMSReceiver(SMSReceiverCallback cb);
+    SMSReceiver(const std::string &spool_dir, SMSReceiverCallback cb);
     ~SMSReceiver();
 
     void start();
@@ -18,11 +21,17 @@ public:
 
 private:
     void run();
+    void scanIncomingDir();
+    void cleanProcessedDir();
+    void handleSMSFile(const std::string &filename, bool backlog);
     void parseSMS(const std::string &path);
 
+    std::string m_incoming_dir;
+    std::string m_processed_dir;
     SMSReceiverCallback m_callback;
     std::thread *m_thread;
     bool m_running;
+    std::set<std::pair<dev_t, ino_t>> m_handled_files;   /* Files that could not be moved */
 };
 
 #endif
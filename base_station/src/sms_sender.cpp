@@ -1,23 +1,72 @@
 #include "logger.hpp"
 #include "sms_sender.hpp"
+#include <cerrno>
+#include <climits>
 #include <cstdint>
 #include <dirent.h>
 #include <fstream>
 #include <mutex>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <sys/inotify.h>
 #include <sys/types.h>
 #include <unistd.h>
 
-#define MODULE_3G_DEVPATH "/dev/ttyUSB2"
-#define SMS_OUTGOING_DIR "/var/spool/sms/outgoing/"
 #define SMS_TOO_OLD         (15 * 60)   /* in seconds */
+#define SMS_QUEUE_MAX_LENGTH    (32)
+#define SMS_SEND_PERIOD         (3000)      /* in milliseconds */
+#define SPOOL_BUF_LEN           (16 * (sizeof(struct inotify_event) + NAME_MAX + 1))
+
+namespace {
+
+/*
+ * How long a SMS waits for other SMS to the same phone number
+ * before being sent, in milliseconds. Alerts have the shortest
+ * window, so that they are only delayed by a second.
+ */
+const unsigned int COALESCE_WINDOW[SMS_PRIORITY_COUNT] = {
+    1000,       /* SMS_PRIORITY_ALERT */
+    2000,       /* SMS_PRIORITY_REPLY */
+    10000,      /* SMS_PRIORITY_DEBUG */
+};
+
+/* Number of 160-character segments needed to send a text */
+unsigned int get_segment_count(const std::string &content)
+{
+    if (content.length() <= 160)
+        return 1;
+
+    /* Concatenated SMS lose 7 characters per segment for the UDH */
+    return (content.length() + SMS_SEGMENT_LENGTH - 1) / SMS_SEGMENT_LENGTH;
+}
+
+}
 
 SMSSender::SMSSender():
+m_spool_dir(),
+m_outgoing_dir(),
+m_modem_devpath(),
 m_mutex(),
-m_counter(0)
+m_cond(),
+m_thread(nullptr),
+m_running(false),
+m_queues(),
+m_queue_depth(0),
+m_files_mutex(),
+m_counter(0),
+m_spool_index(),
+m_spool_files(),
+m_spool_fd(-1),
+m_sent_wd(-1),
+m_failed_wd(-1)
 {
-    cleanOutgoingDir();
+
+}
+
+SMSSender::~SMSSender()
+{
+    stop();
 }
 
 SMSSender& SMSSender::instance()
@@ -26,12 +75,45 @@ SMSSender& SMSSender::instance()
     return s;
 }
 
+void SMSSender::start(const std::string &spool_dir, const std::string &modem_devpath)
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+
+    if (m_running) {
+        Logger::warn("Attempted to start already running sms sender");
+        return;
+    }
+
+    m_spool_dir = spool_dir + '/';
+    m_outgoing_dir = m_spool_dir + "outgoing/";
+    m_modem_devpath = modem_devpath;
+    cleanOutgoingDir();
+
+    m_running = true;
+    m_thread = new std::thread(&SMSSender::run, this);
+}
+
+void SMSSender::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (!m_running)
+            return;
+        m_running = false;
+    }
+
+    m_cond.notify_all();
+    m_thread->join();
+    delete m_thread;
+    m_thread = nullptr;
+}
+
 void SMSSender::cleanOutgoingDir() {
     DIR *outgoing_dir;
     struct dirent *next_file;
-    outgoing_dir = opendir(SMS_OUTGOING_DIR);
+    outgoing_dir = opendir(m_outgoing_dir.c_str());
     if (outgoing_dir == NULL) {
-        Logger::err("Failed to open directory " SMS_OUTGOING_DIR);
+        Logger::err("Failed to open directory " + m_outgoing_dir);
         return;
     }
 
@@ -45,7 +127,7 @@ void SMSSender::cleanOutgoingDir() {
             ss << "Removing old SMS " << next_file->d_name;
             Logger::info(ss.str());
         }
-        std::string filepath = SMS_OUTGOING_DIR;
+        std::string filepath = m_outgoing_dir;
         filepath += next_file->d_name;
         if (remove(filepath.c_str()) != 0) {
             std::stringstream ss;
@@ -57,66 +139,262 @@ void SMSSender::cleanOutgoingDir() {
     closedir(outgoing_dir);
 }
 
-bool SMSSender::sendSMS(const std::string &to, const std::string &content)
+bool SMSSender::sendSMS(const std::string &to, const std::string &content, SMSPriority priority)
 {
-    std::lock_guard<std::mutex> guard(m_mutex);
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+
+        auto now = std::chrono::steady_clock::now();
+        auto ready = now + std::chrono::milliseconds(COALESCE_WINDOW[priority]);
+
+        /*
+         * Merge this SMS with the newest one still pending for the same
+         * phone number if the result does not need more segments than
+         * smstools can send. Older ones are not tried, so that a reply
+         * split in several SMS is not reordered.
+         */
+        int newest_priority = -1;
+        std::deque<OutgoingSMS>::iterator newest;
+        for (int i = 0; i < SMS_PRIORITY_COUNT; ++i) {
+            for (auto it = m_queues[i].begin(); it != m_queues[i].end(); ++it) {
+                if (it->to == to && (newest_priority < 0 || it->queued >= newest->queued)) {
+                    newest_priority = i;
+                    newest = it;
+                }
+            }
+        }
+
+        if (newest_priority >= 0) {
+            std::string merged = newest->content + '\n' + content;
+            if (get_segment_count(merged) <= SMS_MAX_SEGMENTS) {
+                OutgoingSMS sms = *newest;
+                sms.content = merged;
+                sms.queued = now;
+                sms.ready = std::min(sms.ready, ready);
+                if (newest_priority > priority) {
+                    m_queues[newest_priority].erase(newest);
+                    m_queues[priority].push_back(sms);
+                } else {
+                    *newest = sms;
+                }
+
+                {
+                    std::stringstream ss;
+                    ss << "Merged text message to " << to << " with pending one";
+                    Logger::debug(ss.str());
+                }
+                m_cond.notify_one();
+                return true;
+            }
+        }
+
+        if (m_queue_depth >= SMS_QUEUE_MAX_LENGTH) {
+            /* Make room by dropping the newest SMS of the lowest priority */
+            int lowest = SMS_PRIORITY_COUNT - 1;
+            while (lowest > priority && m_queues[lowest].empty())
+                --lowest;
 
-    /* Check if 3G module is connected.
-     * We do not want to write the message to a file
-     * otherwise if the user connects the 3G module
-     * again, the emergency phone might get overflowed with
-     * tons of messages.
-     */
-    if (access(MODULE_3G_DEVPATH, F_OK ) != 0) {
+            if (lowest <= priority) {
+                std::stringstream ss;
+                ss << "SMS queue full. Discarding text message to " << to;
+                Logger::err(ss.str());
+                return false;
+            }
+
+            {
+                std::stringstream ss;
+                ss << "SMS queue full. Dropping queued text message to " << m_queues[lowest].back().to;
+                Logger::warn(ss.str());
+            }
+            m_queues[lowest].pop_back();
+            m_queue_depth--;
+        }
+
+        OutgoingSMS sms;
+        sms.to = to;
+        sms.content = content;
+        sms.queued = now;
+        sms.ready = ready;
+        m_queues[priority].push_back(sms);
+        m_queue_depth++;
+    }
+
+    m_cond.notify_one();
+
+    return true;
+}
+
+void SMSSender::flush()
+{
+    std::vector<OutgoingSMS> pending;
+    {
+        std::lock_guard<std::mutex> guard(m_mutex);
+        if (!m_running)
+            return;
+
+        for (auto &queue : m_queues) {
+            pending.insert(pending.end(), queue.begin(), queue.end());
+            queue.clear();
+        }
+        m_queue_depth = 0;
+    }
+
+    if (pending.empty())
+        return;
+
+    if (access(m_modem_devpath.c_str(), F_OK) != 0) {
         std::stringstream ss;
         ss << "3G module not detected (no ";
-        ss << MODULE_3G_DEVPATH << " found). Discarding text message.";
+        ss << m_modem_devpath << " found). Discarding " << pending.size() << " text messages.";
         Logger::err(ss.str());
-        return false;
+        return;
+    }
+
+    for (const auto &sms : pending)
+        writeSMS(sms);
+}
+
+unsigned int SMSSender::getQueueDepth()
+{
+    std::lock_guard<std::mutex> guard(m_mutex);
+    return m_queue_depth;
+}
+
+void SMSSender::run()
+{
+    Logger::info("SMS sender started");
+
+    startSpoolWatch();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (m_running) {
+        lock.unlock();
+        reconcileSpool();
+        lock.lock();
+
+        if (m_queue_depth == 0) {
+            m_cond.wait_for(lock, std::chrono::milliseconds(100));
+            continue;
+        }
+
+        /*
+         * Pick the highest priority SMS whose coalescing window is over.
+         * Otherwise, sleep until the first window ends.
+         */
+        auto now = std::chrono::steady_clock::now();
+        auto next_ready = std::chrono::steady_clock::time_point::max();
+        bool found = false;
+        OutgoingSMS sms;
+        for (auto &queue : m_queues) {
+            for (auto it = queue.begin(); it != queue.end(); ++it) {
+                if (it->ready > now) {
+                    next_ready = std::min(next_ready, it->ready);
+                    continue;
+                }
+
+                sms = *it;
+                queue.erase(it);
+                found = true;
+                break;
+            }
+            if (found)
+                break;
+        }
+        if (!found) {
+            m_cond.wait_until(lock, std::min(next_ready, now + std::chrono::milliseconds(100)));
+            continue;
+        }
+        m_queue_depth--;
+
+        lock.unlock();
+
+        /* Check if 3G module is connected.
+         * We do not want to write the message to a file
+         * otherwise if the user connects the 3G module
+         * again, the emergency phone might get overflowed with
+         * tons of messages.
+         */
+        bool modem_present = access(m_modem_devpath.c_str(), F_OK) == 0;
+        if (!modem_present) {
+            std::stringstream ss;
+            ss << "3G module not detected (no ";
+            ss << m_modem_devpath << " found). Discarding text message.";
+            Logger::err(ss.str());
+        } else {
+            writeSMS(sms);
+        }
+
+        lock.lock();
+
+        /*
+         * Do not hand over SMS to smstools faster than
+         * the modem can send them.
+         */
+        if (modem_present)
+            m_cond.wait_for(lock, std::chrono::milliseconds(SMS_SEND_PERIOD), [this] { return !m_running; });
     }
 
+    lock.unlock();
+    stopSpoolWatch();
+}
+
+bool SMSSender::writeSMS(const OutgoingSMS &sms)
+{
     std::ofstream file;
 
-    std::stringstream filename;
-    filename << "sms_" << getpid() << "_"  << m_counter;
+    /* Also called by flush(), from another thread than run() */
+    uint64_t counter;
+    {
+        std::lock_guard<std::mutex> guard(m_files_mutex);
+        counter = m_counter++;
+    }
 
-    m_counter++;
+    std::stringstream filename;
+    filename << "sms_" << getpid() << "_"  << counter;
 
+    /* Stay on the same file system as the outgoing dir so that rename works */
     std::stringstream tmp_path;
-    tmp_path << "/tmp/" << filename.str();
+    tmp_path << m_spool_dir << filename.str() << ".tmp";
     file.open(tmp_path.str());
 
     /* Create temporary file */
-    file << "To: " << to << '\n';
+    file << "To: " << sms.to << '\n';
     file << '\n';
-    file << content << '\n';
+    file << sms.content << '\n';
     file.close();
 
     /* Move it to smstool outgoing dir */
     std::stringstream path;
-    path << SMS_OUTGOING_DIR << filename.str();
+    path << m_outgoing_dir << filename.str();
     if (rename(tmp_path.str().c_str(), path.str().c_str()) < 0) {
         Logger::err("Failed to send SMS\n");
         return false;
     }
 
     /* Keep track of this file to delete it later */
-    m_old_files[filename.str()] = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> guard(m_files_mutex);
+    auto timestamp = std::chrono::steady_clock::now();
+    m_spool_index.insert(std::make_pair(timestamp, filename.str()));
+    m_spool_files[filename.str()] = timestamp;
 
     return true;
 }
 
 void SMSSender::cleanupSMS()
 {
+    std::lock_guard<std::mutex> guard(m_files_mutex);
+
     auto timestamp_now = std::chrono::steady_clock::now();
 
-    for (auto &e : m_old_files) {
-        std::string filename = e.first;
-        auto timestamp = e.second;
+    /* Files are ordered by creation time, oldest first */
+    while (!m_spool_index.empty()) {
+        auto it = m_spool_index.begin();
+        std::string filename = it->second;
+        auto timestamp = it->first;
         auto sms_age = std::chrono::duration_cast<std::chrono::seconds>(timestamp_now - timestamp).count();
 
         if (sms_age < SMS_TOO_OLD)
-            continue;
+            break;
 
         {
             std::stringstream ss;
@@ -124,14 +402,96 @@ void SMSSender::cleanupSMS()
             ss << filename;
             Logger::info(ss.str());
         }
-        std::string filepath = SMS_OUTGOING_DIR;
+        std::string filepath = m_outgoing_dir;
         filepath += filename;
-        if (remove(filepath.c_str()) != 0) {
+        if (remove(filepath.c_str()) != 0 && errno != ENOENT) {
             std::stringstream ss;
             ss << "Failed to delete file ";
             ss << filepath;
             Logger::err(ss.str());
         }
+
+        m_spool_files.erase(filename);
+        m_spool_index.erase(it);
+    }
+}
+
+void SMSSender::startSpoolWatch()
+{
+    m_spool_fd = inotify_init1(IN_NONBLOCK);
+    if (m_spool_fd < 0) {
+        Logger::err("inotify_init failed. Cannot track SMS handled by smstools.");
+        return;
+    }
+
+    std::string sent_dir = m_spool_dir + "sent/";
+    m_sent_wd = inotify_add_watch(m_spool_fd, sent_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (m_sent_wd < 0)
+        Logger::warn("Cannot watch directory " + sent_dir);
+
+    std::string failed_dir = m_spool_dir + "failed/";
+    m_failed_wd = inotify_add_watch(m_spool_fd, failed_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (m_failed_wd < 0)
+        Logger::warn("Cannot watch directory " + failed_dir);
+}
+
+void SMSSender::stopSpoolWatch()
+{
+    if (m_spool_fd < 0)
+        return;
+
+    if (m_sent_wd >= 0)
+        inotify_rm_watch(m_spool_fd, m_sent_wd);
+    if (m_failed_wd >= 0)
+        inotify_rm_watch(m_spool_fd, m_failed_wd);
+    close(m_spool_fd);
+    m_spool_fd = -1;
+    m_sent_wd = -1;
+    m_failed_wd = -1;
+}
+
+/*
+ * smstools moves files from the outgoing directory to the sent or
+ * failed directory once it is done with them. Stop tracking these
+ * files so that cleanupSMS() only deals with SMS still in the spool.
+ */
+void SMSSender::reconcileSpool()
+{
+    if (m_spool_fd < 0)
+        return;
+
+    while (true) {
+        char __attribute__ ((aligned(8))) buf[SPOOL_BUF_LEN];
+        ssize_t len = read(m_spool_fd, buf, sizeof(buf));
+        if (len <= 0)
+            break;
+
+        ssize_t i = 0;
+        while (i < len) {
+            struct inotify_event *event = reinterpret_cast<struct inotify_event *>(&buf[i]);
+            i += sizeof(struct inotify_event) + event->len;
+
+            if (!event->len)
+                continue;
+
+            std::string filename(event->name);
+            {
+                std::lock_guard<std::mutex> guard(m_files_mutex);
+                auto it = m_spool_files.find(filename);
+                if (it == m_spool_files.end())
+                    continue;
+                m_spool_index.erase(std::make_pair(it->second, filename));
+                m_spool_files.erase(it);
+            }
+
+            std::stringstream ss;
+            if (event->wd == m_failed_wd) {
+                ss << "smstools failed to send SMS " << filename;
+                Logger::err(ss.str());
+            } else {
+                ss << "smstools sent SMS " << filename;
+                Logger::debug(ss.str());
+            }
+        }
     }
-    m_old_files.clear();
 }
@@ -2,11 +2,26 @@
 #define SMS_SENDER_HPP
 
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <map>
 #include <mutex>
+#include <set>
 #include <string>
+#include <thread>
 
+#define SMS_MAX_SEGMENTS        (3)         /* see autosplit in smsd.conf */
+#define SMS_SEGMENT_LENGTH      (153)       /* of a concatenated SMS */
+#define SMS_MAX_LENGTH          (SMS_MAX_SEGMENTS * SMS_SEGMENT_LENGTH)
+
+/* Lower value means the SMS is sent first */
+enum SMSPriority {
+    SMS_PRIORITY_ALERT,
+    SMS_PRIORITY_REPLY,
+    SMS_PRIORITY_DEBUG,
+    SMS_PRIORITY_COUNT,
+};
 
 class SMSSender {
 public:
@@ -18,33 +33,98 @@ public:
     static SMSSender& instance();
 
     /**
-     * @brief Send SMS
+     * @brief Start sending queued SMS
+     *
+     * @param spool_dir smstools spool directory, containing
+     * outgoing, sent and failed directories
+     * @param modem_devpath device used by smstools to talk to the modem
+     */
+    void start(const std::string &spool_dir, const std::string &modem_devpath);
+    void stop();
+
+    /**
+     * @brief Queue SMS for sending
+     *
+     * The SMS is handed over to smstools by a background thread,
+     * highest priority first. SMS to the same phone number that are
+     * queued within a few seconds are merged into one. This function
+     * never blocks. If the queue is full, the newest SMS of lower
+     * priority is dropped to make room, otherwise this SMS is
+     * discarded.
      *
      * @param to phone number
      * @param content
-     * @return true SMS sent successfully
-     * @return false SMS not sent
+     * @param priority
+     * @return true SMS queued
+     * @return false SMS discarded
      */
-    bool sendSMS(const std::string& to, const std::string &content);
+    bool sendSMS(const std::string& to, const std::string &content, SMSPriority priority = SMS_PRIORITY_REPLY);
+
+    /**
+     * @brief Hand over all queued SMS to smstools right away
+     *
+     * Coalescing windows and send rate are ignored. Called before
+     * rebooting so that queued SMS are not lost.
+     */
+    void flush();
+
+    /**
+     * @brief Get number of SMS waiting to be handed over to smstools
+     */
+    unsigned int getQueueDepth();
 
     /**
      * @brief Clean old SMS to avoid having too many files
      * in the SMS outgoing directory.
      *
+     * Only SMS that smstools did not move to its sent or
+     * failed directories are deleted.
+     *
      * This function should periodically be called.
      */
     void cleanupSMS();
 
 private:
+    struct OutgoingSMS {
+        std::string to;
+        std::string content;
+        std::chrono::steady_clock::time_point queued;
+        std::chrono::steady_clock::time_point ready;    /* Do not send before */
+    };
 
     SMSSender();
-    ~SMSSender() = default;
+    ~SMSSender();
 
+    void run();
     void cleanOutgoingDir();
+    bool writeSMS(const OutgoingSMS &sms);
+    void startSpoolWatch();
+    void stopSpoolWatch();
+    void reconcileSpool();
+
+    std::string m_spool_dir;
+    std::string m_outgoing_dir;
+    std::string m_modem_devpath;
 
     std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::thread *m_thread;
+    bool m_running;
+    std::deque<OutgoingSMS> m_queues[SMS_PRIORITY_COUNT];
+    unsigned int m_queue_depth;
+
+    /* Protect m_counter, m_spool_index and m_spool_files */
+    std::mutex m_files_mutex;
     uint64_t m_counter;
-    std::map<std::string, std::chrono::time_point<std::chrono::steady_clock>> m_old_files;
+
+    /* SMS files in the outgoing directory, ordered by creation time */
+    std::set<std::pair<std::chrono::steady_clock::time_point, std::string>> m_spool_index;
+    std::map<std::string, std::chrono::steady_clock::time_point> m_spool_files;
+
+    /* inotify watches on smstools sent and failed directories */
+    int m_spool_fd;
+    int m_sent_wd;
+    int m_failed_wd;
 };
 
 #endif
@@ -1,11 +1,13 @@
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 #include <microhttpd.h>
 #include <stdexcept>
 #include <sstream>
 #include "logger.hpp"
 #include "web_server.hpp"
 
-#define DEFAULT_WEBSERVER_PORT  (80)
+#define HISTORY_DEFAULT_PERIOD      (24 * 60 * 60)  /* in seconds */
 
 namespace {
 
@@ -26,19 +28,52 @@ answerConnection(void *cls, struct MHD_Connection *connection,
     int ret;
 #endif
     BaseStation *b = reinterpret_cast<BaseStation*>(cls);
-    (void) url;               /* Unused. Silent compiler warning. */
     (void) method;            /* Unused. Silent compiler warning. */
     (void) version;           /* Unused. Silent compiler warning. */
     (void) upload_data;       /* Unused. Silent compiler warning. */
     (void) upload_data_size;  /* Unused. Silent compiler warning. */
     (void) con_cls;           /* Unused. Silent compiler warning. */
 
-    std::string page = b->buildWebpage();
+    std::string page;
+    unsigned int status = MHD_HTTP_OK;
+    bool is_json = false;
+    if (strcmp(url, "/history") == 0) {
+        /*
+         * /history?heater=<name or MAC>&from=<timestamp>&to=<timestamp>&resolution=<hourly|daily|monthly>
+         * Without heater, list heaters with a history.
+         */
+        const char *heater = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "heater");
+        const char *from = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "from");
+        const char *to = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "to");
+        const char *resolution = MHD_lookup_connection_value(connection, MHD_GET_ARGUMENT_KIND, "resolution");
+
+        time_t now = time(nullptr);
+        time_t from_ts = from ? strtoll(from, nullptr, 10) : now - HISTORY_DEFAULT_PERIOD;
+        time_t to_ts = to ? strtoll(to, nullptr, 10) : now;
+        HistoryResolution res = HISTORY_RAW;
+        if (resolution && strcmp(resolution, "hourly") == 0)
+            res = HISTORY_HOURLY;
+        else if (resolution && strcmp(resolution, "daily") == 0)
+            res = HISTORY_DAILY;
+        else if (resolution && strcmp(resolution, "monthly") == 0)
+            res = HISTORY_MONTHLY;
+
+        page = b->buildHistory(heater ? heater : "", from_ts, to_ts, res);
+        if (page.empty()) {
+            status = MHD_HTTP_NOT_FOUND;
+            page = "{\"error\":\"unknown heater\"}";
+        }
+        is_json = true;
+    } else {
+        page = b->buildWebpage();
+    }
 
     char *buf = (char *)malloc(page.length() + 1);
     strcpy(buf, page.c_str());
     response = MHD_create_response_from_buffer(page.length(), buf, MHD_RESPMEM_MUST_FREE);
-    ret = MHD_queue_response(connection, MHD_HTTP_OK, response);
+    if (is_json)
+        MHD_add_response_header(response, MHD_HTTP_HEADER_CONTENT_TYPE, "application/json");
+    ret = MHD_queue_response(connection, status, response);
     MHD_destroy_response(response);
 
     return ret;
@@ -46,8 +81,9 @@ answerConnection(void *cls, struct MHD_Connection *connection,
 
 }
 
-WebServer::WebServer(BaseStation *b):
+WebServer::WebServer(BaseStation *b, unsigned int port):
 m_base_station(b),
+m_port(port),
 m_daemon(nullptr)
 {
 
@@ -66,7 +102,7 @@ void WebServer::start()
     }
 
     m_daemon = MHD_start_daemon(MHD_USE_AUTO | MHD_USE_INTERNAL_POLLING_THREAD,
-                               DEFAULT_WEBSERVER_PORT, NULL, NULL,
+                               m_port, NULL, NULL,
                                answerConnection, m_base_station, MHD_OPTION_END);
 
     if (!m_daemon) {
@@ -74,7 +110,7 @@ void WebServer::start()
         throw std::runtime_error("Failed to start web server");
     } else {
         std::stringstream ss;
-        ss << "Web server started. Listening on port " << DEFAULT_WEBSERVER_PORT;
+        ss << "Web server started. Listening on port " << m_port;
         Logger::info(ss.str());
     }
 }
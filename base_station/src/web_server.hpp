@@ -6,7 +6,7 @@
 
 class WebServer {
 public:
-    explicit WebServer(BaseStation *b);
+    WebServer(BaseStation *b, unsigned int port);
     ~WebServer();
 
     void start();
@@ -15,6 +15,7 @@ public:
 private:
 
     BaseStation *m_base_station;
+    unsigned int m_port;
     struct MHD_Daemon *m_daemon;
 };
 
@@ -0,0 +1,125 @@
+#!/bin/sh -e
+
+# This script stands in for smstools so that the base station
+# can run on any Linux machine, without a 3G module.
+#
+# It uses the same spool layout as smstools:
+#   incoming/   text messages received by the base station
+#   outgoing/   text messages to send
+#   sent/       text messages sent
+#   failed/     text messages that could not be sent
+
+SPOOL_DIR="/tmp/fake_smsd"
+LATENCY_MS=3000
+FAILURE_PERCENT=0
+COUNT=1
+
+usage()
+{
+    echo "Usage: $0 [-h] [-d spool-dir] [-l latency-ms] [-f failure-percent] run"
+    echo "       $0 [-h] [-d spool-dir] [-c count] send <from> <text>"
+    echo ""
+    echo "run   Send text messages queued by the base station. Each one takes"
+    echo "      latency-ms to send and fails with a probability of failure-percent."
+    echo "send  Deliver a text message to the base station. With count, deliver"
+    echo "      count text messages at once, from numbers following <from>."
+}
+
+random_percent()
+{
+    echo $(( $(od -An -N2 -tu2 /dev/urandom) % 100 ))
+}
+
+while getopts "hd:l:f:c:" arg; do
+  case $arg in
+    h)
+      usage
+      exit 0
+      ;;
+    d)
+      SPOOL_DIR=$OPTARG
+      ;;
+    l)
+      LATENCY_MS=$OPTARG
+      ;;
+    f)
+      FAILURE_PERCENT=$OPTARG
+      ;;
+    c)
+      COUNT=$OPTARG
+      ;;
+    *)
+      usage
+      exit 1
+      ;;
+  esac
+done
+shift $((OPTIND - 1))
+
+mkdir -p "${SPOOL_DIR}/incoming" "${SPOOL_DIR}/outgoing" "${SPOOL_DIR}/sent" "${SPOOL_DIR}/failed"
+
+case "$1" in
+  run)
+    echo "Fake smsd running (spool: ${SPOOL_DIR}, latency: ${LATENCY_MS}ms, failures: ${FAILURE_PERCENT}%)"
+    while true; do
+      for f in "${SPOOL_DIR}"/outgoing/*; do
+        [ -f "$f" ] || continue
+
+        # Simulate the time it takes the modem to send the message
+        sleep "$(awk "BEGIN { print ${LATENCY_MS} / 1000 }")"
+
+        TO=$(sed -n 's/^To: //p' "$f")
+        if [ "$(random_percent)" -lt "${FAILURE_PERCENT}" ]; then
+          mv "$f" "${SPOOL_DIR}/failed/"
+          echo "[$(date +%T)] Failed to send $(basename "$f") to ${TO}"
+        else
+          mv "$f" "${SPOOL_DIR}/sent/"
+          echo "[$(date +%T)] Sent $(basename "$f") to ${TO}:"
+          sed '1,/^$/d' "${SPOOL_DIR}/sent/$(basename "$f")"
+        fi
+      done
+      sleep 0.2
+    done
+    ;;
+  send)
+    if [ $# -ne 3 ]; then
+      usage
+      exit 1
+    fi
+
+    BATCH_DIR="${SPOOL_DIR}/tmp.$$"
+    mkdir -p "${BATCH_DIR}"
+    PREFIX="GSM1.$(date +%s%N)"
+    NOW=$(date +"%y-%m-%d %T")
+    LENGTH=$(printf "%s" "$3" | wc -c)
+    i=0
+    while [ $i -lt "${COUNT}" ]; do
+      FROM=$2
+      [ "${COUNT}" -eq 1 ] || FROM=$(( $2 + i ))
+      cat > "${BATCH_DIR}/${PREFIX}.$i" <<- EOM
+From: ${FROM}
+From_TOA: 91 international, ISDN/telephone
+From_SMSC: 33000000000
+Sent: ${NOW}
+Received: ${NOW}
+Subject: GSM1
+Modem: GSM1
+Report: no
+Alphabet: ISO
+Length: ${LENGTH}
+
+$3
+EOM
+      i=$((i + 1))
+    done
+    # Like smstools, only move complete files in the incoming directory.
+    # mv checks each file after moving it, which fails if the base station
+    # already handled it: rmdir fails instead if a file was not moved.
+    mv "${BATCH_DIR}"/* "${SPOOL_DIR}/incoming/" 2> /dev/null || true
+    rmdir "${BATCH_DIR}"
+    ;;
+  *)
+    usage
+    exit 1
+    ;;
+esac
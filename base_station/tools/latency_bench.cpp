@@ -0,0 +1,617 @@
+/*
+ * Measure the time between a text message landing in the smstools
+ * incoming directory and every heater controller concerned receiving
+ * the new state.
+ *
+ * The base station is started against a temporary spool directory and
+ * a fleet of fake heater controllers. Each of them polls the base station
+ * like the firmware does: connect, send REQ_HEATER_STATE, wait for
+ * HEATER_STATE_REPLY and disconnect. No modem nor network access is needed.
+ */
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <ftw.h>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+#define DEFAULT_BASE_STATION_PATH   "build/release/bin/base_station-release"
+#define DEFAULT_FLEET_SIZES         "1,10,50"
+#define DEFAULT_POLL_PERIODS        "1000,5000"
+#define DEFAULT_RUN_COUNT           (10)
+#define DEFAULT_PORT                (40000)
+
+#define MESSAGE_SIZE                (64)
+#define HEATER_STATE_TIMEOUT        (1000)      /* in milliseconds, same as firmware */
+#define STARTUP_TIMEOUT             (5000)      /* in milliseconds */
+#define COMMAND_TIMEOUT             (10000)     /* in milliseconds, on top of poll period */
+#define SENDER_PHONE_NUMBER         "33600000000"
+
+typedef std::chrono::steady_clock Clock;
+
+enum MessageType {
+    REQ_HEATER_STATE = 1,
+    HEATER_STATE_REPLY = 2,
+};
+
+enum HeaterState {
+    HEATER_OFF = 0,
+    HEATER_DEFROST = 1,
+    HEATER_ECO = 2,
+    HEATER_COMFORT = 3,
+};
+
+struct FakeHeater {
+    std::string name;
+    uint8_t mac[6];
+    uint64_t counter;
+    unsigned int period;            /* in milliseconds */
+    int fd;
+    bool connected;
+    Clock::time_point next_poll;
+    Clock::time_point poll_start;
+    uint8_t rx[MESSAGE_SIZE];
+    size_t rx_len;
+    int state;                      /* -1 until first reply */
+    Clock::time_point state_since;  /* when the current state was first received */
+};
+
+static std::mt19937 rng(std::random_device{}());
+
+static void print_help(char *program_name)
+{
+    std::cout << "Usage: " << program_name << " [options]\n"
+              << "Options:\n"
+              << "    --base-station <path>             Base station program (default: " DEFAULT_BASE_STATION_PATH ")\n"
+              << "    --heaters <n,...>                 Fleet sizes (default: " DEFAULT_FLEET_SIZES ")\n"
+              << "    --poll-periods <ms,...>           Heater poll periods (default: " DEFAULT_POLL_PERIODS ")\n"
+              << "    --runs <count>                    Number of times each command is sent (default: " << DEFAULT_RUN_COUNT << ")\n"
+              << "    --port <port>                     First TCP port used by base station (default: " << DEFAULT_PORT << ")\n"
+              << "    --help, -h                        Print help\n"
+              << std::flush;
+}
+
+static std::vector<unsigned int> parse_list(const std::string &str)
+{
+    std::vector<unsigned int> values;
+    std::stringstream ss(str);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        int value = std::stoi(item);
+        if (value <= 0)
+            throw std::invalid_argument(item);
+        values.push_back(value);
+    }
+    return values;
+}
+
+static unsigned int elapsed_ms(Clock::time_point from, Clock::time_point to)
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+}
+
+static int remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+static void remove_dir(const std::string &path)
+{
+    nftw(path.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static pid_t start_base_station(const std::string &program, const std::string &work_dir, unsigned int port)
+{
+    std::string device_server_port = std::to_string(port);
+    std::string web_server_port = std::to_string(port + 1);
+    std::string spool_dir = work_dir + "/spool";
+    std::string state_file = work_dir + "/base_station.state";
+    std::string history_dir = work_dir + "/history";
+
+    pid_t pid = fork();
+    if (pid < 0)
+        throw std::runtime_error("Failed to fork");
+
+    if (pid == 0) {
+        /* Logs are written in current directory */
+        if (chdir(work_dir.c_str()) < 0)
+            _exit(127);
+
+        int null_fd = open("/dev/null", O_RDWR);
+        if (null_fd >= 0) {
+            dup2(null_fd, STDOUT_FILENO);
+            dup2(null_fd, STDERR_FILENO);
+            close(null_fd);
+        }
+
+        execl(program.c_str(), program.c_str(),
+              "--device-server-port", device_server_port.c_str(),
+              "--web-server-port", web_server_port.c_str(),
+              "--sms-spool-dir", spool_dir.c_str(),
+              "--modem-devpath", "/dev/null",
+              "--state-file", state_file.c_str(),
+              "--history-dir", history_dir.c_str(),
+              static_cast<char *>(nullptr));
+        _exit(127);
+    }
+
+    return pid;
+}
+
+static void stop_base_station(pid_t pid)
+{
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+static bool wait_for_base_station(pid_t pid, unsigned int port)
+{
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    Clock::time_point deadline = Clock::now() + std::chrono::milliseconds(STARTUP_TIMEOUT);
+    while (Clock::now() < deadline) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid)
+            return false;
+
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            return false;
+        bool ok = connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0;
+        close(fd);
+        if (ok)
+            return true;
+
+        usleep(100 * 1000);
+    }
+
+    return false;
+}
+
+/*
+ * Write the text message next to the incoming directory and move
+ * it there, like smstools does. Return the time at which it landed.
+ */
+static Clock::time_point send_sms(const std::string &spool_dir, const std::string &content)
+{
+    static unsigned int sms_count = 0;
+    std::string filename = "GSM1." + std::to_string(getpid()) + "." + std::to_string(sms_count++);
+    std::string tmp_path = spool_dir + "/" + filename;
+
+    {
+        std::ofstream file(tmp_path);
+        file << "From: " SENDER_PHONE_NUMBER "\n"
+             << "From_TOA: 91 international, ISDN/telephone\n"
+             << "Subject: GSM1\n"
+             << "Modem: GSM1\n"
+             << "Alphabet: ISO\n"
+             << "Length: " << content.length() << "\n"
+             << "\n"
+             << content;
+        if (!file)
+            throw std::runtime_error("Failed to write " + tmp_path);
+    }
+
+    if (rename(tmp_path.c_str(), (spool_dir + "/incoming/" + filename).c_str()) < 0)
+        throw std::runtime_error("Failed to move " + tmp_path + " to incoming directory");
+
+    return Clock::now();
+}
+
+class Fleet {
+public:
+    Fleet(unsigned int count, unsigned int period, unsigned int port);
+    ~Fleet();
+
+    /* Run fake heaters until done returns true or deadline is reached */
+    bool runUntil(std::function<bool()> done, Clock::time_point deadline);
+
+    std::vector<FakeHeater> heaters;
+    unsigned int failures;
+
+private:
+    void startPoll(FakeHeater &h, Clock::time_point now);
+    void sendRequest(FakeHeater &h);
+    void handleReply(FakeHeater &h, Clock::time_point now);
+    void endPoll(FakeHeater &h, bool failed);
+
+    struct sockaddr_in m_addr;
+};
+
+Fleet::Fleet(unsigned int count, unsigned int period, unsigned int port):
+heaters(count),
+failures(0),
+m_addr()
+{
+    m_addr.sin_family = AF_INET;
+    m_addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    m_addr.sin_port = htons(port);
+
+    Clock::time_point now = Clock::now();
+    std::uniform_int_distribution<unsigned int> phase(0, period - 1);
+    for (unsigned int i = 0; i < count; ++i) {
+        FakeHeater &h = heaters[i];
+        h.name = "H" + std::to_string(i);
+        h.mac[0] = 0x02;
+        h.mac[1] = 0x00;
+        h.mac[2] = (i >> 24) & 0xFF;
+        h.mac[3] = (i >> 16) & 0xFF;
+        h.mac[4] = (i >> 8) & 0xFF;
+        h.mac[5] = i & 0xFF;
+        h.counter = (static_cast<uint64_t>(rng()) << 32) | rng();
+        /* Same jitter as firmware */
+        h.period = period + 50 * ((h.counter >> 32) & 0xF);
+        h.fd = -1;
+        h.connected = false;
+        h.next_poll = now + std::chrono::milliseconds(phase(rng));
+        h.rx_len = 0;
+        h.state = -1;
+    }
+}
+
+Fleet::~Fleet()
+{
+    for (auto &h : heaters) {
+        if (h.fd >= 0)
+            close(h.fd);
+    }
+}
+
+bool Fleet::runUntil(std::function<bool()> done, Clock::time_point deadline)
+{
+    std::vector<struct pollfd> fds;
+    std::vector<FakeHeater *> owners;
+
+    while (!done()) {
+        Clock::time_point now = Clock::now();
+        if (now >= deadline)
+            return false;
+
+        fds.clear();
+        owners.clear();
+        for (auto &h : heaters) {
+            if (h.fd < 0 && now >= h.next_poll)
+                startPoll(h, now);
+            if (h.fd >= 0 && elapsed_ms(h.poll_start, now) >= HEATER_STATE_TIMEOUT)
+                endPoll(h, true);
+
+            if (h.fd >= 0) {
+                struct pollfd pfd;
+                pfd.fd = h.fd;
+                pfd.events = h.connected ? POLLIN : POLLOUT;
+                pfd.revents = 0;
+                fds.push_back(pfd);
+                owners.push_back(&h);
+            }
+        }
+
+        if (poll(fds.data(), fds.size(), 1) < 0 && errno != EINTR)
+            throw std::runtime_error("poll failed");
+
+        now = Clock::now();
+        for (unsigned int i = 0; i < fds.size(); ++i) {
+            FakeHeater &h = *owners[i];
+            if (!fds[i].revents)
+                continue;
+
+            if (!h.connected) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(h.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err) {
+                    endPoll(h, true);
+                    continue;
+                }
+                h.connected = true;
+                sendRequest(h);
+            } else {
+                ssize_t ret = read(h.fd, h.rx + h.rx_len, sizeof(h.rx) - h.rx_len);
+                if (ret <= 0) {
+                    endPoll(h, true);
+                    continue;
+                }
+                h.rx_len += ret;
+                if (h.rx_len == sizeof(h.rx))
+                    handleReply(h, now);
+            }
+        }
+    }
+
+    return true;
+}
+
+void Fleet::startPoll(FakeHeater &h, Clock::time_point now)
+{
+    /* Like a ticker, keep a fixed rate unless we fell behind */
+    h.next_poll += std::chrono::milliseconds(h.period);
+    if (h.next_poll < now)
+        h.next_poll = now + std::chrono::milliseconds(h.period);
+
+    h.poll_start = now;
+    h.rx_len = 0;
+    h.connected = false;
+    h.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (h.fd < 0) {
+        failures++;
+        return;
+    }
+
+    if (connect(h.fd, reinterpret_cast<const struct sockaddr *>(&m_addr), sizeof(m_addr)) == 0) {
+        h.connected = true;
+        sendRequest(h);
+    } else if (errno != EINPROGRESS) {
+        endPoll(h, true);
+    }
+}
+
+void Fleet::sendRequest(FakeHeater &h)
+{
+    uint8_t msg[MESSAGE_SIZE];
+    memset(msg, 0xFF, sizeof(msg));
+    msg[0] = 1;
+    msg[1] = REQ_HEATER_STATE;
+    memcpy(&msg[2], h.mac, sizeof(h.mac));
+    memcpy(&msg[8], &h.counter, sizeof(h.counter));
+    memcpy(&msg[16], h.name.c_str(), h.name.length() + 1);
+    h.counter++;
+
+    /* Fits in an empty socket buffer */
+    if (write(h.fd, msg, sizeof(msg)) != static_cast<ssize_t>(sizeof(msg)))
+        endPoll(h, true);
+}
+
+void Fleet::handleReply(FakeHeater &h, Clock::time_point now)
+{
+    if (h.rx[0] != 1 || h.rx[1] != HEATER_STATE_REPLY || h.rx[16] > HEATER_COMFORT) {
+        endPoll(h, true);
+        return;
+    }
+
+    if (h.state != h.rx[16]) {
+        h.state = h.rx[16];
+        h.state_since = now;
+    }
+    endPoll(h, false);
+}
+
+void Fleet::endPoll(FakeHeater &h, bool failed)
+{
+    if (failed)
+        failures++;
+    close(h.fd);
+    h.fd = -1;
+}
+
+static unsigned int percentile(const std::vector<unsigned int> &sorted, unsigned int p)
+{
+    /* Nearest-rank method */
+    size_t rank = (p * sorted.size() + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static void print_stats(unsigned int heater_count, unsigned int period, const std::string &command,
+                        std::vector<unsigned int> latencies, unsigned int timeouts)
+{
+    std::cout << std::setw(7) << heater_count
+              << std::setw(11) << period
+              << "  " << std::left << std::setw(11) << command << std::right
+              << std::setw(5) << latencies.size()
+              << std::setw(9) << timeouts;
+
+    if (latencies.empty()) {
+        std::cout << std::endl;
+        return;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << std::setw(8) << latencies.front()
+              << std::setw(8) << percentile(latencies, 50)
+              << std::setw(8) << percentile(latencies, 90)
+              << std::setw(8) << percentile(latencies, 99)
+              << std::setw(8) << latencies.back()
+              << std::endl;
+}
+
+/*
+ * Send "ALL ECO", "HEATER X OFF", "ALL COMFORT", "HEATER Y OFF", ...
+ * so that every command changes the state of the heaters it targets.
+ * The latency of a command is the time until the last of them got
+ * the new state.
+ */
+static void run_benchmark(const std::string &program, unsigned int heater_count,
+                          unsigned int period, unsigned int run_count, unsigned int port)
+{
+    char dir_template[] = "/tmp/latency_bench.XXXXXX";
+    if (!mkdtemp(dir_template))
+        throw std::runtime_error("Failed to create temporary directory");
+    std::string work_dir(dir_template);
+    std::string spool_dir = work_dir + "/spool";
+    for (auto d : {"", "/incoming", "/outgoing", "/sent", "/failed"})
+        mkdir((spool_dir + d).c_str(), 0755);
+
+    pid_t pid = start_base_station(program, work_dir, port);
+    if (!wait_for_base_station(pid, port)) {
+        stop_base_station(pid);
+        remove_dir(work_dir);
+        throw std::runtime_error("Base station did not start");
+    }
+
+    Fleet fleet(heater_count, period, port);
+    std::vector<unsigned int> all_latencies, heater_latencies;
+    unsigned int all_timeouts = 0, heater_timeouts = 0;
+    unsigned int timeout = 2 * period + COMMAND_TIMEOUT;
+
+    /* Let every heater controller get its initial state */
+    fleet.runUntil([&fleet] {
+        for (auto &h : fleet.heaters) {
+            if (h.state < 0)
+                return false;
+        }
+        return true;
+    }, Clock::now() + std::chrono::milliseconds(timeout));
+
+    std::uniform_int_distribution<unsigned int> heater_index(0, heater_count - 1);
+    std::uniform_int_distribution<unsigned int> gap(0, period);
+    for (unsigned int i = 0; i < 2 * run_count; ++i) {
+        std::vector<FakeHeater *> targets;
+        std::string command;
+        int expected_state;
+
+        if (i % 2 == 0) {
+            command = (i % 4 == 0) ? "ALL ECO" : "ALL COMFORT";
+            expected_state = (i % 4 == 0) ? HEATER_ECO : HEATER_COMFORT;
+            for (auto &h : fleet.heaters)
+                targets.push_back(&h);
+        } else {
+            FakeHeater &h = fleet.heaters[heater_index(rng)];
+            command = "HEATER " + h.name + " OFF";
+            expected_state = HEATER_OFF;
+            targets.push_back(&h);
+        }
+
+        Clock::time_point t0 = send_sms(spool_dir, command);
+        bool done = fleet.runUntil([&] {
+            for (auto h : targets) {
+                if (h->state != expected_state || h->state_since < t0)
+                    return false;
+            }
+            return true;
+        }, t0 + std::chrono::milliseconds(timeout));
+
+        std::vector<unsigned int> &latencies = (i % 2 == 0) ? all_latencies : heater_latencies;
+        unsigned int &timeouts = (i % 2 == 0) ? all_timeouts : heater_timeouts;
+        if (done) {
+            Clock::time_point last = t0;
+            for (auto h : targets)
+                last = std::max(last, h->state_since);
+            latencies.push_back(elapsed_ms(t0, last));
+        } else {
+            timeouts++;
+        }
+
+        /* Do not send next command in phase with heater polls */
+        fleet.runUntil([] { return false; }, Clock::now() + std::chrono::milliseconds(gap(rng)));
+    }
+
+    stop_base_station(pid);
+    remove_dir(work_dir);
+
+    print_stats(heater_count, period, "ALL", all_latencies, all_timeouts);
+    print_stats(heater_count, period, "HEATER X", heater_latencies, heater_timeouts);
+    if (fleet.failures) {
+        std::cout << "        " << fleet.failures << " heater state requests failed" << std::endl;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    char *program_name = argv[0];
+    std::string base_station_path = DEFAULT_BASE_STATION_PATH;
+    std::vector<unsigned int> fleet_sizes = parse_list(DEFAULT_FLEET_SIZES);
+    std::vector<unsigned int> poll_periods = parse_list(DEFAULT_POLL_PERIODS);
+    unsigned int run_count = DEFAULT_RUN_COUNT;
+    unsigned int port = DEFAULT_PORT;
+
+    argc--;
+    argv++;
+    try {
+        while (argc) {
+            std::string opt(argv[0]);
+            if (opt == "--base-station" && argc >= 2) {
+                base_station_path = argv[1];
+                argc--;
+                argv++;
+            } else if (opt == "--heaters" && argc >= 2) {
+                fleet_sizes = parse_list(argv[1]);
+                argc--;
+                argv++;
+            } else if (opt == "--poll-periods" && argc >= 2) {
+                poll_periods = parse_list(argv[1]);
+                argc--;
+                argv++;
+            } else if (opt == "--runs" && argc >= 2) {
+                run_count = std::stoi(argv[1]);
+                argc--;
+                argv++;
+            } else if (opt == "--port" && argc >= 2) {
+                port = std::stoi(argv[1]);
+                argc--;
+                argv++;
+            } else if (opt == "--help" || opt == "-h") {
+                print_help(program_name);
+                return 0;
+            } else {
+                std::cerr << "Invalid option: \"" << opt << '\"' << std::endl;
+                print_help(program_name);
+                return -1;
+            }
+
+            argc--;
+            argv++;
+        }
+    } catch (const std::logic_error &) {
+        std::cerr << "Invalid option value" << std::endl;
+        print_help(program_name);
+        return -1;
+    }
+
+    /* Base station is started from a temporary directory */
+    char path[PATH_MAX];
+    if (!realpath(base_station_path.c_str(), path)) {
+        std::cerr << "Cannot find base station program \"" << base_station_path << '\"' << std::endl;
+        return -1;
+    }
+
+    /* Connection may be closed by base station while replying */
+    signal(SIGPIPE, SIG_IGN);
+
+    std::cout << std::setw(7) << "heaters"
+              << std::setw(11) << "period(ms)"
+              << "  " << std::left << std::setw(11) << "command" << std::right
+              << std::setw(5) << "runs"
+              << std::setw(9) << "timeouts"
+              << std::setw(8) << "min(ms)"
+              << std::setw(8) << "p50(ms)"
+              << std::setw(8) << "p90(ms)"
+              << std::setw(8) << "p99(ms)"
+              << std::setw(8) << "max(ms)"
+              << std::endl;
+    try {
+        for (auto heater_count : fleet_sizes) {
+            for (auto period : poll_periods) {
+                run_benchmark(path, heater_count, period, run_count, port);
+                /* Avoid connections in TIME_WAIT state from previous base station */
+                port += 2;
+            }
+        }
+    } catch (const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return -1;
+    }
+
+    return 0;
+}
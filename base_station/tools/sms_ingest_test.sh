@@ -0,0 +1,101 @@
+#!/bin/sh -e
+
+# Deliver a burst of text messages at once to the base station and
+# check that each one is parsed exactly once, then report the rate
+# at which they were handled.
+
+BASE_STATION="build/release/bin/base_station-release"
+COUNT=1000
+TIMEOUT=60
+TOOLS_DIR=$(dirname "$0")
+
+usage()
+{
+    echo "Usage: $0 [-h] [-b base-station] [-n count] [-t timeout-s]"
+    echo ""
+    echo "Run the base station against a temporary spool directory, deliver"
+    echo "count text messages at once and wait up to timeout-s seconds for"
+    echo "them to be handled."
+}
+
+while getopts "hb:n:t:" arg; do
+  case $arg in
+    h)
+      usage
+      exit 0
+      ;;
+    b)
+      BASE_STATION=$OPTARG
+      ;;
+    n)
+      COUNT=$OPTARG
+      ;;
+    t)
+      TIMEOUT=$OPTARG
+      ;;
+    *)
+      usage
+      exit 1
+      ;;
+  esac
+done
+
+case "${BASE_STATION}" in
+  /*) ;;
+  *) BASE_STATION="$(pwd)/${BASE_STATION}" ;;
+esac
+
+WORK_DIR=$(mktemp -d)
+SPOOL_DIR="${WORK_DIR}/spool"
+FAKE_SMSD_PID=
+BASE_STATION_PID=
+
+cleanup()
+{
+    [ -z "${BASE_STATION_PID}" ] || kill "${BASE_STATION_PID}" 2> /dev/null || true
+    [ -z "${FAKE_SMSD_PID}" ] || kill "${FAKE_SMSD_PID}" 2> /dev/null || true
+    wait 2> /dev/null || true
+    rm -rf "${WORK_DIR}"
+}
+trap cleanup EXIT
+
+sh "${TOOLS_DIR}/fake_smsd.sh" -d "${SPOOL_DIR}" -l 0 run > "${WORK_DIR}/smsd.log" 2>&1 &
+FAKE_SMSD_PID=$!
+
+# Base station writes its log files in the current directory
+(cd "${WORK_DIR}" && exec "${BASE_STATION}" --sms-spool-dir "${SPOOL_DIR}" --modem-devpath /dev/null \
+    --state-file "${WORK_DIR}/state" --history-dir "${WORK_DIR}/history" \
+    --web-server-port 0 --device-server-port 0) > "${WORK_DIR}/base_station.log" 2>&1 &
+BASE_STATION_PID=$!
+
+# Base station handles text messages once it watches the incoming directory
+sleep 1
+
+START=$(date +%s%N)
+sh "${TOOLS_DIR}/fake_smsd.sh" -d "${SPOOL_DIR}" -c "${COUNT}" send 33600000000 "PING"
+
+DEADLINE=$(( $(date +%s) + TIMEOUT ))
+while [ "$(ls "${SPOOL_DIR}/incoming" | wc -l)" -ne 0 ]; do
+  if [ "$(date +%s)" -ge "${DEADLINE}" ]; then
+    echo "FAIL: $(ls "${SPOOL_DIR}/incoming" | wc -l) text messages still in incoming directory after ${TIMEOUT}s"
+    exit 1
+  fi
+  sleep 0.05
+done
+ELAPSED_MS=$(( ($(date +%s%N) - START) / 1000000 ))
+
+# Let the base station log the last ones
+sleep 0.5
+
+PARSED=$(grep -c 'Parsed SMS file' "${WORK_DIR}/base_station.log" || true)
+UNIQUE=$(grep -o 'Parsed SMS file "[^"]*"' "${WORK_DIR}/base_station.log" | sort -u | wc -l)
+PROCESSED=$(ls "${SPOOL_DIR}/processed" | wc -l)
+
+echo "Delivered ${COUNT} text messages, written and handled in ${ELAPSED_MS} ms ($(( COUNT * 1000 / (ELAPSED_MS + 1) )) per second)"
+echo "Parsed: ${PARSED}, unique: ${UNIQUE}, moved to processed: ${PROCESSED}"
+
+if [ "${PARSED}" -ne "${COUNT}" ] || [ "${UNIQUE}" -ne "${COUNT}" ] || [ "${PROCESSED}" -ne "${COUNT}" ]; then
+  echo "FAIL: each text message must be parsed exactly once"
+  exit 1
+fi
+echo "PASS"
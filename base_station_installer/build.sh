@@ -97,6 +97,19 @@ ExecStart=/usr/local/bin/base_station
 WantedBy=multi-user.target
 EOM
 
+# Advertise device server, so that heater controllers can find the base station with mDNS
+cat > "${TMPDIR}/iotheater.service" <<- EOM
+<?xml version="1.0" standalone='no'?>
+<!DOCTYPE service-group SYSTEM "avahi-service.dtd">
+<service-group>
+  <name>Base station</name>
+  <service>
+    <type>_iotheater._tcp</type>
+    <port>32322</port>
+  </service>
+</service-group>
+EOM
+
 # Generate ssh key
 ssh-keygen -t rsa -b 2048 -f "${TMPDIR}/base_station_ssh_key" -q -N ""
 cat "${TMPDIR}/base_station_ssh_key"
@@ -133,7 +146,7 @@ sed -i 's/#PasswordAuthentication yes/PasswordAuthentication no/g' /etc/ssh/sshd
 # Upgrade packages and install dependencies
 apt update
 apt -y upgrade
-apt -y install unattended-upgrades smstools git build-essential dnsutils libmicrohttpd-dev
+apt -y install unattended-upgrades smstools git build-essential dnsutils libmicrohttpd-dev avahi-daemon
 
 # Disable HDMI
 if ! cat /etc/rc.local | grep -q "tvservice -o"; then
@@ -157,6 +170,12 @@ install -m 644 basestation.service /lib/systemd/system/basestation.service
 systemctl enable basestation
 systemctl start basestation
 
+# Advertise base station with mDNS
+echo "Configuring avahi daemon"
+install -D -m 644 iotheater.service /etc/avahi/services/iotheater.service
+systemctl enable avahi-daemon
+systemctl restart avahi-daemon
+
 # Change hostname
 if ! cat /etc/hosts | grep -q -w basestation; then
     echo "Setting hostname"
@@ -1,13 +1,12 @@
 #include "board.h"
 #include "commissioned.h"
 #include "heater.h"
+#include "heater_controller.h"
 #include "settings.h"
-#include "uptime_formatter.h"
 #include "version.h"
 #include "webpages.h"
 #include "Arduino.h"
 #include "Ticker.h"
-#include <cppQueue.h>
 #include <ESP8266WiFi.h>
 #include <ESP8266mDNS.h>
 #include <ESPAsyncTCP.h>
@@ -15,34 +14,51 @@
 #include <ESP8266TrueRandom.h>
 #include <NTPClient.h>
 #include <WiFiUdp.h>
+#include <coredecls.h>
 
-#define BUTTON_PRESS_TIMEOUT  (10000)    /* in milliseconds */
-#define WIFI_JOIN_TIMEOUT     (15000)    /* in milliseconds */
-#define HEATER_STATE_TIMEOUT  (1000)     /* in milliseconds */
+#define BUTTON_PRESS_TIMEOUT        (10000)    /* in milliseconds */
+#define WIFI_JOIN_TIMEOUT           (15000)    /* in milliseconds */
+#define DIRECTED_JOIN_TIMEOUT       (5000)     /* in milliseconds */
+#define DIRECTED_JOIN_REPLY_TIMEOUT (10000)    /* in milliseconds */
 
 static WiFiEventHandler wifi_connected_handler;
 static WiFiEventHandler wifi_disconnected_handler;
 static WiFiEventHandler wifi_got_ip_handler;
 
-#define CONNECTION_MAX_ATTEMPT    (3)
+/*
+ * A directed join reuses the access point, channel and IP configuration
+ * of the last connection, skipping the scan and DHCP.
+ */
+static bool directed_join;
+static bool dhcp_renewed;
+static unsigned long wifi_lost_time;        /* in milliseconds */
+static unsigned long wifi_connected_time;   /* in milliseconds */
+static Ticker directed_join_ticker;
+static unsigned long first_poll_time;       /* in milliseconds since boot, 0 until first reply */
+static bool first_poll_directed;
 
 #define WEB_SERVER_PORT       (80)
 static AsyncWebServer server(WEB_SERVER_PORT);
-static char webpage_buffer[2048];
-static bool button_pressed;
-static unsigned long button_pressed_start;
+static Ticker button_ticker;
 
 #define NTP_UPDATE_INTERVAL             (15 * 60 * 1000)  /* in milliseconds */
+#define NTP_RETRY_PERIOD                (10 * 1000)       /* in milliseconds */
 static WiFiUDP ntpUDP;
 static NTPClient ntpClient(ntpUDP);
-static unsigned long last_heater_state_timestamp;
-
-#define SEND_HEATER_STATE_REQ_PERIOD    (60 * 1000)     /* in milliseconds */
-
-#define SEND_HEATER_STATE_REQ_EV        (1U << 0)
-
-static Ticker send_heater_state_req_ticker;
-static uint32_t events;
+static Ticker ntp_ticker;
+
+/*
+ * The main loop sleeps until one of these events, or one of the heater
+ * controller, is raised by an interrupt, a Ticker or a WiFi/lwIP callback.
+ */
+#define SAVE_WIFI_CACHE_EV              (1U << 1)
+#define BUTTON_CHANGED_EV               (1U << 2)
+#define FACTORY_RESET_EV                (1U << 3)
+#define NTP_UPDATE_EV                   (1U << 4)
+#define MDNS_UPDATE_EV                  (1U << 5)
+#define SAMPLE_RSSI_EV                  (1U << 6)
+#define MDNS_ANSWER_EV                  (1U << 7)
+#define DIRECTED_JOIN_TIMEOUT_EV        (1U << 8)
 
 #define BLINK_PERIOD           (500)    /* in milliseconds */
 static Ticker leds_ticker;
@@ -54,48 +70,39 @@ enum led_state_t {
 };
 enum led_state_t led_state;
 
-static char basestation_addr[32];
-#define BASE_STATION_PORT           (32322)
-static unsigned int request_state_failure_count;
-#define REQUEST_STATE_FAILURE_THRESHOLD    (15)
-static unsigned int request_state_failure_since_boot_counter;
-
-static uint8_t heater_state;
-#define DEFAULT_HEATER_STATE        (HEATER_DEFROST)
-
-static uint64_t msg_counter;
-enum message_type_t {
-    REQ_HEATER_STATE    = 1,
-    HEATER_STATE_REPLY  = 2,
-};
-
-/* 64-byte message */
-struct __attribute__((packed)) message_t {
-    struct __attribute__((packed)) message_header_t {
-        uint8_t protocol_version;
-        uint8_t msg_type;
-        byte mac[6];
-        uint64_t counter;
-    } header;
-    uint8_t data[48];
-};
-
-#define MAX_ERROR_RECORDED      (5)
-enum error_code_t {
-    CANNOT_CONNECT_TO_BASE_STATION,
-    REPLY_TIMEOUT,
-    MESSAGE_PROTOCOL_NOT_SUPPORTED,
-    INVALID_MESSAGE_TYPE,
-    INVALID_HEATER_STATE,
-    MESSAGE_READ_FAILURE,
-    REQUEST_WRITE_FAILURE,
-};
-struct ErrorRecord {
-    enum error_code_t code;
-    unsigned long timestamp;
-};
-static cppQueue last_errors(sizeof(struct ErrorRecord), MAX_ERROR_RECORDED, FIFO);
-static char errors_str[512];
+static struct heater_controller_t controller;
+
+static unsigned long loop_time_avg;     /* in microseconds */
+static unsigned long loop_time_max;     /* in microseconds */
+
+/* RSSI sampled every minute while connected, for /metrics.json */
+#define RSSI_HISTORY_LENGTH             (30)
+#define RSSI_SAMPLE_PERIOD              (60 * 1000) /* in milliseconds */
+static Ticker rssi_ticker;
+static int8_t rssi_history[RSSI_HISTORY_LENGTH];
+static unsigned int rssi_history_head;
+static unsigned int rssi_history_count;
+
+/*
+ * LEAmDNS answers queries as they are received, MDNS.update() only
+ * drives probing, announcing and service queries. It is called every
+ * second for a while after they start, then every minute.
+ */
+#define MDNS_BUSY_UPDATE_PERIOD         (1000)      /* in milliseconds */
+#define MDNS_IDLE_UPDATE_PERIOD         (60 * 1000) /* in milliseconds */
+#define MDNS_BUSY_TIME                  (15 * 1000) /* in milliseconds */
+static Ticker mdns_ticker;
+static bool mdns_busy;
+static unsigned long mdns_busy_start;       /* in milliseconds */
+
+/*
+ * Base station advertises its device server with Avahi. It is looked for
+ * in the background: LEAmDNS sends the query, and calls back as answers
+ * are received, until the query is removed.
+ */
+#define MDNS_QUERY_TIMEOUT              (5 * 1000)  /* in milliseconds */
+static MDNSResponder::hMDNSServiceQuery mdns_query;
+static unsigned long mdns_query_start;      /* in milliseconds */
 
 static void update_leds()
 {
@@ -121,6 +128,30 @@ static void update_leds()
     ++counter;
 }
 
+/* Safe from interrupts, WiFi and lwIP callbacks */
+static void IRAM_ATTR raise_event(uint32_t ev)
+{
+    heater_controller_raise_event(&controller, ev);
+}
+
+static void mdns_update_callback(void)
+{
+    raise_event(MDNS_UPDATE_EV);
+}
+
+static void start_mdns_busy_period(void)
+{
+    mdns_busy = true;
+    mdns_busy_start = millis();
+    mdns_ticker.attach_ms(MDNS_BUSY_UPDATE_PERIOD, mdns_update_callback);
+}
+
+/* Only wakes up the main loop, which checks the directed join timeouts */
+static void directed_join_timeout_callback(void)
+{
+    raise_event(DIRECTED_JOIN_TIMEOUT_EV);
+}
+
 static void log_to_serial(char *str)
 {
     char buffer[256];
@@ -134,7 +165,10 @@ static void log_to_serial(char *str)
 static void wifi_connected(const WiFiEventStationModeConnected& event)
 {
     log_to_serial("Connected to WiFi");
-    events |= SEND_HEATER_STATE_REQ_EV;
+    wifi_connected_time = millis();
+    if (directed_join && !dhcp_renewed)
+        directed_join_ticker.once_ms(DIRECTED_JOIN_REPLY_TIMEOUT, directed_join_timeout_callback);
+    raise_event(SEND_HEATER_STATE_REQ_EV);
     led_state = DISCONNECTED_FROM_BASE_STATION;
 }
 
@@ -142,6 +176,8 @@ static void wifi_disconnected(const WiFiEventStationModeDisconnected& event)
 {
     log_to_serial("Disonnected from WiFi");
     led_state = DISCONNECTED_FROM_WIFI;
+    if (directed_join)
+        directed_join_ticker.once_ms(DIRECTED_JOIN_TIMEOUT, directed_join_timeout_callback);
 }
 
 static void wifi_got_ip(const WiFiEventStationModeGotIP& event)
@@ -157,95 +193,281 @@ static void wifi_got_ip(const WiFiEventStationModeGotIP& event)
 
     if (!MDNS.begin(name))
         log_to_serial("Cannot start MDNS server");
+    else
+        start_mdns_busy_period();
+
+    /* Flash is not written from WiFi event handlers */
+    raise_event(SEND_HEATER_STATE_REQ_EV | SAVE_WIFI_CACHE_EV | NTP_UPDATE_EV);
+}
+
+static void join_wifi(bool directed)
+{
+    char ssid[64];
+    char password[64];
+    struct wifi_cache_t cache;
+    settings_get_ssid(ssid);
+    settings_get_password(password);
+
+    directed_join = directed && settings_get_wifi_cache(&cache);
+    dhcp_renewed = false;
+    wifi_lost_time = millis();
+    if (directed_join) {
+        log_to_serial("Joining WiFi network using last connection");
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        WiFi.begin(ssid, password, cache.channel, cache.bssid);
+        directed_join_ticker.once_ms(DIRECTED_JOIN_TIMEOUT, directed_join_timeout_callback);
+    } else {
+        directed_join_ticker.detach();
+        WiFi.disconnect();
+        WiFi.config(0U, 0U, 0U);    /* Enable DHCP */
+        WiFi.begin(ssid, password);
+    }
 }
 
-static void send_heater_state_req_callback(void)
+static void save_wifi_cache(void)
 {
-    events |= SEND_HEATER_STATE_REQ_EV;
+    struct wifi_cache_t cache;
+    memset(&cache, 0, sizeof(cache));
+    memcpy(cache.bssid, WiFi.BSSID(), sizeof(cache.bssid));
+    cache.channel = WiFi.channel();
+    cache.ip = WiFi.localIP();
+    cache.gateway = WiFi.gatewayIP();
+    cache.subnet = WiFi.subnetMask();
+    cache.dns = WiFi.dnsIP();
+    settings_set_wifi_cache(&cache);
+}
+
+static void IRAM_ATTR button_changed(void)
+{
+    raise_event(BUTTON_CHANGED_EV);
+}
+
+static void button_pressed_callback(void)
+{
+    raise_event(FACTORY_RESET_EV);
+}
+
+static void ntp_update_callback(void)
+{
+    raise_event(NTP_UPDATE_EV);
+}
+
+static void sample_rssi_callback(void)
+{
+    raise_event(SAMPLE_RSSI_EV);
 }
 
 static void apply_heater_state(void)
 {
-    switch (heater_state) {
+    switch (controller.client.heater_state) {
     case HEATER_DEFROST:
         log_to_serial("Heater set in defrost mode");
-        digitalWrite(POSITIVE_OUTPUT_PIN, 0);
-        digitalWrite(NEGATIVE_OUTPUT_PIN, 1);
         break;
     case HEATER_ECO:
         log_to_serial("Heater set in eco mode");
-        digitalWrite(POSITIVE_OUTPUT_PIN, 1);
-        digitalWrite(NEGATIVE_OUTPUT_PIN, 1);
         break;
     case HEATER_COMFORT:
         log_to_serial("Heater set in comfort/on mode");
-        digitalWrite(POSITIVE_OUTPUT_PIN, 0);
-        digitalWrite(NEGATIVE_OUTPUT_PIN, 0);
         break;
     default:
         log_to_serial("Turning heater off");
-        digitalWrite(POSITIVE_OUTPUT_PIN, 1);
-        digitalWrite(NEGATIVE_OUTPUT_PIN, 0);
         break;
     }
+
+    heater_set_outputs(controller.client.heater_state);
+}
+
+static void heater_client_log(struct heater_client_t *c, const char *str)
+{
+    log_to_serial((char *)str);
 }
 
-static void record_error(enum error_code_t code)
+static unsigned long heater_client_get_time(struct heater_client_t *c)
 {
-    ErrorRecord rec;
-    rec.code = code;
-    rec.timestamp = ntpClient.getEpochTime();
+    return ntpClient.getEpochTime();
+}
+
+static void heater_client_state_changed(struct heater_client_t *c)
+{
+    apply_heater_state();
+}
 
-    if (last_errors.isFull())
-        last_errors.drop();
-    last_errors.push(&rec);
+/* Port and address come in separate answers, they are checked from the main loop */
+static void mdns_query_callback(MDNSResponder::MDNSServiceInfo info, MDNSResponder::AnswerType answer_type, bool set_content)
+{
+    if (set_content)
+        raise_event(MDNS_ANSWER_EV);
+}
+
+static void stop_mdns_query(void)
+{
+    MDNS.removeServiceQuery(mdns_query);
+    mdns_query = 0;
 }
 
-static void build_errors_webpage(char *buf)
+static void check_mdns_answers(void)
 {
-    if (last_errors.isEmpty()) {
-        strcpy(buf, "No errors");
+    for (uint32_t i = 0; i < MDNS.answerCount(mdns_query); ++i) {
+        if (!MDNS.hasAnswerIP4Address(mdns_query, i) || !MDNS.hasAnswerPort(mdns_query, i))
+            continue;
+
+        heater_client_base_station_found(&controller.client, MDNS.answerIP4Address(mdns_query, i, 0),
+                                         MDNS.answerPort(mdns_query, i));
+        stop_mdns_query();
         return;
     }
+}
 
-    buf[0] = '\0';
-    int i = 0;
-    while (i < last_errors.getCount()) {
-        ErrorRecord rec;
-        last_errors.peekIdx(&rec, i);
-
-        switch (rec.code) {
-        case CANNOT_CONNECT_TO_BASE_STATION:
-            strcat(buf, "Cannot connect to base station");
-            break;
-        case REPLY_TIMEOUT:
-            strcat(buf, "Timeout waiting for reply from base station");
-            break;
-        case MESSAGE_PROTOCOL_NOT_SUPPORTED:
-            strcat(buf, "Message protocol not supported");
-            break;
-        case INVALID_MESSAGE_TYPE:
-            strcat(buf, "Received invalid message type");
-            break;
-        case INVALID_HEATER_STATE:
-            strcat(buf, "Received invalid heater state");
-            break;
-        case MESSAGE_READ_FAILURE:
-            strcat(buf, "Failed to read message from client");
-            break;
-        case REQUEST_WRITE_FAILURE:
-            strcat(buf, "Failed to send message to base station");
-            break;
-        }
+static void heater_client_discover_base_station(struct heater_client_t *c)
+{
+    if (mdns_query)
+        return;
 
-        char tmp[32];
-        sprintf(tmp, ", timestamp=%lu", rec.timestamp);
-        strcat(buf, tmp);
+    log_to_serial("Looking for base station with mDNS");
+    mdns_query = MDNS.installServiceQuery(BASE_STATION_MDNS_SERVICE, "tcp", mdns_query_callback);
+    if (!mdns_query) {
+        log_to_serial("Cannot start mDNS query");
+        return;
+    }
+    mdns_query_start = millis();
+    start_mdns_busy_period();
+}
 
-        ++i;
-        if (i < last_errors.getCount())
-            strcat(buf, "<br>");
+static int heater_client_get_rssi(struct heater_client_t *c)
+{
+    return WiFi.RSSI();
+}
+
+static void heater_client_status_changed(struct heater_client_t *c)
+{
+    if (c->connected_to_base_station && first_poll_time == 0) {
+        first_poll_time = millis();
+        first_poll_directed = directed_join;
+    }
+
+    if (c->connected_to_base_station)
+        led_state = CONNECTED_TO_BASE_STATION;
+    else if (led_state == CONNECTED_TO_BASE_STATION)
+        led_state = DISCONNECTED_FROM_BASE_STATION;
+}
+
+static void sample_rssi(void)
+{
+    if (WiFi.status() != WL_CONNECTED)
+        return;
+
+    rssi_history[(rssi_history_head + rssi_history_count) % RSSI_HISTORY_LENGTH] = WiFi.RSSI();
+    if (rssi_history_count < RSSI_HISTORY_LENGTH)
+        rssi_history_count++;
+    else
+        rssi_history_head = (rssi_history_head + 1) % RSSI_HISTORY_LENGTH;
+}
+
+static const char *heater_state_str(uint8_t state)
+{
+    switch (state) {
+    case HEATER_DEFROST: return "DEFROST";
+    case HEATER_ECO: return "ECO";
+    case HEATER_COMFORT: return "COMFORT/ON";
+    case HEATER_OFF: return "OFF";
+    default: return "UNKNOWN";
+    }
+}
+
+static const char *wifi_level_str(long rssi)
+{
+    if (rssi > -67)
+        return "excellent";
+    else if (rssi > -70)
+        return "very good";
+    else if (rssi > -80)
+        return "okay";
+    else if (rssi > -90)
+        return "not good";
+    else
+        return "unusable";
+}
+
+static void send_status_json(AsyncWebServerRequest *request)
+{
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    char buf[48];
+
+    response->printf("{\"name\":\"%s\",\"chip_id\":\"%08X\",\"firmware\":", controller.client.name, ESP.getChipId());
+    print_json_string(response, FW_VERSION);
+    response->printf(",\"mac\":\"%s\",\"uptime\":%lu,\"reset_reason\":", WiFi.macAddress().c_str(), millis() / 1000);
+    print_json_string(response, ESP.getResetReason().c_str());
+    response->printf(",\"warm_resets\":%u,\"first_poll_time\":%lu,\"first_poll_join\":\"%s\",",
+                     controller.rtc_state.warm_reset_count, first_poll_time,
+                     first_poll_time == 0 ? "no reply yet" : first_poll_directed ? "directed join" : "full scan");
+
+    long rssi = WiFi.RSSI();
+    if (controller.client.basestation_ip == 0)
+        strcpy(buf, "not resolved");
+    else
+        sprintf(buf, "%s:%u%s", IPAddress(controller.client.basestation_ip).toString().c_str(),
+                controller.client.basestation_ip_port, controller.client.basestation_discovered ? ", found with mDNS" : "");
+    response->printf("\"rssi\":%ld,\"wifi_level\":\"%s\",\"basestation_addr\":", rssi, wifi_level_str(rssi));
+    print_json_string(response, controller.client.basestation_addr);
+    response->printf(",\"basestation_ip\":\"%s\",\"heater_state\":\"%s\",\"last_reply\":%lu,",
+                     buf, heater_state_str(controller.client.heater_state), controller.client.last_heater_state_timestamp);
+    response->printf("\"poll_period\":%lu,\"poll_period_source\":\"%s\",",
+                     controller.client.poll_period / 1000,
+                     controller.client.poll_period_from_base_station ? "set by base station" : "default");
+    response->printf("\"failures\":%u,\"radio_on_time\":%lu,\"last_exchange\":%lu,\"connections\":%u,",
+                     controller.client.request_state_failure_since_boot_counter,
+                     controller.client.radio_on_time, controller.client.last_exchange_duration, controller.client.connection_count);
+    response->printf("\"loop_time_avg\":%lu,\"loop_time_max\":%lu,\"loop_rate\":%lu,\"free_heap\":%u,\"max_free_block\":%u,\"errors\":[",
+                     loop_time_avg, loop_time_max, (unsigned long)(controller.loop_iterations * 60000ULL / (millis() + 1)),
+                     ESP.getFreeHeap(), ESP.getMaxFreeBlockSize());
+    for (unsigned int i = 0; i < controller.client.error_count; ++i) {
+        const struct ErrorRecord *rec = &controller.client.errors[(controller.client.error_head + i) % MAX_ERROR_RECORDED];
+        response->printf("%s{\"code\":%d,\"description\":\"%s\",\"timestamp\":%lu}",
+                         i > 0 ? "," : "", rec->code, heater_client_error_str(rec->code), rec->timestamp);
     }
+    response->print("]}");
+
+    request->send(response);
+}
+
+/* Counters and timings, meant to be scraped to spot sick devices */
+static void send_metrics_json(AsyncWebServerRequest *request)
+{
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+
+    response->printf("{\"uptime\":%lu,\"free_heap\":%u,\"max_free_block\":%u,\"heap_fragmentation\":%u,",
+                     millis() / 1000, ESP.getFreeHeap(), ESP.getMaxFreeBlockSize(), ESP.getHeapFragmentation());
+    response->printf("\"loop_time_avg\":%lu,\"loop_time_max\":%lu,\"requests\":%u,\"replies\":%u,\"failures\":%u,",
+                     loop_time_avg, loop_time_max, controller.client.request_count, controller.client.reply_count,
+                     controller.client.request_state_failure_since_boot_counter);
+    response->printf("\"connections\":%u,\"reconnects\":%u,\"phases\":{",
+                     controller.client.connection_count, controller.client.reconnect_count);
+    for (int i = 0; i < PHASE_COUNT; ++i) {
+        const struct PhaseStats *stats = &controller.client.phases[i];
+        response->printf("%s\"%s\":{\"count\":%u,\"last\":%lu,\"avg\":%lu,\"max\":%lu}",
+                         i > 0 ? "," : "", heater_client_phase_str((enum exchange_phase_t)i), stats->count,
+                         stats->last, stats->count ? (unsigned long)(stats->total / stats->count) : 0, stats->max);
+    }
+
+    response->printf("},\"last_reply_latency\":%lu,\"reply_latency\":[", controller.client.last_reply_latency);
+    for (unsigned int i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+        unsigned long limit = heater_client_latency_bucket_limit(i);
+        if (limit)
+            response->printf("%s{\"lt\":%lu,\"count\":%u}", i > 0 ? "," : "", limit, controller.client.latency_histogram[i]);
+        else
+            response->printf("%s{\"lt\":null,\"count\":%u}", i > 0 ? "," : "", controller.client.latency_histogram[i]);
+    }
+
+    response->print("],\"rssi\":[");
+    for (unsigned int i = 0; i < rssi_history_count; ++i)
+        response->printf("%s%d", i > 0 ? "," : "", rssi_history[(rssi_history_head + i) % RSSI_HISTORY_LENGTH]);
+
+    response->print("],\"error_counts\":{");
+    for (int i = 0; i < ERROR_CODE_COUNT; ++i)
+        response->printf("%s\"%d\":%u", i > 0 ? "," : "", i, controller.client.error_code_count[i]);
+    response->print("}}");
+
+    request->send(response);
 }
 
 void setup_commissioned()
@@ -259,12 +481,16 @@ void setup_commissioned()
     pinMode(POSITIVE_OUTPUT_PIN, OUTPUT);
     pinMode(NEGATIVE_OUTPUT_PIN, OUTPUT);
     /*
-     * Put heater in defrost mode. This is the safest option as
+     * After a warm reset, restore the last heater state right away.
+     *
+     * Otherwise, put heater in defrost mode. This is the safest option as
      * we do not know how long we stayed off
      * and whether the base station is up and running. If it is,
      * we will soon get the heater state.
      */
-    heater_state = DEFAULT_HEATER_STATE;
+    controller.keep_rtc_state = true;
+    if (heater_controller_restore(&controller))
+        log_to_serial("Warm reset, restoring heater state");
     apply_heater_state();
 
     /* Load settings */
@@ -278,30 +504,35 @@ void setup_commissioned()
 
     char name[32];
     char ssid[64];
-    char password[64];
     settings_get_name(name);
     settings_get_ssid(ssid);
-    settings_get_password(password);
-    settings_get_basestation(basestation_addr);
+    settings_get_basestation(controller.client.basestation_addr);
 
     {
       char buffer[64];
       sprintf(buffer, "Heater controller name: \"%s\"", name);
       log_to_serial(buffer);
-      sprintf(buffer, "Base station addr: \"%s\"", basestation_addr);
+      sprintf(buffer, "Base station addr: \"%s\"", controller.client.basestation_addr);
       log_to_serial(buffer);
     }
 
-    /* Init message counter */
+    controller.client.basestation_port = BASE_STATION_PORT;
+    WiFi.macAddress(controller.client.mac);
+    memcpy(controller.client.name, name, sizeof(controller.client.name));
+    controller.client.log = heater_client_log;
+    controller.client.get_time = heater_client_get_time;
+    controller.client.heater_state_changed = heater_client_state_changed;
+    controller.client.base_station_status_changed = heater_client_status_changed;
+    controller.client.discover_base_station = heater_client_discover_base_station;
+    controller.client.get_rssi = heater_client_get_rssi;
+    controller.client.fell_back = NULL;
+    controller.client.firmware_version = FW_SHORT_VERSION;
+    heater_controller_init(&controller, ESP8266TrueRandom.random());
     {
-      msg_counter = ESP8266TrueRandom.random();
-      msg_counter &= 0x0FFFFFFF;  /* Clear highest 4 bits, to ensure that msg_counter will not overflow */
-      msg_counter <<= 32;
       char buffer[64];
-      sprintf(buffer, "Message counter set to %llu", msg_counter);
+      sprintf(buffer, "Message counter set to %llu", controller.client.msg_counter);
       log_to_serial(buffer);
     }
-    request_state_failure_since_boot_counter = 0;
 
     led_state = DISCONNECTED_FROM_WIFI;
     leds_ticker.attach_ms(BLINK_PERIOD, update_leds);
@@ -313,7 +544,7 @@ void setup_commissioned()
     wifi_got_ip_handler = WiFi.onStationModeGotIP(wifi_got_ip);
     WiFi.mode(WIFI_STA);
     WiFi.hostname(String("heater-") + name);
-    WiFi.begin(ssid, password);
+    join_wifi(true);
     {
       char buffer[64];
       sprintf(buffer, "Connecting to Wifi network: \"%s\"", ssid);
@@ -326,50 +557,17 @@ void setup_commissioned()
         Serial.println(WiFi.localIP());
     }
 
-    ntpClient.setUpdateInterval(NTP_UPDATE_INTERVAL);
     ntpClient.begin();
 
     /* Spawn web server */
-    server.on("/", HTTP_GET, [name](AsyncWebServerRequest *request){
-        char heater_state_str[16];
-        switch (heater_state) {
-        case HEATER_DEFROST: strcpy(heater_state_str, "DEFROST"); break;
-        case HEATER_ECO: strcpy(heater_state_str, "ECO"); break;
-        case HEATER_COMFORT: strcpy(heater_state_str, "COMFORT/ON"); break;
-        case HEATER_OFF: strcpy(heater_state_str, "OFF"); break;
-        default: strcpy(heater_state_str, "UNKNOWN"); break;
-        }
-        byte mac[6];
-        WiFi.macAddress(mac);
-        build_errors_webpage(errors_str);
-        long rssi = WiFi.RSSI();
-        char wifi_level[32];
-        if (rssi > -67)
-            strcpy(wifi_level, "excellent");
-        else if (rssi > -70)
-            strcpy(wifi_level, "very good");
-        else if (rssi > -80)
-            strcpy(wifi_level, "okay");
-        else if (rssi > -90)
-            strcpy(wifi_level, "not good");
-        else
-            strcpy(wifi_level, "unusable");
-        sprintf(webpage_buffer, commissioned_index_html,
-                    name,
-                    name,
-                    ESP.getChipId(),
-                    FW_VERSION,
-                    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
-                    uptime_formatter::getUptime().c_str(),
-                    rssi, wifi_level,
-                    basestation_addr,
-                    heater_state_str,
-                    last_heater_state_timestamp,
-                    request_state_failure_since_boot_counter,
-                    errors_str);
-        request->send_P(200, "text/html", webpage_buffer);
-        }
-    );
+    server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
+        send_gzipped_webpage(request, "text/html", commissioned_index_html_gz, commissioned_index_html_gz_len);
+    });
+    server.on("/common.js", HTTP_GET, [](AsyncWebServerRequest *request){
+        send_gzipped_webpage(request, "application/javascript", common_js_gz, common_js_gz_len);
+    });
+    server.on("/status.json", HTTP_GET, send_status_json);
+    server.on("/metrics.json", HTTP_GET, send_metrics_json);
     server.on("/unregister", HTTP_POST, [] (AsyncWebServerRequest *request) {
         log_to_serial("Factory reset (from website)");
         settings_erase();
@@ -377,27 +575,51 @@ void setup_commissioned()
     });
     server.begin();
 
-    /* Add a little bit of jitter so that not all heater controllers
-     *  are contacting the base station at the same time. This scenario
-     *  is likely to happen when you get a power cut and it comes back
-     *  on.
-     */
-    send_heater_state_req_ticker.attach_ms(
-      SEND_HEATER_STATE_REQ_PERIOD + 50 * ((msg_counter >> 32) & 0xF),
-      send_heater_state_req_callback);
+    rssi_ticker.attach_ms(RSSI_SAMPLE_PERIOD, sample_rssi_callback);
+    attachInterrupt(digitalPinToInterrupt(BUTTON_PIN), button_changed, CHANGE);
 }
 
 void loop_commissioned()
 {
-    ntpClient.update();
-    MDNS.update();
+    unsigned long loop_start = micros();
+
+    uint32_t ev = heater_controller_take_events(&controller);
+
+    if (ev & NTP_UPDATE_EV) {
+        bool updated = WiFi.status() == WL_CONNECTED && ntpClient.forceUpdate();
+        ntp_ticker.once_ms(updated ? NTP_UPDATE_INTERVAL : NTP_RETRY_PERIOD, ntp_update_callback);
+    }
+
+    if ((ev & MDNS_ANSWER_EV) && mdns_query)
+        check_mdns_answers();
+
+    if (ev & MDNS_UPDATE_EV) {
+        MDNS.update();
+        if (mdns_query && millis() - mdns_query_start >= MDNS_QUERY_TIMEOUT) {
+            log_to_serial("No base station found with mDNS");
+            stop_mdns_query();
+        }
+        if (mdns_busy && millis() - mdns_busy_start >= MDNS_BUSY_TIME) {
+            mdns_busy = false;
+            mdns_ticker.attach_ms(MDNS_IDLE_UPDATE_PERIOD, mdns_update_callback);
+        }
+    }
+
+    if (ev & SAMPLE_RSSI_EV)
+        sample_rssi();
 
     /* Clear configuration if button is pressed for a while */
-    if (digitalRead(BUTTON_PIN) == 0) {
-        if (!button_pressed) {
-            button_pressed = true;
-            button_pressed_start = millis();
-        } else if (millis() - button_pressed_start >= BUTTON_PRESS_TIMEOUT) {
+    if (ev & BUTTON_CHANGED_EV) {
+        if (digitalRead(BUTTON_PIN) == 0) {
+            if (!button_ticker.active())
+                button_ticker.once_ms(BUTTON_PRESS_TIMEOUT, button_pressed_callback);
+        } else {
+            button_ticker.detach();
+        }
+    }
+
+    if (ev & FACTORY_RESET_EV) {
+        if (digitalRead(BUTTON_PIN) == 0) {
             int i;
 
             log_to_serial("Factory reset");
@@ -415,160 +637,49 @@ void loop_commissioned()
 
             ESP.restart();
         }
-    } else {
-        button_pressed = false;
     }
 
-    if (WiFi.status() == WL_CONNECTED && (events & SEND_HEATER_STATE_REQ_EV)) {
-        events &= ~SEND_HEATER_STATE_REQ_EV;
-
-        WiFiClient client;
-        bool connection_established = false;
-
-        int attempts = CONNECTION_MAX_ATTEMPT;
-        do {
-            connection_established = client.connect(basestation_addr, BASE_STATION_PORT);
-            if (!connection_established)
-                delay(50);
-            attempts--;
-        } while (!connection_established && attempts > 0);
-
-        if (!connection_established) {
-            char buf[128];
-            sprintf("Failed to connect to base station (hostname/ip=%s)", basestation_addr);
-            log_to_serial(buf);
-            request_state_failure_count++;
-            request_state_failure_since_boot_counter++;
-            record_error(CANNOT_CONNECT_TO_BASE_STATION);
-        } else {
-            log_to_serial("Sending heater state request to base station");
-
-            struct message_t heater_state_req_msg;
-            memset(&heater_state_req_msg, 0xFF, sizeof(heater_state_req_msg));
-            heater_state_req_msg.header.protocol_version = 1;
-            heater_state_req_msg.header.msg_type = REQ_HEATER_STATE;
-            WiFi.macAddress(heater_state_req_msg.header.mac);
-            heater_state_req_msg.header.counter = msg_counter++;
-            settings_get_name((char *)heater_state_req_msg.data);
-
-            {
-                size_t bytes_to_send_count = sizeof(heater_state_req_msg);
-                uint8_t *dst = (uint8_t *)&heater_state_req_msg;
-                while (bytes_to_send_count > 0) {
-                    size_t ret = client.write(dst, bytes_to_send_count);
-                    if (ret <= 0) {
-                        log_to_serial("Failed to write message to base station");
-                        request_state_failure_count++;
-                        request_state_failure_since_boot_counter++;
-                        record_error(REQUEST_WRITE_FAILURE);
-                        goto client_cleanup;
-                    }
-
-                    dst += ret;
-                    bytes_to_send_count -= ret;
-                }
-            }
+    /*
+     * Access point or IP configuration may have changed since last
+     * connection, fall back to a scan and DHCP.
+     */
+    if (WiFi.status() == WL_CONNECTED)
+        wifi_lost_time = millis();
+    else if (directed_join && millis() - wifi_lost_time >= DIRECTED_JOIN_TIMEOUT) {
+        log_to_serial("Directed WiFi join failed, scanning");
+        join_wifi(false);
+    }
 
-            unsigned long start = millis();
-            while (millis() - start < HEATER_STATE_TIMEOUT) {
-                if (client.available() >= sizeof(struct message_t))
-                    break;
-            }
-            if (millis() - start >= HEATER_STATE_TIMEOUT) {
-                log_to_serial("Timeout while waiting for heater state reply from base station");
-                request_state_failure_count++;
-                request_state_failure_since_boot_counter++;
-                record_error(REPLY_TIMEOUT);
-            } else {
-                struct message_t heater_state_reply_msg;
-                unsigned int bytes_read;
-                uint8_t *dst;
-
-                /* Read and check that we read an entire message */
-                dst = (uint8_t *)&heater_state_reply_msg;
-                bytes_read = 0;
-                while (bytes_read < sizeof(heater_state_reply_msg)) {
-                    int ret = client.read(dst, sizeof(heater_state_reply_msg) - bytes_read);
-                    if (ret <= 0)
-                        break;
-                    dst += ret;
-                    bytes_read += ret;
-                }
-                if (bytes_read < sizeof(heater_state_reply_msg)) {
-                    log_to_serial("Failed to read message from base station");
-                    request_state_failure_count++;
-                    request_state_failure_since_boot_counter++;
-                    record_error(MESSAGE_READ_FAILURE);
-                    goto client_cleanup;
-                }
-
-                if (heater_state_reply_msg.header.protocol_version != 1) {
-                    char buffer[128];
-                    sprintf(buffer, "Discarding message: protocol version %u not supported", heater_state_reply_msg.header.protocol_version);
-                    log_to_serial(buffer);
-                    request_state_failure_count++;
-                    request_state_failure_since_boot_counter++;
-                    record_error(MESSAGE_PROTOCOL_NOT_SUPPORTED);
-                } else if (heater_state_reply_msg.header.msg_type == REQ_HEATER_STATE) {
-                    log_to_serial("Discarding message: not expecting REQ_HEATER_STATE from base station");
-                    request_state_failure_count++;
-                    request_state_failure_since_boot_counter++;
-                    record_error(INVALID_MESSAGE_TYPE);
-                } else if (heater_state_reply_msg.header.msg_type != HEATER_STATE_REPLY) {
-                    char buffer[128];
-                    sprintf(buffer, "Invalid message type %u", heater_state_reply_msg.header.msg_type);
-                    log_to_serial(buffer);
-                    request_state_failure_count++;
-                    request_state_failure_since_boot_counter++;
-                    record_error(INVALID_MESSAGE_TYPE);
-                } else {
-                    uint8_t new_heater_state = heater_state_reply_msg.data[0];
-                    switch (new_heater_state) {
-                    case HEATER_OFF:
-                    case HEATER_DEFROST:
-                    case HEATER_ECO:
-                    case HEATER_COMFORT:
-                        led_state = CONNECTED_TO_BASE_STATION;
-                        last_heater_state_timestamp = ntpClient.getEpochTime();
-                        request_state_failure_count = 0;
-                        if (heater_state != new_heater_state) {
-                            heater_state = new_heater_state;
-                            apply_heater_state();
-                        }
-                        break;
-                    default:
-                        {
-                            char buffer[64];
-                            sprintf(buffer, "Received invalid heater state %d from base station", new_heater_state);
-                            log_to_serial(buffer);
-                            request_state_failure_count++;
-                            request_state_failure_since_boot_counter++;
-                            record_error(INVALID_HEATER_STATE);
-                        }
-                        break;
-                    }
-                }
-            }
+    /*
+     * Once the base station replied, start DHCP to renew the lease of
+     * the address reused by the directed join. The access point may
+     * accept the association while the address is stale: without a
+     * reply after a failed request or a timeout, start DHCP as well.
+     */
+    if (directed_join && !dhcp_renewed && WiFi.status() == WL_CONNECTED) {
+        bool no_reply = controller.client.request_state_failure_count > 0
+                     || millis() - wifi_connected_time >= DIRECTED_JOIN_REPLY_TIMEOUT;
+        if (controller.client.connected_to_base_station || no_reply) {
+            if (!controller.client.connected_to_base_station)
+                log_to_serial("No reply from base station with last IP configuration, starting DHCP");
+            WiFi.config(0U, 0U, 0U);
+            dhcp_renewed = true;
         }
-client_cleanup:
-        client.stop();
     }
 
-    if (request_state_failure_count == REQUEST_STATE_FAILURE_THRESHOLD) {
-        char buffer[128];
-        sprintf(buffer, "Too many failures (count: %d) while requesting heater state from base station", request_state_failure_count);
-        log_to_serial(buffer);
+    if (ev & SAVE_WIFI_CACHE_EV) {
+        save_wifi_cache();
+    }
 
-        /*
-         * It seems that the base station is down or not running properly.
-         * Let's put the heater in defrost mode.
-         */
-        heater_state = DEFAULT_HEATER_STATE;
-        apply_heater_state();
+    heater_controller_process(&controller, ev, WiFi.status() == WL_CONNECTED);
 
-        led_state = DISCONNECTED_FROM_BASE_STATION;
+    {
+        unsigned long loop_time = micros() - loop_start;
+        if (loop_time > loop_time_max)
+            loop_time_max = loop_time;
+        loop_time_avg = (loop_time_avg * 7 + loop_time) / 8;
     }
 
     wifi_set_sleep_type(LIGHT_SLEEP_T);
-    delay(100);
+    heater_controller_sleep(&controller);
 }
@@ -0,0 +1,15 @@
+#include "crc.h"
+
+uint32_t crc32(const void *data, size_t len)
+{
+    const uint8_t *buf = (const uint8_t *)data;
+    uint32_t crc = 0xFFFFFFFF;
+
+    while (len--) {
+        crc ^= *buf++;
+        for (int i = 0; i < 8; ++i)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return ~crc;
+}
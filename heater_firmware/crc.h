@@ -0,0 +1,16 @@
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Compute CRC-32 (IEEE 802.3)
+ *
+ * @param[in] data
+ * @param[in] len
+ * @return CRC of data
+ */
+uint32_t crc32(const void *data, size_t len);
+
+#endif
@@ -0,0 +1,29 @@
+#!/bin/sh -e
+
+# Generate webpages_data.cpp from the files of html/. Files are gzipped, so
+# that they take less flash and less time to send over WiFi, and are
+# served with "Content-Encoding: gzip".
+#
+# Run it, or make, after changing a file of html/ and commit the
+# generated file: the Arduino IDE does not run it.
+
+cd "$(dirname "$0")"
+
+OUTPUT=webpages_data.cpp
+
+{
+    echo "/* Generated by gen_webpages.sh from html/, do not edit */"
+    echo ""
+    echo "#include \"webpages.h\""
+    for file in html/*; do
+        name=$(basename "$file" | tr '.-' '__')
+        echo ""
+        echo "/* $file: $(wc -c < "$file") bytes, $(gzip -9 -n -c "$file" | wc -c) bytes gzipped */"
+        echo "const uint8_t ${name}_gz[] PROGMEM = {"
+        gzip -9 -n -c "$file" | od -A n -v -t x1 | sed -e 's/ \([0-9a-f][0-9a-f]\)/0x\1, /g' -e 's/^/   /' -e 's/, $/,/'
+        echo "};"
+        echo "const size_t ${name}_gz_len = sizeof(${name}_gz);"
+    done
+} > "${OUTPUT}.tmp"
+
+mv "${OUTPUT}.tmp" "${OUTPUT}"
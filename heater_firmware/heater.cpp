@@ -0,0 +1,25 @@
+#include "board.h"
+#include "heater.h"
+#include "Arduino.h"
+
+void heater_set_outputs(uint8_t state)
+{
+    switch (state) {
+    case HEATER_DEFROST:
+        digitalWrite(POSITIVE_OUTPUT_PIN, 0);
+        digitalWrite(NEGATIVE_OUTPUT_PIN, 1);
+        break;
+    case HEATER_ECO:
+        digitalWrite(POSITIVE_OUTPUT_PIN, 1);
+        digitalWrite(NEGATIVE_OUTPUT_PIN, 1);
+        break;
+    case HEATER_COMFORT:
+        digitalWrite(POSITIVE_OUTPUT_PIN, 0);
+        digitalWrite(NEGATIVE_OUTPUT_PIN, 0);
+        break;
+    default:
+        digitalWrite(POSITIVE_OUTPUT_PIN, 1);
+        digitalWrite(NEGATIVE_OUTPUT_PIN, 0);
+        break;
+    }
+}
@@ -1,6 +1,8 @@
 #ifndef HEATER_H
 #define HEATER_H
 
+#include <stdint.h>
+
 enum heater_state_t {
     HEATER_OFF,
     HEATER_DEFROST,
@@ -8,4 +10,13 @@ enum heater_state_t {
     HEATER_COMFORT,
 };
 
+#define DEFAULT_HEATER_STATE        (HEATER_DEFROST)
+
+/**
+ * @brief Drive pilot wire outputs according to heater state
+ *
+ * @param[in] state
+ */
+void heater_set_outputs(uint8_t state);
+
 #endif
@@ -0,0 +1,631 @@
+#include "heater.h"
+#include "heater_client.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BASE_STATION_CONNECTED_EV       (1U << 0)
+#define BASE_STATION_DISCONNECTED_EV    (1U << 1)
+#define HEATER_STATE_REPLY_EV           (1U << 2)
+
+static const unsigned long latency_bucket_limits[LATENCY_BUCKET_COUNT - 1] = {
+    5, 10, 20, 50, 100, 200, 500,       /* in milliseconds */
+};
+
+static void log_msg(struct heater_client_t *c, const char *str)
+{
+    if (c->log)
+        c->log(c, str);
+}
+
+static void wake(struct heater_client_t *c)
+{
+    if (c->wake)
+        c->wake(c);
+}
+
+static void base_station_connected(void *arg, AsyncClient *client)
+{
+    struct heater_client_t *c = (struct heater_client_t *)arg;
+    c->connected_timestamp = micros();
+    c->events |= BASE_STATION_CONNECTED_EV;
+    wake(c);
+}
+
+static void base_station_disconnected(void *arg, AsyncClient *client)
+{
+    struct heater_client_t *c = (struct heater_client_t *)arg;
+    c->events |= BASE_STATION_DISCONNECTED_EV;
+    wake(c);
+}
+
+static void base_station_error(void *arg, AsyncClient *client, int8_t error)
+{
+    struct heater_client_t *c = (struct heater_client_t *)arg;
+    c->events |= BASE_STATION_DISCONNECTED_EV;
+    wake(c);
+}
+
+static void base_station_data(void *arg, AsyncClient *client, void *data, size_t len)
+{
+    struct heater_client_t *c = (struct heater_client_t *)arg;
+    size_t count = sizeof(c->reply_buffer) - c->reply_length;
+    if (len < count)
+        count = len;
+    if (c->reply_length == 0 && count > 0)
+        c->reply_first_byte = micros();
+
+    memcpy(&c->reply_buffer[c->reply_length], data, count);
+    c->reply_length += count;
+    if (c->reply_length == sizeof(c->reply_buffer)) {
+        c->reply_complete = micros();
+        c->events |= HEATER_STATE_REPLY_EV;
+        wake(c);
+    }
+}
+
+static void record_phase(struct heater_client_t *c, enum exchange_phase_t phase, unsigned long duration)
+{
+    struct PhaseStats *stats = &c->phases[phase];
+    stats->last = duration;
+    if (duration > stats->max)
+        stats->max = duration;
+    stats->total += duration;
+    stats->count++;
+}
+
+static void record_latency(struct heater_client_t *c, unsigned long latency)
+{
+    unsigned int bucket = 0;
+    while (bucket < LATENCY_BUCKET_COUNT - 1 && latency >= latency_bucket_limits[bucket])
+        ++bucket;
+
+    c->latency_histogram[bucket]++;
+    c->last_reply_latency = latency;
+}
+
+static void record_error(struct heater_client_t *c, enum error_code_t code)
+{
+    if (code < ERROR_CODE_COUNT)
+        c->error_code_count[code]++;
+
+    struct ErrorRecord *rec = &c->errors[(c->error_head + c->error_count) % MAX_ERROR_RECORDED];
+    rec->code = code;
+    rec->timestamp = c->get_time ? c->get_time(c) : 0;
+
+    if (c->error_count < MAX_ERROR_RECORDED)
+        c->error_count++;
+    else
+        c->error_head = (c->error_head + 1) % MAX_ERROR_RECORDED;
+}
+
+static void set_heater_state(struct heater_client_t *c, uint8_t state)
+{
+    if (c->heater_state == state)
+        return;
+
+    c->heater_state = state;
+    if (c->heater_state_changed)
+        c->heater_state_changed(c);
+}
+
+static void set_connected(struct heater_client_t *c, bool connected)
+{
+    if (c->connected_to_base_station == connected)
+        return;
+
+    c->connected_to_base_station = connected;
+    if (c->base_station_status_changed)
+        c->base_station_status_changed(c);
+}
+
+/*
+ * Add a little bit of jitter so that not all heater controllers
+ * are contacting the base station at the same time. This scenario
+ * is likely to happen when you get a power cut and it comes back
+ * on.
+ */
+static unsigned long default_poll_period(const struct heater_client_t *c)
+{
+    return SEND_HEATER_STATE_REQ_PERIOD + 50 * ((c->msg_counter >> 32) & 0xF);
+}
+
+static void set_poll_period(struct heater_client_t *c, unsigned long period, bool from_base_station)
+{
+    /* Base station may set the same period again to move the next request */
+    if (!from_base_station && !c->poll_period_from_base_station)
+        return;
+
+    c->poll_period = period;
+    c->poll_period_from_base_station = from_base_station;
+    if (c->poll_period_changed)
+        c->poll_period_changed(c);
+}
+
+static void count_failure(struct heater_client_t *c, enum error_code_t code)
+{
+    c->request_state_failure_count++;
+    c->request_state_failure_since_boot_counter++;
+    record_error(c, code);
+    set_poll_period(c, default_poll_period(c), false);
+
+    if (c->request_state_failure_count == REQUEST_STATE_FAILURE_THRESHOLD) {
+        char buffer[128];
+        sprintf(buffer, "Too many failures (count: %u) while requesting heater state from base station", c->request_state_failure_count);
+        log_msg(c, buffer);
+
+        /*
+         * It seems that the base station is down or not running properly.
+         * Let's put the heater in defrost mode.
+         */
+        set_heater_state(c, DEFAULT_HEATER_STATE);
+        set_connected(c, false);
+        if (c->fell_back)
+            c->fell_back(c);
+    }
+}
+
+static void end_exchange(struct heater_client_t *c)
+{
+    c->last_exchange_duration = millis() - c->exchange_start;
+    c->radio_on_time += c->last_exchange_duration;
+}
+
+static void request_failed(struct heater_client_t *c, enum error_code_t code)
+{
+    switch (code) {
+    case CANNOT_CONNECT_TO_BASE_STATION:
+        {
+            char buf[128];
+            sprintf(buf, "Failed to connect to base station (hostname/ip=%s)", c->basestation_addr);
+            log_msg(c, buf);
+        }
+        break;
+    case REPLY_TIMEOUT:
+        log_msg(c, "Timeout while waiting for heater state reply from base station");
+        break;
+    case MESSAGE_READ_FAILURE:
+        log_msg(c, "Failed to read message from base station");
+        break;
+    case REQUEST_WRITE_FAILURE:
+        log_msg(c, "Failed to write message to base station");
+        break;
+    default:
+        break;
+    }
+
+    c->request_pending = false;
+    end_exchange(c);
+    count_failure(c, code);
+}
+
+static void forget_base_station_ip(struct heater_client_t *c)
+{
+    c->basestation_ip = 0;
+    c->basestation_discovered = false;
+}
+
+/* Only called after a failure, the result comes later with heater_client_base_station_found() */
+static void discover_base_station(struct heater_client_t *c)
+{
+    if (!c->discover_base_station)
+        return;
+    if (c->discovery_count > 0 && millis() - c->discovery_timestamp < BASE_STATION_DISCOVERY_PERIOD)
+        return;
+
+    c->discovery_count++;
+    c->discovery_timestamp = millis();
+    c->discover_base_station(c);
+}
+
+/*
+ * Resolving basestation_addr on every connection adds latency, and
+ * failures when DNS is flaky. The address is resolved by connecting
+ * with the hostname, then the IP address is reused.
+ */
+static void connect_to_base_station(struct heater_client_t *c)
+{
+    c->connection_attempts++;
+    c->state = CLIENT_CONNECTING;
+    c->state_timestamp = millis();
+    c->connect_start = micros();
+
+    if (c->basestation_ip != 0 && millis() - c->basestation_ip_timestamp >= BASE_STATION_ADDR_TTL)
+        forget_base_station_ip(c);
+
+    bool ret;
+    if (c->basestation_ip != 0) {
+        ret = c->client.connect(IPAddress(c->basestation_ip), c->basestation_ip_port);
+    } else {
+        c->resolution_count++;
+        ret = c->client.connect(c->basestation_addr, c->basestation_port);
+    }
+    if (!ret)
+        c->events |= BASE_STATION_DISCONNECTED_EV;
+    wake(c);
+}
+
+/* Close connection and try again with a new one if attempts are left */
+static void retry_request(struct heater_client_t *c, enum error_code_t code)
+{
+    c->client.close(true);
+    c->state = CLIENT_DISCONNECTED;
+
+    /* Base station may have a new address, resolve it again */
+    if (code == CANNOT_CONNECT_TO_BASE_STATION) {
+        bool discovered = c->basestation_discovered;
+        forget_base_station_ip(c);
+        if (!discovered && c->connection_attempts >= CONNECTION_MAX_ATTEMPT)
+            discover_base_station(c);
+    }
+
+    if (c->connection_attempts < CONNECTION_MAX_ATTEMPT) {
+        c->request_pending = true;
+        c->reconnect_count++;
+    } else
+        request_failed(c, code);
+}
+
+/* Append a field if it fits entirely, integers are stored in little endian */
+static void append_telemetry(uint8_t *data, size_t *offset, uint8_t type, const void *value, size_t len)
+{
+    if (*offset + 2 + len > sizeof(((struct message_t *)0)->data))
+        return;
+
+    data[(*offset)++] = type;
+    data[(*offset)++] = len;
+    memcpy(&data[*offset], value, len);
+    *offset += len;
+}
+
+static void append_telemetry_uint(uint8_t *data, size_t *offset, uint8_t type, uint32_t value, size_t len)
+{
+    uint8_t buf[4];
+    for (size_t i = 0; i < len; ++i)
+        buf[i] = value >> (8 * i);
+    append_telemetry(data, offset, type, buf, len);
+}
+
+/*
+ * The name, with its NULL terminator, is followed by telemetry fields,
+ * by order of priority: those that do not fit are left out.
+ */
+static void build_heater_state_req_data(struct heater_client_t *c, uint8_t *data)
+{
+    size_t offset = strnlen(c->name, sizeof(c->name) - 1);
+    memcpy(data, c->name, offset);
+    data[offset++] = '\0';
+
+    if (c->get_rssi) {
+        int8_t rssi = c->get_rssi(c);
+        append_telemetry(data, &offset, TELEMETRY_RSSI, &rssi, sizeof(rssi));
+    }
+    append_telemetry_uint(data, &offset, TELEMETRY_UPTIME, millis() / 1000, 4);
+    {
+        unsigned int failures = c->request_state_failure_since_boot_counter;
+        append_telemetry_uint(data, &offset, TELEMETRY_FAILURES, failures > 0xFFFF ? 0xFFFF : failures, 2);
+    }
+    if (c->reply_count > 0) {
+        unsigned long rtt = c->last_reply_latency;
+        append_telemetry_uint(data, &offset, TELEMETRY_LAST_RTT, rtt > 0xFFFF ? 0xFFFF : rtt, 2);
+    }
+    if (c->firmware_version) {
+        size_t len = strlen(c->firmware_version);
+        append_telemetry(data, &offset, TELEMETRY_FIRMWARE_VERSION, c->firmware_version, len > 32 ? 32 : len);
+    }
+}
+
+static void send_heater_state_req(struct heater_client_t *c)
+{
+    log_msg(c, "Sending heater state request to base station");
+
+    struct message_t heater_state_req_msg;
+    memset(&heater_state_req_msg, 0xFF, sizeof(heater_state_req_msg));
+    heater_state_req_msg.header.protocol_version = 1;
+    heater_state_req_msg.header.msg_type = REQ_HEATER_STATE;
+    memcpy(heater_state_req_msg.header.mac, c->mac, sizeof(c->mac));
+    heater_state_req_msg.header.counter = c->msg_counter++;
+    build_heater_state_req_data(c, heater_state_req_msg.data);
+
+    c->request_pending = false;
+    c->reply_length = 0;
+    unsigned long write_start = micros();
+    if (c->client.write((const char *)&heater_state_req_msg, sizeof(heater_state_req_msg)) != sizeof(heater_state_req_msg)) {
+        retry_request(c, REQUEST_WRITE_FAILURE);
+        return;
+    }
+    c->request_written = micros();
+    record_phase(c, PHASE_WRITE, c->request_written - write_start);
+
+    c->state = CLIENT_WAITING_REPLY;
+    c->state_timestamp = millis();
+}
+
+static void handle_heater_state_reply(struct heater_client_t *c)
+{
+    struct message_t heater_state_reply_msg;
+    memcpy(&heater_state_reply_msg, c->reply_buffer, sizeof(heater_state_reply_msg));
+    c->reply_length = 0;
+    c->state = CLIENT_IDLE;
+    c->reply_count++;
+    end_exchange(c);
+
+    /* Reply may start before write() returns */
+    unsigned long first_byte = c->reply_first_byte;
+    if ((long)(first_byte - c->request_written) < 0)
+        first_byte = c->request_written;
+    record_phase(c, PHASE_WAIT, first_byte - c->request_written);
+    record_phase(c, PHASE_READ, c->reply_complete - first_byte);
+    record_latency(c, (c->reply_complete - c->request_written) / 1000);
+
+    if (heater_state_reply_msg.header.protocol_version != 1) {
+        char buffer[128];
+        sprintf(buffer, "Discarding message: protocol version %u not supported", heater_state_reply_msg.header.protocol_version);
+        log_msg(c, buffer);
+        count_failure(c, MESSAGE_PROTOCOL_NOT_SUPPORTED);
+    } else if (heater_state_reply_msg.header.msg_type == REQ_HEATER_STATE) {
+        log_msg(c, "Discarding message: not expecting REQ_HEATER_STATE from base station");
+        count_failure(c, INVALID_MESSAGE_TYPE);
+    } else if (heater_state_reply_msg.header.msg_type != HEATER_STATE_REPLY) {
+        char buffer[128];
+        sprintf(buffer, "Invalid message type %u", heater_state_reply_msg.header.msg_type);
+        log_msg(c, buffer);
+        count_failure(c, INVALID_MESSAGE_TYPE);
+    } else {
+        uint8_t new_heater_state = heater_state_reply_msg.data[0];
+        switch (new_heater_state) {
+        case HEATER_OFF:
+        case HEATER_DEFROST:
+        case HEATER_ECO:
+        case HEATER_COMFORT:
+            c->last_heater_state_timestamp = c->get_time ? c->get_time(c) : 0;
+            c->request_state_failure_count = 0;
+            set_connected(c, true);
+            set_heater_state(c, new_heater_state);
+            {
+                /* Optional delay until next request, in seconds */
+                uint16_t poll_period = heater_state_reply_msg.data[1]
+                                     | (heater_state_reply_msg.data[2] << 8);
+                if (poll_period == NO_POLL_PERIOD) {
+                    set_poll_period(c, default_poll_period(c), false);
+                } else {
+                    unsigned long period = poll_period * 1000UL;
+                    if (period < POLL_PERIOD_MIN)
+                        period = POLL_PERIOD_MIN;
+                    if (period > POLL_PERIOD_MAX)
+                        period = POLL_PERIOD_MAX;
+                    set_poll_period(c, period, true);
+                }
+            }
+            break;
+        default:
+            {
+                char buffer[64];
+                sprintf(buffer, "Received invalid heater state %d from base station", new_heater_state);
+                log_msg(c, buffer);
+                count_failure(c, INVALID_HEATER_STATE);
+            }
+            break;
+        }
+    }
+}
+
+void heater_client_init(struct heater_client_t *c, uint8_t initial_state)
+{
+    c->heater_state = initial_state;
+    c->connected_to_base_station = false;
+    c->last_heater_state_timestamp = 0;
+    c->poll_period = default_poll_period(c);
+    c->poll_period_from_base_station = false;
+
+    c->state = CLIENT_DISCONNECTED;
+    c->events = 0;
+    c->request_pending = false;
+    c->connection_attempts = 0;
+    c->state_timestamp = 0;
+    c->reply_length = 0;
+
+    c->basestation_ip = 0;
+    c->basestation_ip_port = 0;
+    c->basestation_ip_timestamp = 0;
+    c->basestation_discovered = false;
+    c->discovery_timestamp = 0;
+
+    c->error_head = 0;
+    c->error_count = 0;
+
+    c->request_count = 0;
+    c->reply_count = 0;
+    c->request_state_failure_count = 0;
+    c->request_state_failure_since_boot_counter = 0;
+    c->connection_count = 0;
+    c->resolution_count = 0;
+    c->discovery_count = 0;
+    c->exchange_start = 0;
+    c->last_exchange_duration = 0;
+    c->radio_on_time = 0;
+    c->reconnect_count = 0;
+    memset(c->error_code_count, 0, sizeof(c->error_code_count));
+    memset(c->phases, 0, sizeof(c->phases));
+    memset(c->latency_histogram, 0, sizeof(c->latency_histogram));
+    c->last_reply_latency = 0;
+
+    c->client.onConnect(base_station_connected, c);
+    c->client.onDisconnect(base_station_disconnected, c);
+    c->client.onError(base_station_error, c);
+    c->client.onData(base_station_data, c);
+}
+
+void heater_client_request_state(struct heater_client_t *c)
+{
+    if (c->request_pending || c->state == CLIENT_CONNECTING || c->state == CLIENT_WAITING_REPLY)
+        return;
+
+    c->request_pending = true;
+    c->request_count++;
+    c->connection_attempts = 0;
+    c->exchange_start = millis();
+}
+
+void heater_client_process(struct heater_client_t *c, bool wifi_connected)
+{
+    /* Connection cannot survive a WiFi disconnection */
+    if (!wifi_connected) {
+        if (c->state == CLIENT_IDLE) {
+            c->client.close(true);
+            c->state = CLIENT_DISCONNECTED;
+        }
+        set_connected(c, false);
+    }
+
+    if (c->events & BASE_STATION_CONNECTED_EV) {
+        c->events &= ~BASE_STATION_CONNECTED_EV;
+
+        if (c->state == CLIENT_CONNECTING) {
+            c->client.setNoDelay(true);
+            c->state = CLIENT_IDLE;
+            c->connection_count++;
+            record_phase(c, PHASE_CONNECT, c->connected_timestamp - c->connect_start);
+
+            if (c->basestation_ip == 0) {
+                c->basestation_ip = c->client.getRemoteAddress();
+                c->basestation_ip_port = c->basestation_port;
+                c->basestation_ip_timestamp = millis();
+            }
+        }
+    }
+
+    if (c->events & HEATER_STATE_REPLY_EV) {
+        c->events &= ~HEATER_STATE_REPLY_EV;
+
+        if (c->state == CLIENT_WAITING_REPLY)
+            handle_heater_state_reply(c);
+        else
+            c->reply_length = 0;
+    }
+
+    /* Events of a connection that was already closed are ignored */
+    if ((c->events & BASE_STATION_DISCONNECTED_EV) && !c->client.connecting() && !c->client.connected()) {
+        switch (c->state) {
+        case CLIENT_CONNECTING:
+            retry_request(c, CANNOT_CONNECT_TO_BASE_STATION);
+            break;
+        case CLIENT_WAITING_REPLY:
+            /* Base station may have closed an idle connection, try a new one */
+            retry_request(c, MESSAGE_READ_FAILURE);
+            break;
+        case CLIENT_IDLE:
+            log_msg(c, "Base station closed connection");
+            c->state = CLIENT_DISCONNECTED;
+            break;
+        default:
+            break;
+        }
+    }
+    c->events &= ~BASE_STATION_DISCONNECTED_EV;
+
+    if (c->state == CLIENT_CONNECTING
+    &&  millis() - c->state_timestamp >= HEATER_STATE_TIMEOUT)
+        retry_request(c, CANNOT_CONNECT_TO_BASE_STATION);
+
+    if (c->state == CLIENT_WAITING_REPLY
+    &&  millis() - c->state_timestamp >= HEATER_STATE_TIMEOUT) {
+        /* Reply may still come later, do not mix it with next one */
+        c->client.close(true);
+        c->state = CLIENT_DISCONNECTED;
+        request_failed(c, REPLY_TIMEOUT);
+    }
+
+    if (c->request_pending && wifi_connected) {
+        if (c->state == CLIENT_DISCONNECTED)
+            connect_to_base_station(c);
+        else if (c->state == CLIENT_IDLE)
+            send_heater_state_req(c);
+    }
+}
+
+void heater_client_base_station_found(struct heater_client_t *c, uint32_t ip, uint16_t port)
+{
+    if (ip == 0)
+        return;
+
+    log_msg(c, "Found base station on network");
+    c->basestation_ip = ip;
+    c->basestation_ip_port = port;
+    c->basestation_ip_timestamp = millis();
+    c->basestation_discovered = true;
+}
+
+bool heater_client_busy(const struct heater_client_t *c)
+{
+    return c->request_pending || c->state == CLIENT_CONNECTING || c->state == CLIENT_WAITING_REPLY;
+}
+
+const char *heater_client_error_str(enum error_code_t code)
+{
+    switch (code) {
+    case CANNOT_CONNECT_TO_BASE_STATION:
+        return "Cannot connect to base station";
+    case REPLY_TIMEOUT:
+        return "Timeout waiting for reply from base station";
+    case MESSAGE_PROTOCOL_NOT_SUPPORTED:
+        return "Message protocol not supported";
+    case INVALID_MESSAGE_TYPE:
+        return "Received invalid message type";
+    case INVALID_HEATER_STATE:
+        return "Received invalid heater state";
+    case MESSAGE_READ_FAILURE:
+        return "Failed to read message from client";
+    case REQUEST_WRITE_FAILURE:
+        return "Failed to send message to base station";
+    default:
+        return "Unknown error";
+    }
+}
+
+const char *heater_client_phase_str(enum exchange_phase_t phase)
+{
+    switch (phase) {
+    case PHASE_CONNECT:
+        return "connect";
+    case PHASE_WRITE:
+        return "write";
+    case PHASE_WAIT:
+        return "wait";
+    case PHASE_READ:
+        return "read";
+    default:
+        return "unknown";
+    }
+}
+
+unsigned long heater_client_latency_bucket_limit(unsigned int bucket)
+{
+    if (bucket >= LATENCY_BUCKET_COUNT - 1)
+        return 0;
+
+    return latency_bucket_limits[bucket];
+}
+
+void heater_client_build_errors(const struct heater_client_t *c, char *buf)
+{
+    if (c->error_count == 0) {
+        strcpy(buf, "No errors");
+        return;
+    }
+
+    buf[0] = '\0';
+    unsigned int i = 0;
+    while (i < c->error_count) {
+        const struct ErrorRecord *rec = &c->errors[(c->error_head + i) % MAX_ERROR_RECORDED];
+
+        strcat(buf, heater_client_error_str(rec->code));
+
+        char tmp[32];
+        sprintf(tmp, ", timestamp=%lu", rec->timestamp);
+        strcat(buf, tmp);
+
+        ++i;
+        if (i < c->error_count)
+            strcat(buf, "<br>");
+    }
+}
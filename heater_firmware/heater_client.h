@@ -0,0 +1,277 @@
+#ifndef HEATER_CLIENT_H
+#define HEATER_CLIENT_H
+
+#include "Arduino.h"
+#include <ESPAsyncTCP.h>
+#include <stdint.h>
+
+#define BASE_STATION_PORT               (32322)
+#define BASE_STATION_MDNS_SERVICE       "iotheater"     /* _iotheater._tcp */
+#define SEND_HEATER_STATE_REQ_PERIOD    (60 * 1000)     /* in milliseconds */
+#define HEATER_STATE_TIMEOUT            (1000)          /* in milliseconds */
+#define CONNECTION_MAX_ATTEMPT          (3)
+#define REQUEST_STATE_FAILURE_THRESHOLD (15)
+#define POLL_PERIOD_MIN                 (5 * 1000)      /* in milliseconds */
+#define POLL_PERIOD_MAX                 (60 * 60 * 1000) /* in milliseconds */
+#define NO_POLL_PERIOD                  (0xFFFF)
+#define BASE_STATION_ADDR_TTL           (60 * 60 * 1000) /* in milliseconds */
+#define BASE_STATION_DISCOVERY_PERIOD   (10 * 60 * 1000) /* in milliseconds */
+
+enum message_type_t {
+    REQ_HEATER_STATE    = 1,
+    HEATER_STATE_REPLY  = 2,
+};
+
+/* Telemetry fields appended to REQ_HEATER_STATE after the name */
+enum telemetry_type_t {
+    TELEMETRY_PAD               = 0x00,     /* single byte, no length */
+    TELEMETRY_RSSI              = 0x01,     /* int8_t, in dBm */
+    TELEMETRY_UPTIME            = 0x02,     /* uint32_t, in seconds */
+    TELEMETRY_FAILURES          = 0x03,     /* uint16_t, since boot */
+    TELEMETRY_LAST_RTT          = 0x04,     /* uint16_t, in milliseconds */
+    TELEMETRY_FIRMWARE_VERSION  = 0x05,     /* string, not NULL-terminated */
+    TELEMETRY_END               = 0xFF,
+};
+
+/* 64-byte message */
+struct __attribute__((packed)) message_t {
+    struct __attribute__((packed)) message_header_t {
+        uint8_t protocol_version;
+        uint8_t msg_type;
+        uint8_t mac[6];
+        uint64_t counter;
+    } header;
+    uint8_t data[48];
+};
+
+#define MAX_ERROR_RECORDED      (5)
+enum error_code_t {
+    CANNOT_CONNECT_TO_BASE_STATION,
+    REPLY_TIMEOUT,
+    MESSAGE_PROTOCOL_NOT_SUPPORTED,
+    INVALID_MESSAGE_TYPE,
+    INVALID_HEATER_STATE,
+    MESSAGE_READ_FAILURE,
+    REQUEST_WRITE_FAILURE,
+    ERROR_CODE_COUNT,
+};
+struct ErrorRecord {
+    enum error_code_t code;
+    unsigned long timestamp;
+};
+
+/* Phases of an exchange with the base station, timed for instrumentation */
+enum exchange_phase_t {
+    PHASE_CONNECT,              /* connect() until connected */
+    PHASE_WRITE,                /* write() of request */
+    PHASE_WAIT,                 /* request written until first byte of reply */
+    PHASE_READ,                 /* first byte until complete reply */
+    PHASE_COUNT,
+};
+struct PhaseStats {
+    unsigned long last;         /* in microseconds */
+    unsigned long max;          /* in microseconds */
+    uint64_t total;             /* in microseconds */
+    unsigned int count;
+};
+
+/* Reply latency, from request written to complete reply */
+#define LATENCY_BUCKET_COUNT    (8)
+
+enum client_state_t {
+    CLIENT_DISCONNECTED,
+    CLIENT_CONNECTING,
+    CLIENT_IDLE,                /* connected, no request in flight */
+    CLIENT_WAITING_REPLY,
+};
+
+/*
+ * Exchange of heater state with the base station.
+ *
+ * The connection is kept open between requests. AsyncClient callbacks
+ * only record events, which are handled by heater_client_process() so
+ * that the caller never waits for the network.
+ *
+ * All state lives in struct heater_client_t, so that the host build
+ * can run several heaters in one process.
+ */
+struct heater_client_t {
+    /* Configuration, set before heater_client_init() */
+    char basestation_addr[32];
+    uint16_t basestation_port;
+    uint8_t mac[6];
+    char name[32];
+    uint64_t msg_counter;
+    const char *firmware_version;   /* optional, sent in telemetry */
+
+    /* Hooks, called from heater_client_process() */
+    void (*log)(struct heater_client_t *c, const char *str);
+    unsigned long (*get_time)(struct heater_client_t *c);      /* UNIX timestamp */
+    void (*heater_state_changed)(struct heater_client_t *c);
+    void (*base_station_status_changed)(struct heater_client_t *c);
+    void (*poll_period_changed)(struct heater_client_t *c);
+    /*
+     * Optional, start looking for a base station on the network (mDNS...)
+     * after connecting to basestation_addr failed. Must not block, the
+     * result is passed to heater_client_base_station_found(). Called at
+     * most every BASE_STATION_DISCOVERY_PERIOD.
+     */
+    void (*discover_base_station)(struct heater_client_t *c);
+    /*
+     * Optional, called from AsyncClient callbacks when events are
+     * waiting for heater_client_process(), to wake up the main loop.
+     */
+    void (*wake)(struct heater_client_t *c);
+    /* Optional, signal strength in dBm sent in telemetry */
+    int (*get_rssi)(struct heater_client_t *c);
+    /*
+     * Optional, called when REQUEST_STATE_FAILURE_THRESHOLD requests in a
+     * row failed and the heater fell back to DEFAULT_HEATER_STATE, even if
+     * it never connected to the base station.
+     */
+    void (*fell_back)(struct heater_client_t *c);
+    void *user;
+
+    uint8_t heater_state;
+    bool connected_to_base_station;
+    unsigned long last_heater_state_timestamp;
+
+    /*
+     * Delay between requests, set by the base station in its replies.
+     * Back to the default period if the base station does not set it
+     * or if a request fails.
+     */
+    unsigned long poll_period;              /* in milliseconds */
+    bool poll_period_from_base_station;
+
+    /*
+     * Address of the base station, resolved by the first connection
+     * to basestation_addr or found by discovery. It is used until
+     * BASE_STATION_ADDR_TTL expires or a connection fails.
+     */
+    uint32_t basestation_ip;                /* 0 if not resolved */
+    uint16_t basestation_ip_port;
+    unsigned long basestation_ip_timestamp; /* in milliseconds */
+    bool basestation_discovered;
+    unsigned long discovery_timestamp;      /* in milliseconds */
+
+    AsyncClient client;
+    enum client_state_t state;
+    volatile uint32_t events;
+    bool request_pending;       /* send request once connected */
+    unsigned int connection_attempts;
+    unsigned long state_timestamp;      /* in milliseconds */
+    uint8_t reply_buffer[sizeof(struct message_t)];
+    size_t reply_length;
+    unsigned long connect_start;            /* in microseconds */
+    unsigned long connected_timestamp;      /* in microseconds */
+    unsigned long request_written;          /* in microseconds */
+    unsigned long reply_first_byte;         /* in microseconds */
+    unsigned long reply_complete;           /* in microseconds */
+
+    struct ErrorRecord errors[MAX_ERROR_RECORDED];
+    unsigned int error_head;
+    unsigned int error_count;
+
+    /* Statistics */
+    unsigned int request_count;
+    unsigned int reply_count;
+    unsigned int request_state_failure_count;
+    unsigned int request_state_failure_since_boot_counter;
+    unsigned int connection_count;
+    unsigned int resolution_count;
+    unsigned int discovery_count;
+    unsigned long exchange_start;           /* in milliseconds */
+    unsigned long last_exchange_duration;   /* in milliseconds */
+    unsigned long radio_on_time;            /* in milliseconds */
+    unsigned int reconnect_count;           /* connections opened again during a request */
+    unsigned int error_code_count[ERROR_CODE_COUNT];
+    struct PhaseStats phases[PHASE_COUNT];
+    unsigned int latency_histogram[LATENCY_BUCKET_COUNT];
+    unsigned long last_reply_latency;       /* in milliseconds */
+};
+
+/**
+ * @brief Reset state and register AsyncClient callbacks
+ *
+ * The default poll period depends on msg_counter, which must be set.
+ *
+ * @param[in] c
+ * @param[in] initial_state Heater state until base station replies
+ */
+void heater_client_init(struct heater_client_t *c, uint8_t initial_state);
+
+/**
+ * @brief Request heater state from base station
+ *
+ * Ignored if previous request is still in progress.
+ */
+void heater_client_request_state(struct heater_client_t *c);
+
+/**
+ * @brief Handle network events and timeouts
+ *
+ * Must be called from the main loop.
+ *
+ * @param[in] c
+ * @param[in] wifi_connected
+ */
+void heater_client_process(struct heater_client_t *c, bool wifi_connected);
+
+/**
+ * @brief Use base station found by the discover_base_station hook
+ *
+ * Must be called from the main loop. Next connections use this address
+ * until they fail or BASE_STATION_ADDR_TTL expires.
+ *
+ * @param[in] c
+ * @param[in] ip IPv4 address, in network byte order like IPAddress
+ * @param[in] port
+ */
+void heater_client_base_station_found(struct heater_client_t *c, uint32_t ip, uint16_t port);
+
+/**
+ * @brief Check if an exchange is in progress
+ *
+ * While busy, heater_client_process() must be called regularly to
+ * handle timeouts. Otherwise, it only needs to be called after
+ * heater_client_request_state() or the wake hook.
+ *
+ * @param[in] c
+ * @return True if busy, false otherwise
+ */
+bool heater_client_busy(const struct heater_client_t *c);
+
+/**
+ * @brief Get description of an error
+ *
+ * @param[in] code
+ * @return Description of error
+ */
+const char *heater_client_error_str(enum error_code_t code);
+
+/**
+ * @brief Get name of an exchange phase
+ *
+ * @param[in] phase
+ * @return Name of phase
+ */
+const char *heater_client_phase_str(enum exchange_phase_t phase);
+
+/**
+ * @brief Get upper bound of a bucket of the reply latency histogram
+ *
+ * @param[in] bucket
+ * @return Upper bound in milliseconds (excluded), 0 for the last bucket
+ */
+unsigned long heater_client_latency_bucket_limit(unsigned int bucket);
+
+/**
+ * @brief Describe last errors, separated by <br>
+ *
+ * @param[in] c
+ * @param[out] buf 512 char array
+ */
+void heater_client_build_errors(const struct heater_client_t *c, char *buf);
+
+#endif
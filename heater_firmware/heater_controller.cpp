@@ -0,0 +1,120 @@
+#include "heater.h"
+#include "heater_controller.h"
+#include <coredecls.h>
+#include <string.h>
+
+static void send_heater_state_req_callback(struct heater_controller_t *ctrl)
+{
+    heater_controller_raise_event(ctrl, SEND_HEATER_STATE_REQ_EV);
+}
+
+static void poll_period_changed(struct heater_client_t *c)
+{
+    struct heater_controller_t *ctrl = (struct heater_controller_t *)c->user;
+    ctrl->send_heater_state_req_ticker.attach_ms(c->poll_period, [ctrl] () { send_heater_state_req_callback(ctrl); });
+}
+
+static void wake(struct heater_client_t *c)
+{
+    esp_schedule();
+}
+
+static void save_rtc_state(struct heater_controller_t *ctrl)
+{
+    if (!ctrl->keep_rtc_state)
+        return;
+
+    struct rtc_state_t *state = &ctrl->rtc_state;
+    state->heater_state = ctrl->client.heater_state;
+    state->msg_counter = ctrl->client.msg_counter;
+    memcpy(state->errors, ctrl->client.errors, sizeof(state->errors));
+    state->error_head = ctrl->client.error_head;
+    state->error_count = ctrl->client.error_count;
+    rtc_state_save(state);
+}
+
+bool heater_controller_restore(struct heater_controller_t *ctrl)
+{
+    ctrl->warm_reset = ctrl->keep_rtc_state && rtc_state_load(&ctrl->rtc_state)
+                    && ctrl->rtc_state.heater_state <= HEATER_COMFORT;
+    if (ctrl->warm_reset) {
+        ctrl->rtc_state.warm_reset_count++;
+        ctrl->client.heater_state = ctrl->rtc_state.heater_state;
+    } else {
+        memset(&ctrl->rtc_state, 0, sizeof(ctrl->rtc_state));
+        ctrl->client.heater_state = DEFAULT_HEATER_STATE;
+    }
+
+    return ctrl->warm_reset;
+}
+
+void heater_controller_init(struct heater_controller_t *ctrl, uint32_t random)
+{
+    struct heater_client_t *c = &ctrl->client;
+    struct rtc_state_t *state = &ctrl->rtc_state;
+
+    /* Clear highest 4 bits of a new counter, to ensure that it will not overflow */
+    if (ctrl->warm_reset)
+        c->msg_counter = state->msg_counter;
+    else
+        c->msg_counter = (uint64_t)(random & 0x0FFFFFFF) << 32;
+
+    c->poll_period_changed = poll_period_changed;
+    c->wake = wake;
+    c->user = ctrl;
+    heater_client_init(c, c->heater_state);
+    if (ctrl->warm_reset && state->error_count <= MAX_ERROR_RECORDED && state->error_head < MAX_ERROR_RECORDED) {
+        memcpy(c->errors, state->errors, sizeof(c->errors));
+        c->error_head = state->error_head;
+        c->error_count = state->error_count;
+    }
+    save_rtc_state(ctrl);
+
+    ctrl->events = 0;
+    ctrl->request_due = false;
+    ctrl->loop_iterations = 0;
+    poll_period_changed(c);
+}
+
+void IRAM_ATTR heater_controller_raise_event(struct heater_controller_t *ctrl, uint32_t ev)
+{
+    ctrl->events |= ev;
+    esp_schedule();
+}
+
+uint32_t heater_controller_take_events(struct heater_controller_t *ctrl)
+{
+    noInterrupts();
+    uint32_t ev = ctrl->events;
+    ctrl->events = 0;
+    interrupts();
+
+    return ev;
+}
+
+void heater_controller_process(struct heater_controller_t *ctrl, uint32_t events, bool wifi_connected)
+{
+    ctrl->loop_iterations++;
+
+    if (events & SEND_HEATER_STATE_REQ_EV)
+        ctrl->request_due = true;
+    if (ctrl->request_due && wifi_connected) {
+        ctrl->request_due = false;
+        heater_client_request_state(&ctrl->client);
+    }
+
+    heater_client_process(&ctrl->client, wifi_connected);
+    save_rtc_state(ctrl);
+}
+
+bool heater_controller_has_events(const struct heater_controller_t *ctrl)
+{
+    /* Heater client records network events in its own word and calls the wake hook */
+    return ctrl->events != 0 || ctrl->client.events != 0;
+}
+
+void heater_controller_sleep(struct heater_controller_t *ctrl)
+{
+    esp_delay(heater_client_busy(&ctrl->client) ? BUSY_LOOP_PERIOD : IDLE_LOOP_PERIOD,
+              [ctrl] () { return !heater_controller_has_events(ctrl); });
+}
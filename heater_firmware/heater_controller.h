@@ -0,0 +1,120 @@
+#ifndef HEATER_CONTROLLER_H
+#define HEATER_CONTROLLER_H
+
+#include "heater_client.h"
+#include "rtc_state.h"
+#include "Arduino.h"
+#include "Ticker.h"
+#include <stdint.h>
+
+/*
+ * Part of the commissioned main loop shared by the firmware and its
+ * Linux builds: state kept across warm resets, message counter, request
+ * timer, exchanges with the base station and sleep until next event.
+ *
+ * The main loop sleeps until an event is raised. Bit 0 is used here,
+ * the caller may use the others for its own events.
+ */
+#define SEND_HEATER_STATE_REQ_EV        (1U << 0)
+
+#define BUSY_LOOP_PERIOD                (100)       /* in milliseconds */
+#define IDLE_LOOP_PERIOD                (10000)     /* in milliseconds */
+
+struct heater_controller_t {
+    /*
+     * Configuration and hooks set by the caller, except wake and
+     * poll_period_changed which are set by heater_controller_init()
+     */
+    struct heater_client_t client;
+    /* RTC user memory holds a single state, false to run several controllers in one process */
+    bool keep_rtc_state;
+    void *user;
+
+    struct rtc_state_t rtc_state;
+    bool warm_reset;
+    volatile uint32_t events;
+    bool request_due;       /* request event taken while WiFi was down */
+    Ticker send_heater_state_req_ticker;
+    unsigned long loop_iterations;
+};
+
+/**
+ * @brief Restore heater state kept in RTC memory
+ *
+ * After a warm reset (watchdog, exception...), client.heater_state is
+ * set to the last heater state so that the caller can apply it right
+ * away, and the heater does not notice the reset. Otherwise, it is set
+ * to DEFAULT_HEATER_STATE.
+ *
+ * @param[in] ctrl
+ * @return True after a warm reset, false after a cold boot
+ */
+bool heater_controller_restore(struct heater_controller_t *ctrl);
+
+/**
+ * @brief Init message counter and heater client, start request timer
+ *
+ * After a warm reset, the message counter and the last errors carry on
+ * so that the base station does not report a reboot.
+ *
+ * @param[in] ctrl
+ * @param[in] random Random number for the message counter after a cold boot
+ */
+void heater_controller_init(struct heater_controller_t *ctrl, uint32_t random);
+
+/**
+ * @brief Raise events and wake up main loop
+ *
+ * Safe from interrupts, Ticker, WiFi and lwIP callbacks.
+ *
+ * @param[in] ctrl
+ * @param[in] ev
+ */
+void IRAM_ATTR heater_controller_raise_event(struct heater_controller_t *ctrl, uint32_t ev);
+
+/**
+ * @brief Take all raised events at once
+ *
+ * Interrupts are disabled so that an event raised by an interrupt is
+ * not lost. Events raised while handling these ones are left for the
+ * next iteration.
+ *
+ * @param[in] ctrl
+ * @return Raised events
+ */
+uint32_t heater_controller_take_events(struct heater_controller_t *ctrl);
+
+/**
+ * @brief Send request if due, handle exchange and save RTC state
+ *
+ * Must be called once per iteration of the main loop. Without WiFi,
+ * the request is sent once connected.
+ *
+ * @param[in] ctrl
+ * @param[in] events Events taken by heater_controller_take_events()
+ * @param[in] wifi_connected
+ */
+void heater_controller_process(struct heater_controller_t *ctrl, uint32_t events, bool wifi_connected);
+
+/**
+ * @brief Check if events of the controller or of its heater client are waiting
+ *
+ * A request kept until WiFi connects does not count, the event raised
+ * on connection wakes the main loop.
+ *
+ * @param[in] ctrl
+ * @return True if the main loop has something to do
+ */
+bool heater_controller_has_events(const struct heater_controller_t *ctrl);
+
+/**
+ * @brief Sleep until next event
+ *
+ * While an exchange with the base station is in progress, its timeouts
+ * are checked every BUSY_LOOP_PERIOD.
+ *
+ * @param[in] ctrl
+ */
+void heater_controller_sleep(struct heater_controller_t *ctrl);
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+/*
+ * Subset of the Arduino API used by the firmware logic, implemented
+ * on Linux in host.cpp.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+typedef uint8_t byte;
+
+#define PROGMEM
+#define IRAM_ATTR
+
+#define LOW             (0)
+#define HIGH            (1)
+
+#define INPUT           (0)
+#define OUTPUT          (1)
+#define INPUT_PULLUP    (2)
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void yield(void);
+
+/* Signals play the role of interrupts, they are blocked in between */
+void noInterrupts(void);
+void interrupts(void);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+/*
+ * Only the flash sector reserved for EEPROM emulation is emulated, by a file.
+ * RTC user memory is emulated by another file, so restarting a host build
+ * behaves like a warm reset.
+ */
+class EspClass {
+public:
+    bool flashEraseSector(uint32_t sector);
+    bool flashWrite(uint32_t offset, uint32_t *data, size_t size);
+    bool flashRead(uint32_t offset, uint32_t *data, size_t size);
+    bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+    bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+};
+
+extern EspClass ESP;
+
+class String {
+public:
+    String(const char *str = ""):
+    m_str(str)
+    {
+
+    }
+
+    const char *c_str() const
+    {
+        return m_str.c_str();
+    }
+
+    unsigned int length() const
+    {
+        return m_str.length();
+    }
+
+    void toCharArray(char *buf, unsigned int size) const
+    {
+        if (size == 0)
+            return;
+
+        strncpy(buf, m_str.c_str(), size - 1);
+        buf[size - 1] = '\0';
+    }
+
+    String operator+(const String &other) const
+    {
+        return String((m_str + other.m_str).c_str());
+    }
+
+private:
+    std::string m_str;
+};
+
+/* IPv4 address, in network byte order like on the ESP8266 */
+class IPAddress {
+public:
+    IPAddress(uint32_t addr = 0):
+    m_addr(addr)
+    {
+
+    }
+
+    operator uint32_t() const
+    {
+        return m_addr;
+    }
+
+private:
+    uint32_t m_addr;
+};
+
+#endif
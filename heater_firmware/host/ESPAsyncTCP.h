@@ -0,0 +1,73 @@
+#ifndef ESPASYNCTCP_H
+#define ESPASYNCTCP_H
+
+/*
+ * AsyncClient on top of non-blocking sockets. Callbacks are run from
+ * delay() and yield(), like lwIP callbacks on the ESP8266.
+ */
+
+#include "Arduino.h"
+#include <functional>
+#include <stddef.h>
+#include <stdint.h>
+
+class AsyncClient;
+
+typedef std::function<void(void *, AsyncClient *)> AcConnectHandler;
+typedef std::function<void(void *, AsyncClient *, void *data, size_t len)> AcDataHandler;
+typedef std::function<void(void *, AsyncClient *, int8_t error)> AcErrorHandler;
+
+class AsyncClient {
+public:
+    AsyncClient();
+    ~AsyncClient();
+
+    bool connect(IPAddress ip, uint16_t port);
+    bool connect(const char *host, uint16_t port);
+    void close(bool now = false);
+    size_t write(const char *data, size_t size);
+
+    bool connecting() const;
+    bool connected() const;
+    void setNoDelay(bool nodelay);
+    uint32_t getRemoteAddress() const;
+
+    void onConnect(AcConnectHandler cb, void *arg = NULL);
+    void onDisconnect(AcConnectHandler cb, void *arg = NULL);
+    void onData(AcDataHandler cb, void *arg = NULL);
+    void onError(AcErrorHandler cb, void *arg = NULL);
+
+    /* Host only: wait up to timeout for socket events and run callbacks */
+    static void processAll(int timeout_ms);
+
+    /* Host only: true if a client is connecting or waiting for data after a write */
+    static bool anyBusy();
+
+private:
+    enum State {
+        DISCONNECTED,
+        CONNECTING,
+        CONNECTED,
+    };
+
+    AsyncClient(const AsyncClient &);
+    AsyncClient &operator=(const AsyncClient &);
+
+    void handleEvents(short revents);
+    void fail(int8_t error);
+
+    int m_fd;
+    State m_state;
+    bool m_busy;
+
+    AcConnectHandler m_connect_cb;
+    void *m_connect_cb_arg;
+    AcConnectHandler m_disconnect_cb;
+    void *m_disconnect_cb_arg;
+    AcDataHandler m_data_cb;
+    void *m_data_cb_arg;
+    AcErrorHandler m_error_cb;
+    void *m_error_cb_arg;
+};
+
+#endif
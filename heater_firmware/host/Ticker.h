@@ -0,0 +1,38 @@
+#ifndef TICKER_H
+#define TICKER_H
+
+/* Ticker callbacks are run from delay() and yield() */
+
+#include <functional>
+#include <stdint.h>
+
+class Ticker {
+public:
+    typedef std::function<void(void)> callback_function_t;
+
+    Ticker();
+    ~Ticker();
+
+    void attach_ms(uint32_t milliseconds, callback_function_t callback);
+    void once_ms(uint32_t milliseconds, callback_function_t callback);
+    void detach();
+    bool active() const;
+
+    /* Host only: time of next callback in microseconds, UINT64_MAX if none */
+    static uint64_t nextDeadline();
+
+    /* Host only: run callbacks due at now (in microseconds) */
+    static void runDue(uint64_t now);
+
+private:
+    Ticker(const Ticker &);
+    Ticker &operator=(const Ticker &);
+
+    bool m_active;
+    bool m_repeat;
+    uint64_t m_period;      /* in microseconds */
+    uint64_t m_deadline;    /* in microseconds */
+    callback_function_t m_callback;
+};
+
+#endif
@@ -0,0 +1,20 @@
+#ifndef COREDECLS_H
+#define COREDECLS_H
+
+/* Scheduling of the loop task, as in the ESP8266 core */
+
+#include <functional>
+#include <stdint.h>
+
+/**
+ * @brief Wake up loop task from esp_delay(), safe from callbacks
+ */
+void esp_schedule(void);
+
+/**
+ * @brief Run callbacks for up to timeout_ms, until esp_schedule()
+ * is called and blocked() returns false
+ */
+void esp_delay(uint32_t timeout_ms, std::function<bool(void)> blocked);
+
+#endif
@@ -0,0 +1,617 @@
+#include "Arduino.h"
+#include "ESPAsyncTCP.h"
+#include "Ticker.h"
+#include "coredecls.h"
+#include "host.h"
+#include "spi_flash.h"
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <set>
+#include <signal.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+#define PIN_COUNT           (17)
+#define RECV_BUFFER_SIZE    (1460)
+
+/* lwIP error codes passed to error callbacks */
+#define ERR_RST             (-14)
+#define ERR_CONN            (-11)
+
+static bool virtual_clock;
+static uint64_t virtual_now;    /* in microseconds */
+static std::string eeprom_path = "eeprom.bin";
+static uint8_t pins[PIN_COUNT];
+
+static std::set<AsyncClient *> clients;
+static std::set<Ticker *> tickers;
+static bool scheduled;
+
+static uint64_t real_now(void)
+{
+    static uint64_t start;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+    if (start == 0)
+        start = now;
+
+    return now - start;
+}
+
+void host_set_virtual_clock(bool enable)
+{
+    if (enable && !virtual_clock)
+        virtual_now = real_now();
+    virtual_clock = enable;
+}
+
+void host_set_eeprom_path(const char *path)
+{
+    eeprom_path = path;
+}
+
+unsigned long micros(void)
+{
+    return virtual_clock ? virtual_now : real_now();
+}
+
+unsigned long millis(void)
+{
+    return micros() / 1000;
+}
+
+/* Run callbacks until deadline, or until esp_schedule() is called if wakeable */
+static void run_until(uint64_t until, bool wakeable)
+{
+    do {
+        uint64_t now = micros();
+        uint64_t next = std::min(until, Ticker::nextDeadline());
+
+        if (!virtual_clock) {
+            int timeout = next > now ? (next - now + 999) / 1000 : 0;
+            AsyncClient::processAll(timeout);
+        } else if (AsyncClient::anyBusy()) {
+            /* Base station runs in real time, give it time to reply */
+            uint64_t start = real_now();
+            AsyncClient::processAll(1);
+            virtual_now += real_now() - start;
+        } else {
+            AsyncClient::processAll(0);
+            if (next > virtual_now)
+                virtual_now = next;
+        }
+
+        Ticker::runDue(micros());
+    } while (micros() < until && !(wakeable && scheduled));
+}
+
+void delay(unsigned long ms)
+{
+    run_until(micros() + (uint64_t)ms * 1000, false);
+}
+
+void esp_schedule(void)
+{
+    scheduled = true;
+}
+
+void esp_delay(uint32_t timeout_ms, std::function<bool(void)> blocked)
+{
+    uint64_t until = micros() + (uint64_t)timeout_ms * 1000;
+
+    while (blocked() && micros() < until) {
+        scheduled = false;
+        run_until(until, true);
+    }
+    scheduled = false;
+}
+
+void yield(void)
+{
+    AsyncClient::processAll(0);
+    Ticker::runDue(micros());
+}
+
+static void block_signals(int how)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGINT);
+    sigaddset(&set, SIGTERM);
+    sigprocmask(how, &set, NULL);
+}
+
+void noInterrupts(void)
+{
+    block_signals(SIG_BLOCK);
+}
+
+void interrupts(void)
+{
+    block_signals(SIG_UNBLOCK);
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+    if (pin < PIN_COUNT && mode == INPUT_PULLUP)
+        pins[pin] = HIGH;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+    if (pin < PIN_COUNT)
+        pins[pin] = val;
+}
+
+int digitalRead(uint8_t pin)
+{
+    return pin < PIN_COUNT ? pins[pin] : LOW;
+}
+
+/* Flash */
+
+EspClass ESP;
+
+/* Symbol of the linker script, its address gives the sector of EEPROM */
+extern "C" {
+uint32_t _EEPROM_start;
+}
+
+/*
+ * The file holds the sector of EEPROM, then the sector before it. Like
+ * in settings.cpp, addresses are computed with 32-bit arithmetic.
+ */
+#define FLASH_SECTOR_COUNT      (2)
+
+static uint32_t eeprom_sector(void)
+{
+    return (uint32_t)(((uintptr_t)&_EEPROM_start - 0x40200000) / SPI_FLASH_SEC_SIZE);
+}
+
+/* Return index of sector in file, FLASH_SECTOR_COUNT if not emulated */
+static unsigned int sector_index(uint32_t sector)
+{
+    uint32_t index = eeprom_sector() - sector;
+    return index < FLASH_SECTOR_COUNT ? index : FLASH_SECTOR_COUNT;
+}
+
+static void load_flash(std::vector<uint8_t> &flash)
+{
+    flash.assign(FLASH_SECTOR_COUNT * SPI_FLASH_SEC_SIZE, 0xFF);
+
+    FILE *file = fopen(eeprom_path.c_str(), "rb");
+    if (!file)
+        return;
+
+    size_t count = fread(flash.data(), 1, flash.size(), file);
+    (void)count;
+    fclose(file);
+}
+
+static bool store_flash(const std::vector<uint8_t> &flash)
+{
+    FILE *file = fopen(eeprom_path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ret = fwrite(flash.data(), 1, flash.size(), file) == flash.size();
+    fclose(file);
+
+    return ret;
+}
+
+/* Return offset in file, or -1 if range is not emulated or not aligned */
+static long flash_offset(uint32_t address, size_t size)
+{
+    /* sector * SPI_FLASH_SEC_SIZE may have wrapped around, so compare addresses */
+    uint32_t offset = address % SPI_FLASH_SEC_SIZE;
+    uint32_t index = (eeprom_sector() * SPI_FLASH_SEC_SIZE - (address - offset)) / SPI_FLASH_SEC_SIZE;
+    if (index >= FLASH_SECTOR_COUNT || offset % 4 || size % 4 || offset + size > SPI_FLASH_SEC_SIZE)
+        return -1;
+
+    return index * SPI_FLASH_SEC_SIZE + offset;
+}
+
+bool EspClass::flashEraseSector(uint32_t sector)
+{
+    unsigned int index = sector_index(sector);
+    if (index >= FLASH_SECTOR_COUNT)
+        return false;
+
+    std::vector<uint8_t> flash;
+    load_flash(flash);
+    memset(&flash[index * SPI_FLASH_SEC_SIZE], 0xFF, SPI_FLASH_SEC_SIZE);
+    return store_flash(flash);
+}
+
+bool EspClass::flashWrite(uint32_t address, uint32_t *data, size_t size)
+{
+    long offset = flash_offset(address, size);
+    if (offset < 0)
+        return false;
+
+    std::vector<uint8_t> flash;
+    load_flash(flash);
+
+    /* Like NOR flash, writing can only clear bits */
+    const uint8_t *src = (const uint8_t *)data;
+    for (size_t i = 0; i < size; ++i)
+        flash[offset + i] &= src[i];
+
+    return store_flash(flash);
+}
+
+bool EspClass::flashRead(uint32_t address, uint32_t *data, size_t size)
+{
+    long offset = flash_offset(address, size);
+    if (offset < 0)
+        return false;
+
+    std::vector<uint8_t> flash;
+    load_flash(flash);
+    memcpy(data, &flash[offset], size);
+    return true;
+}
+
+/* RTC user memory */
+
+#define RTC_USER_MEMORY_SIZE    (512)
+
+static bool rtc_user_memory_access(uint32_t offset, size_t size)
+{
+    return size % 4 == 0 && offset * 4 + size <= RTC_USER_MEMORY_SIZE;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size)
+{
+    if (!rtc_user_memory_access(offset, size))
+        return false;
+
+    std::vector<uint8_t> memory(RTC_USER_MEMORY_SIZE, 0);
+    FILE *file = fopen((eeprom_path + ".rtc").c_str(), "rb");
+    if (file) {
+        size_t count = fread(memory.data(), 1, memory.size(), file);
+        (void)count;
+        fclose(file);
+    }
+
+    memcpy(data, &memory[offset * 4], size);
+    return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size)
+{
+    if (!rtc_user_memory_access(offset, size))
+        return false;
+
+    std::vector<uint8_t> memory(RTC_USER_MEMORY_SIZE, 0);
+    std::string path = eeprom_path + ".rtc";
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file) {
+        size_t count = fread(memory.data(), 1, memory.size(), file);
+        (void)count;
+        fclose(file);
+    }
+
+    memcpy(&memory[offset * 4], data, size);
+
+    file = fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    bool ret = fwrite(memory.data(), 1, memory.size(), file) == memory.size();
+    fclose(file);
+
+    return ret;
+}
+
+/* Ticker */
+
+Ticker::Ticker():
+m_active(false),
+m_repeat(false),
+m_period(0),
+m_deadline(0),
+m_callback()
+{
+    tickers.insert(this);
+}
+
+Ticker::~Ticker()
+{
+    tickers.erase(this);
+}
+
+void Ticker::attach_ms(uint32_t milliseconds, callback_function_t callback)
+{
+    m_active = true;
+    m_repeat = true;
+    m_period = (uint64_t)milliseconds * 1000;
+    m_deadline = micros() + m_period;
+    m_callback = callback;
+}
+
+void Ticker::once_ms(uint32_t milliseconds, callback_function_t callback)
+{
+    attach_ms(milliseconds, callback);
+    m_repeat = false;
+}
+
+void Ticker::detach()
+{
+    m_active = false;
+}
+
+bool Ticker::active() const
+{
+    return m_active;
+}
+
+uint64_t Ticker::nextDeadline()
+{
+    uint64_t next = UINT64_MAX;
+    for (auto t : tickers) {
+        if (t->m_active)
+            next = std::min(next, t->m_deadline);
+    }
+
+    return next;
+}
+
+void Ticker::runDue(uint64_t now)
+{
+    std::vector<Ticker *> due;
+    for (auto t : tickers) {
+        if (t->m_active && t->m_deadline <= now)
+            due.push_back(t);
+    }
+
+    for (auto t : due) {
+        if (t->m_repeat) {
+            t->m_deadline += t->m_period;
+            if (t->m_deadline <= now)
+                t->m_deadline = now + t->m_period;
+        } else {
+            t->m_active = false;
+        }
+
+        t->m_callback();
+    }
+}
+
+/* AsyncClient */
+
+AsyncClient::AsyncClient():
+m_fd(-1),
+m_state(DISCONNECTED),
+m_busy(false),
+m_connect_cb(),
+m_connect_cb_arg(NULL),
+m_disconnect_cb(),
+m_disconnect_cb_arg(NULL),
+m_data_cb(),
+m_data_cb_arg(NULL),
+m_error_cb(),
+m_error_cb_arg(NULL)
+{
+    clients.insert(this);
+}
+
+AsyncClient::~AsyncClient()
+{
+    close(true);
+    clients.erase(this);
+}
+
+bool AsyncClient::connect(const char *host, uint16_t port)
+{
+    if (m_fd >= 0)
+        return false;
+
+    /* Unlike on the ESP8266, hostname is resolved synchronously */
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, NULL, &hints, &res) != 0)
+        return false;
+
+    struct sockaddr_in addr;
+    memcpy(&addr, res->ai_addr, sizeof(addr));
+    freeaddrinfo(res);
+
+    return connect(IPAddress(addr.sin_addr.s_addr), port);
+}
+
+bool AsyncClient::connect(IPAddress ip, uint16_t port)
+{
+    if (m_fd >= 0)
+        return false;
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = (uint32_t)ip;
+    addr.sin_port = htons(port);
+
+    m_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (m_fd < 0)
+        return false;
+
+    if (::connect(m_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 && errno != EINPROGRESS) {
+        ::close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+
+    /* Connection is reported from processAll(), even if already established */
+    m_state = CONNECTING;
+    m_busy = true;
+    return true;
+}
+
+void AsyncClient::close(bool now)
+{
+    (void)now;
+
+    if (m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_state = DISCONNECTED;
+    m_busy = false;
+}
+
+size_t AsyncClient::write(const char *data, size_t size)
+{
+    if (m_state != CONNECTED)
+        return 0;
+
+    ssize_t ret = send(m_fd, data, size, MSG_NOSIGNAL);
+    if (ret <= 0)
+        return 0;
+
+    m_busy = true;
+    return ret;
+}
+
+bool AsyncClient::connecting() const
+{
+    return m_state == CONNECTING;
+}
+
+bool AsyncClient::connected() const
+{
+    return m_state == CONNECTED;
+}
+
+void AsyncClient::setNoDelay(bool nodelay)
+{
+    int flag = nodelay;
+    if (m_fd >= 0)
+        setsockopt(m_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+uint32_t AsyncClient::getRemoteAddress() const
+{
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (m_fd < 0 || getpeername(m_fd, (struct sockaddr *)&addr, &len) < 0)
+        return 0;
+
+    return addr.sin_addr.s_addr;
+}
+
+void AsyncClient::onConnect(AcConnectHandler cb, void *arg)
+{
+    m_connect_cb = cb;
+    m_connect_cb_arg = arg;
+}
+
+void AsyncClient::onDisconnect(AcConnectHandler cb, void *arg)
+{
+    m_disconnect_cb = cb;
+    m_disconnect_cb_arg = arg;
+}
+
+void AsyncClient::onData(AcDataHandler cb, void *arg)
+{
+    m_data_cb = cb;
+    m_data_cb_arg = arg;
+}
+
+void AsyncClient::onError(AcErrorHandler cb, void *arg)
+{
+    m_error_cb = cb;
+    m_error_cb_arg = arg;
+}
+
+void AsyncClient::fail(int8_t error)
+{
+    close(true);
+    if (m_error_cb)
+        m_error_cb(m_error_cb_arg, this, error);
+}
+
+void AsyncClient::handleEvents(short revents)
+{
+    if (m_state == CONNECTING) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(m_fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+            fail(ERR_CONN);
+            return;
+        }
+
+        m_state = CONNECTED;
+        m_busy = false;
+        if (m_connect_cb)
+            m_connect_cb(m_connect_cb_arg, this);
+        return;
+    }
+
+    uint8_t buf[RECV_BUFFER_SIZE];
+    ssize_t ret = recv(m_fd, buf, sizeof(buf), 0);
+    if (ret > 0) {
+        m_busy = false;
+        if (m_data_cb)
+            m_data_cb(m_data_cb_arg, this, buf, ret);
+    } else if (ret == 0) {
+        close(true);
+        if (m_disconnect_cb)
+            m_disconnect_cb(m_disconnect_cb_arg, this);
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        fail(ERR_RST);
+    }
+}
+
+void AsyncClient::processAll(int timeout_ms)
+{
+    std::vector<AsyncClient *> polled;
+    std::vector<struct pollfd> fds;
+
+    for (auto c : clients) {
+        if (c->m_fd < 0)
+            continue;
+
+        struct pollfd fd;
+        fd.fd = c->m_fd;
+        fd.events = c->m_state == CONNECTING ? POLLOUT : POLLIN;
+        fd.revents = 0;
+        fds.push_back(fd);
+        polled.push_back(c);
+    }
+
+    if (fds.empty()) {
+        if (timeout_ms > 0)
+            poll(NULL, 0, timeout_ms);
+        return;
+    }
+
+    if (poll(fds.data(), fds.size(), timeout_ms) <= 0)
+        return;
+
+    for (unsigned int i = 0; i < fds.size(); ++i) {
+        /* Client may have been closed by a previous callback */
+        if (fds[i].revents && polled[i]->m_fd == fds[i].fd)
+            polled[i]->handleEvents(fds[i].revents);
+    }
+}
+
+bool AsyncClient::anyBusy()
+{
+    for (auto c : clients) {
+        if (c->m_busy)
+            return true;
+    }
+
+    return false;
+}
@@ -0,0 +1,22 @@
+#ifndef HOST_H
+#define HOST_H
+
+/* Controls of the Linux shim that have no equivalent on the ESP8266 */
+
+/**
+ * @brief Run on a virtual clock
+ *
+ * While no client waits for the network, delay() returns immediately
+ * and moves the clock to the next deadline, so that hours of heater
+ * time run in seconds. Exchanges with the base station still take
+ * real time.
+ */
+void host_set_virtual_clock(bool enable);
+
+/**
+ * @brief Set file emulating the flash sector of EEPROM and the one before,
+ * must be called before settings_load()
+ */
+void host_set_eeprom_path(const char *path);
+
+#endif
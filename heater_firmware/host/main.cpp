@@ -0,0 +1,226 @@
+#include "heater.h"
+#include "heater_controller.h"
+#include "host.h"
+#include "settings.h"
+#include "version.h"
+#include "Arduino.h"
+#include "Ticker.h"
+#include <iostream>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_BASE_STATION    "127.0.0.1"
+#define DEFAULT_EEPROM_PATH     "heater.eeprom"
+#define DEFAULT_MAC             "02:00:00:00:00:01"
+
+#define STOP_EV                 (1U << 1)
+
+static struct heater_controller_t controller;
+static Ticker stop_ticker;
+static time_t start_time;
+static bool quiet;
+
+static void print_help(char *program_name)
+{
+    std::cout << "Usage: " << program_name << " [options]\n"
+              << "Run heater firmware logic on Linux against a base station.\n"
+              << "Options:\n"
+              << "    --base-station <addr>     Base station hostname or IP address (default: " DEFAULT_BASE_STATION ")\n"
+              << "    --port <port>             Base station device server port (default: " << BASE_STATION_PORT << ")\n"
+              << "    --name <name>             Commission heater with this name\n"
+              << "    --mac <mac>               MAC address (default: " DEFAULT_MAC ")\n"
+              << "    --eeprom <path>           File emulating EEPROM (default: " DEFAULT_EEPROM_PATH ")\n"
+              << "    --virtual-clock           Skip idle time, heater time runs faster than real time\n"
+              << "    --duration <seconds>      Stop after this heater time (default: run until interrupted)\n"
+              << "    --quiet, -q               Only print summary\n"
+              << "    --help, -h                Print help\n"
+              << std::flush;
+}
+
+static void handle_signal(int)
+{
+    heater_controller_raise_event(&controller, STOP_EV);
+}
+
+static void log_msg(struct heater_client_t *c, const char *str)
+{
+    if (!quiet)
+        printf("[%lu.%03lu] %s\n", millis() / 1000, millis() % 1000, str);
+}
+
+static unsigned long get_time(struct heater_client_t *c)
+{
+    return start_time + millis() / 1000;
+}
+
+static void heater_state_changed(struct heater_client_t *c)
+{
+    static const char *names[] = { "OFF", "DEFROST", "ECO", "COMFORT" };
+
+    char buf[64];
+    sprintf(buf, "Heater state: %s", c->heater_state <= HEATER_COMFORT ? names[c->heater_state] : "?");
+    log_msg(c, buf);
+    heater_set_outputs(c->heater_state);
+}
+
+static void base_station_status_changed(struct heater_client_t *c)
+{
+    log_msg(c, c->connected_to_base_station ? "Connected to base station" : "Disconnected from base station");
+}
+
+int main(int argc, char **argv)
+{
+    char *program_name = argv[0];
+    std::string basestation = DEFAULT_BASE_STATION;
+    int port = BASE_STATION_PORT;
+    std::string name;
+    std::string mac = DEFAULT_MAC;
+    std::string eeprom_path = DEFAULT_EEPROM_PATH;
+    bool virtual_clock = false;
+    unsigned long duration = 0;
+
+    argc--;
+    argv++;
+    while (argc) {
+        std::string opt(argv[0]);
+        if (opt == "--base-station" && argc >= 2) {
+            basestation = argv[1];
+            argc--;
+            argv++;
+        } else if (opt == "--port" && argc >= 2) {
+            port = atoi(argv[1]);
+            argc--;
+            argv++;
+        } else if (opt == "--name" && argc >= 2) {
+            name = argv[1];
+            argc--;
+            argv++;
+        } else if (opt == "--mac" && argc >= 2) {
+            mac = argv[1];
+            argc--;
+            argv++;
+        } else if (opt == "--eeprom" && argc >= 2) {
+            eeprom_path = argv[1];
+            argc--;
+            argv++;
+        } else if (opt == "--virtual-clock") {
+            virtual_clock = true;
+        } else if (opt == "--duration" && argc >= 2) {
+            duration = strtoul(argv[1], NULL, 10);
+            argc--;
+            argv++;
+        } else if (opt == "--quiet" || opt == "-q") {
+            quiet = true;
+        } else if (opt == "--help" || opt == "-h") {
+            print_help(program_name);
+            return 0;
+        } else {
+            std::cerr << "Invalid option: \"" << opt << '\"' << std::endl;
+            print_help(program_name);
+            return -1;
+        }
+
+        argc--;
+        argv++;
+    }
+
+    struct heater_client_t *c = &controller.client;
+    if (sscanf(mac.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+               &c->mac[0], &c->mac[1], &c->mac[2], &c->mac[3], &c->mac[4], &c->mac[5]) != 6) {
+        std::cerr << "Invalid MAC address: \"" << mac << '\"' << std::endl;
+        return -1;
+    }
+
+    /* Same flow as the firmware: commission, then load settings from EEPROM */
+    host_set_eeprom_path(eeprom_path.c_str());
+    settings_load();
+    if (!name.empty()) {
+        String name_str(name.c_str()), ssid_str("host"), password_str(""), basestation_str(basestation.c_str());
+        settings_create(name_str, ssid_str, password_str, basestation_str);
+    }
+    if (!settings_check()) {
+        std::cerr << "No valid settings in " << eeprom_path << ", use --name to commission heater" << std::endl;
+        return -1;
+    }
+
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    host_set_virtual_clock(virtual_clock);
+    start_time = time(NULL);
+
+    /* Same flow as setup_commissioned() and loop_commissioned() */
+    controller.keep_rtc_state = true;
+    bool warm_reset = heater_controller_restore(&controller);
+    heater_set_outputs(c->heater_state);
+
+    settings_get_name(c->name);
+    settings_get_basestation(c->basestation_addr);
+    c->basestation_port = port;
+    c->log = log_msg;
+    c->get_time = get_time;
+    c->heater_state_changed = heater_state_changed;
+    c->base_station_status_changed = base_station_status_changed;
+    c->discover_base_station = NULL;
+    c->get_rssi = NULL;
+    c->fell_back = NULL;
+    c->firmware_version = FW_SHORT_VERSION;
+    srand(time(NULL) ^ getpid());
+    heater_controller_init(&controller, rand());
+
+    {
+        char buf[192];
+        sprintf(buf, "Heater \"%s\" (firmware version: %s), base station %s:%d, %s",
+                c->name, FW_VERSION, c->basestation_addr, port, warm_reset ? "warm reset" : "cold boot");
+        log_msg(c, buf);
+    }
+
+    /* Firmware sends first request once connected to WiFi */
+    heater_controller_raise_event(&controller, SEND_HEATER_STATE_REQ_EV);
+    if (duration != 0)
+        stop_ticker.once_ms(duration * 1000, [] () { heater_controller_raise_event(&controller, STOP_EV); });
+
+    unsigned long start = millis();
+    for (;;) {
+        uint32_t ev = heater_controller_take_events(&controller);
+        if (ev & STOP_EV)
+            break;
+
+        heater_controller_process(&controller, ev, true);
+        heater_controller_sleep(&controller);
+    }
+
+    {
+        char errors[512];
+        heater_client_build_errors(c, errors);
+
+        std::cout << "Heater time: " << (millis() - start) / 1000 << " s\n"
+                  << "Requests: " << c->request_count
+                  << ", replies: " << c->reply_count
+                  << ", failures: " << c->request_state_failure_since_boot_counter
+                  << ", connections: " << c->connection_count
+                  << ", address resolutions: " << c->resolution_count << '\n'
+                  << "Loop iterations: " << controller.loop_iterations << '\n'
+                  << "Radio on time: " << c->radio_on_time << " ms";
+        if (c->request_count > 0)
+            std::cout << " (" << c->radio_on_time / c->request_count << " ms per request)";
+        std::cout << "\nExchange phases (avg/max us):";
+        for (int i = 0; i < PHASE_COUNT; ++i) {
+            const struct PhaseStats *stats = &c->phases[i];
+            std::cout << ' ' << heater_client_phase_str((enum exchange_phase_t)i) << ' '
+                      << (stats->count ? stats->total / stats->count : 0) << '/' << stats->max;
+        }
+        std::cout << "\nReply latency:";
+        for (unsigned int i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+            unsigned long limit = heater_client_latency_bucket_limit(i);
+            if (limit)
+                std::cout << " <" << limit << "ms: " << c->latency_histogram[i];
+            else
+                std::cout << " more: " << c->latency_histogram[i];
+        }
+        std::cout << ", reconnects: " << c->reconnect_count;
+        std::cout << "\nLast errors: " << errors << std::endl;
+    }
+
+    return 0;
+}
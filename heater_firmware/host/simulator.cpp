@@ -0,0 +1,337 @@
+#include "heater.h"
+#include "heater_controller.h"
+#include "host.h"
+#include "Arduino.h"
+#include "Ticker.h"
+#include "coredecls.h"
+#include <algorithm>
+#include <iostream>
+#include <signal.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <vector>
+
+#define REPORT_PERIOD           (60 * 1000) /* in milliseconds */
+#define DEFAULT_BASE_STATION    "127.0.0.1"
+#define DEFAULT_HEATER_COUNT    (100)
+#define DEFAULT_DURATION        (600)       /* in seconds */
+#define EXTRA_FD_COUNT          (64)
+
+/*
+ * One simulated controller: the same heater_controller as
+ * loop_commissioned(), always connected to WiFi. WiFi, NTP, mDNS, the
+ * LEDs and the web server are not simulated, RTC memory is not kept
+ * and all controllers share one sleep: the process sleeps until one of
+ * them raised an event, or until the timeout of the first exchange in
+ * progress.
+ */
+struct simulated_heater_t {
+    struct heater_controller_t controller;
+    Ticker boot_ticker;
+    bool booted;
+    unsigned int reply_count;
+};
+
+/* Counters since last report */
+struct report_t {
+    unsigned int requests;
+    unsigned int replies;
+    unsigned int failures;
+    unsigned int connections;
+    unsigned int fallbacks;
+    unsigned int peak_in_flight;
+    std::vector<unsigned long> exchange_durations;  /* in milliseconds */
+};
+
+static struct simulated_heater_t *heaters;
+static unsigned int heater_count = DEFAULT_HEATER_COUNT;
+static struct report_t period_report;
+static struct report_t total_report;
+static time_t start_time;
+static bool verbose;
+static volatile sig_atomic_t stop;
+
+static void print_help(char *program_name)
+{
+    std::cout << "Usage: " << program_name << " [options]\n"
+              << "Run many heater controllers in one process against a base station.\n"
+              << "Options:\n"
+              << "    --base-station <addr>     Base station hostname or IP address (default: " DEFAULT_BASE_STATION ")\n"
+              << "    --port <port>             Base station device server port (default: " << BASE_STATION_PORT << ")\n"
+              << "    --heaters <count>         Number of heaters (default: " << DEFAULT_HEATER_COUNT << ")\n"
+              << "    --duration <seconds>      Heater time to simulate (default: " << DEFAULT_DURATION << ")\n"
+              << "    --boot-spread <ms>        Heaters boot at random times within this period (default: 0, power cut)\n"
+              << "    --seed <seed>             Seed of message counters, hence of request jitter (default: 1)\n"
+              << "    --real-time               Do not skip idle time\n"
+              << "    --verbose, -v             Print log of every heater\n"
+              << "    --help, -h                Print help\n"
+              << std::flush;
+}
+
+static void handle_signal(int)
+{
+    stop = 1;
+    esp_schedule();
+}
+
+static void log_msg(struct heater_client_t *c, const char *str)
+{
+    if (verbose)
+        printf("[%lu.%03lu] %s: %s\n", millis() / 1000, millis() % 1000, c->name, str);
+}
+
+static unsigned long get_time(struct heater_client_t *c)
+{
+    return start_time + millis() / 1000;
+}
+
+static void fell_back(struct heater_client_t *c)
+{
+    period_report.fallbacks++;
+    total_report.fallbacks++;
+}
+
+static unsigned long percentile(std::vector<unsigned long> &values, unsigned int p)
+{
+    if (values.empty())
+        return 0;
+
+    std::sort(values.begin(), values.end());
+    return values[(values.size() - 1) * p / 100];
+}
+
+static void print_report(const char *label, struct report_t &report)
+{
+    unsigned int disconnected = 0;
+    for (unsigned int i = 0; i < heater_count; ++i) {
+        if (!heaters[i].controller.client.connected_to_base_station)
+            disconnected++;
+    }
+
+    printf("%-8s requests=%u replies=%u failures=%u connections=%u fallbacks=%u disconnected=%u peak_in_flight=%u"
+           " exchange_ms p50=%lu p90=%lu p99=%lu max=%lu\n",
+           label,
+           report.requests, report.replies, report.failures, report.connections,
+           report.fallbacks, disconnected, report.peak_in_flight,
+           percentile(report.exchange_durations, 50),
+           percentile(report.exchange_durations, 90),
+           percentile(report.exchange_durations, 99),
+           percentile(report.exchange_durations, 100));
+}
+
+static void raise_fd_limit(void)
+{
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0)
+        return;
+
+    rlim_t needed = heater_count + EXTRA_FD_COUNT;
+    if (limit.rlim_cur >= needed)
+        return;
+
+    limit.rlim_cur = std::min(needed, limit.rlim_max);
+    setrlimit(RLIMIT_NOFILE, &limit);
+    if (limit.rlim_cur < needed)
+        std::cerr << "Warning: file descriptor limit is " << limit.rlim_cur
+                  << ", too low for " << heater_count << " heaters" << std::endl;
+}
+
+static void boot_heater(struct simulated_heater_t *h, uint32_t random)
+{
+    log_msg(&h->controller.client, "Boot");
+
+    heater_controller_restore(&h->controller);
+    heater_controller_init(&h->controller, random);
+    h->booted = true;
+
+    /* Firmware sends first request once connected to WiFi */
+    heater_controller_raise_event(&h->controller, SEND_HEATER_STATE_REQ_EV);
+}
+
+static bool no_event(void)
+{
+    if (stop)
+        return false;
+
+    for (unsigned int i = 0; i < heater_count; ++i) {
+        if (heater_controller_has_events(&heaters[i].controller))
+            return false;
+    }
+
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    char *program_name = argv[0];
+    std::string basestation = DEFAULT_BASE_STATION;
+    int port = BASE_STATION_PORT;
+    unsigned long duration = DEFAULT_DURATION;
+    unsigned long boot_spread = 0;
+    unsigned int seed = 1;
+    bool real_time = false;
+
+    argc--;
+    argv++;
+    while (argc) {
+        std::string opt(argv[0]);
+        if (opt == "--base-station" && argc >= 2) {
+            basestation = argv[1];
+            argc--;
+            argv++;
+        } else if (opt == "--port" && argc >= 2) {
+            port = atoi(argv[1]);
+            argc--;
+            argv++;
+        } else if (opt == "--heaters" && argc >= 2) {
+            heater_count = strtoul(argv[1], NULL, 10);
+            argc--;
+            argv++;
+        } else if (opt == "--duration" && argc >= 2) {
+            duration = strtoul(argv[1], NULL, 10);
+            argc--;
+            argv++;
+        } else if (opt == "--boot-spread" && argc >= 2) {
+            boot_spread = strtoul(argv[1], NULL, 10);
+            argc--;
+            argv++;
+        } else if (opt == "--seed" && argc >= 2) {
+            seed = strtoul(argv[1], NULL, 10);
+            argc--;
+            argv++;
+        } else if (opt == "--real-time") {
+            real_time = true;
+        } else if (opt == "--verbose" || opt == "-v") {
+            verbose = true;
+        } else if (opt == "--help" || opt == "-h") {
+            print_help(program_name);
+            return 0;
+        } else {
+            std::cerr << "Invalid option: \"" << opt << '\"' << std::endl;
+            print_help(program_name);
+            return -1;
+        }
+
+        argc--;
+        argv++;
+    }
+
+    if (heater_count == 0 || heater_count > 0xFFFFFF || basestation.length() >= sizeof(heaters->controller.client.basestation_addr)) {
+        std::cerr << "Invalid heater count or base station address" << std::endl;
+        return -1;
+    }
+
+    raise_fd_limit();
+    signal(SIGINT, handle_signal);
+    signal(SIGTERM, handle_signal);
+    signal(SIGPIPE, SIG_IGN);
+    host_set_virtual_clock(!real_time);
+    start_time = time(NULL);
+    srand(seed);
+
+    heaters = new struct simulated_heater_t[heater_count];
+    for (unsigned int i = 0; i < heater_count; ++i) {
+        struct simulated_heater_t *h = &heaters[i];
+        struct heater_client_t *c = &h->controller.client;
+
+        h->controller.keep_rtc_state = false;
+        h->controller.user = h;
+        strcpy(c->basestation_addr, basestation.c_str());
+        c->basestation_port = port;
+        c->mac[0] = 0x02;
+        c->mac[1] = 0x00;
+        c->mac[2] = 0x00;
+        c->mac[3] = i >> 16;
+        c->mac[4] = i >> 8;
+        c->mac[5] = i;
+        memset(c->name, 0, sizeof(c->name));
+        sprintf(c->name, "SIM%u", i);
+        c->log = log_msg;
+        c->get_time = get_time;
+        c->heater_state_changed = NULL;
+        c->base_station_status_changed = NULL;
+        c->discover_base_station = NULL;
+        c->get_rssi = NULL;
+        c->fell_back = fell_back;
+        c->firmware_version = NULL;
+
+        h->booted = false;
+        h->reply_count = 0;
+        uint32_t random = rand();
+        if (boot_spread > 0)
+            h->boot_ticker.once_ms(rand() % boot_spread, [h, random] () { boot_heater(h, random); });
+        else
+            boot_heater(h, random);
+    }
+
+    printf("Simulating %u heaters for %lu s against %s:%d\n", heater_count, duration, basestation.c_str(), port);
+
+    unsigned long start = millis();
+    unsigned long last_report = start;
+    Ticker stop_ticker;
+    stop_ticker.once_ms(duration * 1000, [] () { stop = 1; esp_schedule(); });
+    while (!stop) {
+        unsigned int in_flight = 0;
+        bool busy = false;
+
+        for (unsigned int i = 0; i < heater_count; ++i) {
+            struct simulated_heater_t *h = &heaters[i];
+            struct heater_client_t *c = &h->controller.client;
+            if (!h->booted)
+                continue;
+
+            unsigned int request_count = c->request_count;
+            unsigned int failure_count = c->request_state_failure_since_boot_counter;
+            unsigned int connection_count = c->connection_count;
+
+            heater_controller_process(&h->controller, heater_controller_take_events(&h->controller), true);
+            busy = busy || heater_client_busy(c);
+
+            if (c->reply_count != h->reply_count) {
+                h->reply_count = c->reply_count;
+                period_report.replies++;
+                period_report.exchange_durations.push_back(c->last_exchange_duration);
+            }
+            period_report.requests += c->request_count - request_count;
+            period_report.failures += c->request_state_failure_since_boot_counter - failure_count;
+            period_report.connections += c->connection_count - connection_count;
+
+            if (c->state == CLIENT_CONNECTING || c->state == CLIENT_WAITING_REPLY)
+                in_flight++;
+        }
+        period_report.peak_in_flight = std::max(period_report.peak_in_flight, in_flight);
+
+        if (millis() - last_report >= REPORT_PERIOD) {
+            char label[32];
+            sprintf(label, "%lus", (millis() - start) / 1000);
+            print_report(label, period_report);
+
+            total_report.requests += period_report.requests;
+            total_report.replies += period_report.replies;
+            total_report.failures += period_report.failures;
+            total_report.connections += period_report.connections;
+            total_report.peak_in_flight = std::max(total_report.peak_in_flight, period_report.peak_in_flight);
+            total_report.exchange_durations.insert(total_report.exchange_durations.end(),
+                                                   period_report.exchange_durations.begin(),
+                                                   period_report.exchange_durations.end());
+            period_report = report_t();
+            last_report = millis();
+        }
+
+        esp_delay(busy ? BUSY_LOOP_PERIOD : IDLE_LOOP_PERIOD, no_event);
+    }
+
+    total_report.requests += period_report.requests;
+    total_report.replies += period_report.replies;
+    total_report.failures += period_report.failures;
+    total_report.connections += period_report.connections;
+    total_report.peak_in_flight = std::max(total_report.peak_in_flight, period_report.peak_in_flight);
+    total_report.exchange_durations.insert(total_report.exchange_durations.end(),
+                                           period_report.exchange_durations.begin(),
+                                           period_report.exchange_durations.end());
+    print_report("total", total_report);
+
+    delete[] heaters;
+
+    return 0;
+}
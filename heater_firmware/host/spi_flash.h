@@ -0,0 +1,6 @@
+#ifndef SPI_FLASH_H
+#define SPI_FLASH_H
+
+#define SPI_FLASH_SEC_SIZE      (4096)
+
+#endif
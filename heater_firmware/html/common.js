@@ -0,0 +1,23 @@
+/* Fill elements whose id is a key of the JSON object served at url */
+function load(url, done) {
+  fetch(url).then(function (r) {
+    return r.json();
+  }).then(function (values) {
+    if (typeof values.uptime == "number")
+      values.uptime = formatUptime(values.uptime);
+    Object.keys(values).forEach(function (key) {
+      var e = document.getElementById(key);
+      if (e && typeof values[key] != "object")
+        e.textContent = values[key];
+    });
+    if (done)
+      done(values);
+  });
+}
+
+function formatUptime(seconds) {
+  var days = Math.floor(seconds / 86400);
+  var hours = Math.floor(seconds / 3600) % 24;
+  var minutes = Math.floor(seconds / 60) % 60;
+  return days + " days, " + hours + " hours, " + minutes + " minutes, " + seconds % 60 + " seconds";
+}
@@ -0,0 +1,55 @@
+#include "crc.h"
+#include "rtc_state.h"
+#include <string.h>
+
+#define RTC_STATE_OFFSET    (0)     /* in 32-bit blocks of user memory */
+#define RTC_STATE_MAGIC     (0x52544332)    /* "RTC2" */
+
+/* RTC memory is read and written by 32-bit words */
+union rtc_record_t {
+    struct __attribute__((packed)) {
+        uint32_t magic;
+        uint32_t crc;           /* of state */
+        struct rtc_state_t state;
+    };
+    uint32_t words[(2 * sizeof(uint32_t) + sizeof(struct rtc_state_t) + 3) / 4];
+};
+
+static union rtc_record_t saved;
+static bool saved_valid;
+
+bool rtc_state_load(struct rtc_state_t *state)
+{
+    union rtc_record_t record;
+    memset(&record, 0, sizeof(record));
+    if (!ESP.rtcUserMemoryRead(RTC_STATE_OFFSET, record.words, sizeof(record.words)))
+        return false;
+
+    if (record.magic != RTC_STATE_MAGIC || record.crc != crc32(&record.state, sizeof(record.state)))
+        return false;
+
+    memcpy(state, &record.state, sizeof(*state));
+    memcpy(&saved, &record, sizeof(saved));
+    saved_valid = true;
+    return true;
+}
+
+void rtc_state_save(const struct rtc_state_t *state)
+{
+    if (saved_valid && memcmp(&saved.state, state, sizeof(*state)) == 0)
+        return;
+
+    memset(&saved, 0, sizeof(saved));
+    saved.magic = RTC_STATE_MAGIC;
+    memcpy(&saved.state, state, sizeof(*state));
+    saved.crc = crc32(&saved.state, sizeof(saved.state));
+    saved_valid = ESP.rtcUserMemoryWrite(RTC_STATE_OFFSET, saved.words, sizeof(saved.words));
+}
+
+void rtc_state_clear(void)
+{
+    union rtc_record_t record;
+    memset(&record, 0, sizeof(record));
+    ESP.rtcUserMemoryWrite(RTC_STATE_OFFSET, record.words, sizeof(record.words));
+    saved_valid = false;
+}
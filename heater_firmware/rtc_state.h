@@ -0,0 +1,48 @@
+#ifndef RTC_STATE_H
+#define RTC_STATE_H
+
+#include "heater_client.h"
+#include <stdint.h>
+
+/*
+ * State kept in RTC user memory, which survives resets (watchdog,
+ * exception, ESP.restart()) but not power loss. A checksum tells a
+ * warm reset from a cold boot.
+ */
+struct rtc_state_t {
+    uint64_t msg_counter;
+    uint32_t heater_state;
+    uint32_t warm_reset_count;
+    struct ErrorRecord errors[MAX_ERROR_RECORDED];
+    uint32_t error_head;
+    uint32_t error_count;
+};
+
+/* Checksum and change detection cover the whole struct, padding bytes would make them unreliable */
+static_assert(sizeof(struct rtc_state_t) == sizeof(uint64_t) + 4 * sizeof(uint32_t) + MAX_ERROR_RECORDED * sizeof(struct ErrorRecord),
+              "struct rtc_state_t must not contain padding");
+
+/**
+ * @brief Load state saved before last reset
+ *
+ * @param[out] state
+ * @return True after a warm reset, false after a cold boot
+ */
+bool rtc_state_load(struct rtc_state_t *state);
+
+/**
+ * @brief Save state to RTC user memory
+ *
+ * Nothing is written if state did not change since last call, so it
+ * can be called from every iteration of the main loop.
+ *
+ * @param[in] state
+ */
+void rtc_state_save(const struct rtc_state_t *state);
+
+/**
+ * @brief Invalidate saved state, next boot is handled as a cold boot
+ */
+void rtc_state_clear(void);
+
+#endif
@@ -1,34 +1,201 @@
+#include "crc.h"
 #include "settings.h"
-#include <EEPROM.h>
 #include <string.h>
 
-#define EEPROM_LEN  (512)
+extern "C" {
+#include "spi_flash.h"
+}
+
+/*
+ * Settings are stored in the flash sector reserved for EEPROM emulation
+ * and in the sector before it, the last one of the filesystem area that
+ * this firmware does not use. The EEPROM library is not used: it erases
+ * and rewrites the whole sector on every commit.
+ *
+ * Sectors are split in slots. Each save appends a record with a
+ * sequence number and a CRC to the next erased slot of the current
+ * sector. Once it is full, the other sector is erased and written, so
+ * the latest settings are never in the sector being erased. The valid
+ * record with the highest sequence number is loaded, so a save or an
+ * erase interrupted by a power cut leaves the previous settings in place.
+ */
+
+extern "C" uint32_t _EEPROM_start;
+#define SETTINGS_SECTOR     ((uint32_t)(((uintptr_t)&_EEPROM_start - 0x40200000) / SPI_FLASH_SEC_SIZE))
+#define SECTOR_COUNT        (2)     /* SETTINGS_SECTOR, then the one before */
+
+#define SLOT_SIZE           (256)
+#define SLOT_COUNT          (SPI_FLASH_SEC_SIZE / SLOT_SIZE)    /* per sector */
+
+#define RECORD_MAGIC        (0x53544853)    /* "SHTS" */
+#define RECORD_VERSION      (2)
+
+/* Layout of version 1, written at the beginning of the sector */
+#define LEGACY_MAGIC0       (0xf1772e9a)
+#define LEGACY_MAGIC1       (0x86b81fcb)
+struct __attribute__((packed)) legacy_settings_t {
+    uint32_t magic0;
+    char name[32];
+    char ssid[64];
+    char password[64];
+    char basestation[32];
+    uint32_t magic1;
+};
+
+struct __attribute__((packed)) record_header_t {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;        /* of settings, in bytes */
+    uint32_t sequence;
+    uint32_t crc;           /* of settings */
+};
+
+#define RECORD_SIZE         (((sizeof(struct record_header_t) + sizeof(struct settings_t)) + 3) & ~3)
 
-#define MAGIC0      (0xf1772e9a)
-#define MAGIC1      (0x86b81fcb)
+static_assert(RECORD_SIZE <= SLOT_SIZE, "Settings do not fit in a slot");
 
 static struct settings_t settings;
+static bool valid;
+static int current_slot = -1;
+static uint32_t current_sequence;
+
+/* Slots are numbered across sectors, from 0 to SECTOR_COUNT * SLOT_COUNT - 1 */
+static uint32_t slot_sector(int slot)
+{
+    return SETTINGS_SECTOR - slot / SLOT_COUNT;
+}
+
+static uint32_t slot_address(int slot)
+{
+    return slot_sector(slot) * SPI_FLASH_SEC_SIZE + (slot % SLOT_COUNT) * SLOT_SIZE;
+}
+
+/* Flash is read and written by 32-bit words */
+static bool read_slot(int slot, uint32_t *words)
+{
+    return ESP.flashRead(slot_address(slot), words, SLOT_SIZE);
+}
+
+static bool is_slot_erased(int slot)
+{
+    uint32_t words[SLOT_SIZE / 4];
+    if (!read_slot(slot, words))
+        return false;
+
+    for (unsigned int i = 0; i < SLOT_SIZE / 4; ++i) {
+        if (words[i] != 0xFFFFFFFF)
+            return false;
+    }
+
+    return true;
+}
+
+/* Return false if slot does not contain a valid record */
+static bool read_record(int slot, struct record_header_t *header, struct settings_t *s)
+{
+    uint32_t words[SLOT_SIZE / 4];
+    if (!read_slot(slot, words))
+        return false;
+
+    const uint8_t *data = (const uint8_t *)words + sizeof(*header);
+    memcpy(header, words, sizeof(*header));
+    if (header->magic != RECORD_MAGIC || header->version != RECORD_VERSION
+    ||  header->length == 0 || header->length > SLOT_SIZE - sizeof(*header)
+    ||  crc32(data, header->length) != header->crc)
+        return false;
+
+    /* Fields unknown to this firmware are dropped, missing ones are zero */
+    memset(s, 0, sizeof(*s));
+    memcpy(s, data, header->length < sizeof(*s) ? header->length : sizeof(*s));
+    return true;
+}
+
+/*
+ * Append settings to the next slot of the current sector. Once it is
+ * full, erase the other sector and start over there: the current one
+ * keeps the previous settings until the new record is written.
+ */
+static bool save(const struct settings_t *s)
+{
+    /* Nothing to write if settings did not change */
+    if (valid && memcmp(s, &settings, sizeof(settings)) == 0)
+        return true;
+
+    int slot = current_slot + 1;
+    if (current_slot < 0 || slot % SLOT_COUNT == 0 || !is_slot_erased(slot)) {
+        int sector = current_slot < 0 ? 0 : (current_slot / SLOT_COUNT + 1) % SECTOR_COUNT;
+        slot = sector * SLOT_COUNT;
+        if (!ESP.flashEraseSector(slot_sector(slot)))
+            return false;
+    }
+
+    struct record_header_t header;
+    header.magic = RECORD_MAGIC;
+    header.version = RECORD_VERSION;
+    header.length = sizeof(*s);
+    header.sequence = current_sequence + 1;
+    header.crc = crc32(s, sizeof(*s));
+
+    uint32_t words[RECORD_SIZE / 4];
+    memset(words, 0xFF, sizeof(words));
+    memcpy(words, &header, sizeof(header));
+    memcpy((uint8_t *)words + sizeof(header), s, sizeof(*s));
+    if (!ESP.flashWrite(slot_address(slot), words, sizeof(words)))
+        return false;
+
+    memcpy(&settings, s, sizeof(settings));
+    current_slot = slot;
+    current_sequence = header.sequence;
+    return true;
+}
 
-static bool is_valid(void)
+/* Convert settings saved by firmwares that used the EEPROM library */
+static bool migrate_legacy_settings(void)
 {
-    return settings.magic0 == MAGIC0 && settings.magic1 == MAGIC1;
+    uint32_t words[SLOT_SIZE / 4];
+    struct legacy_settings_t legacy;
+
+    if (!read_slot(0, words))
+        return false;
+    memcpy(&legacy, words, sizeof(legacy));
+    if (legacy.magic0 != LEGACY_MAGIC0 || legacy.magic1 != LEGACY_MAGIC1)
+        return false;
+
+    struct settings_t s;
+    memset(&s, 0, sizeof(s));
+    memcpy(s.name, legacy.name, sizeof(s.name));
+    memcpy(s.ssid, legacy.ssid, sizeof(s.ssid));
+    memcpy(s.password, legacy.password, sizeof(s.password));
+    memcpy(s.basestation, legacy.basestation, sizeof(s.basestation));
+
+    /* Legacy settings stay in the first sector until the record is written in the second one */
+    current_slot = SLOT_COUNT - 1;
+    current_sequence = 0;
+    return save(&s);
 }
 
 bool settings_load(void)
 {
-    uint8_t *dst = (uint8_t *)&settings;
-    int addr = 0;
-    bool valid;
+    current_slot = -1;
+    current_sequence = 0;
+    valid = false;
 
-    EEPROM.begin(EEPROM_LEN);
+    for (int slot = 0; slot < (int)(SECTOR_COUNT * SLOT_COUNT); ++slot) {
+        struct record_header_t header;
+        struct settings_t s;
+        if (!read_record(slot, &header, &s))
+            continue;
 
-    /* Read settings from EEPROM */
-    while (addr < sizeof(settings)) {
-      *dst++ = EEPROM.read(addr);
-      ++addr;
+        if (!valid || (int32_t)(header.sequence - current_sequence) > 0) {
+            memcpy(&settings, &s, sizeof(settings));
+            current_slot = slot;
+            current_sequence = header.sequence;
+            valid = true;
+        }
     }
 
-    valid = is_valid();
+    if (!valid)
+        valid = migrate_legacy_settings();
 
     if (!valid)
         memset(&settings, 0, sizeof(settings));
@@ -38,44 +205,30 @@ bool settings_load(void)
 
 void settings_erase(void)
 {
-    /* Erase EEPROM */
-    for (int i = 0; i < EEPROM_LEN; ++i)
-        EEPROM.write(i, 0xFF);
-    EEPROM.commit();
+    for (int sector = 0; sector < SECTOR_COUNT; ++sector)
+        ESP.flashEraseSector(slot_sector(sector * SLOT_COUNT));
+    current_slot = -1;
+    current_sequence = 0;
 
     memset(&settings, 0, sizeof(settings));
+    valid = false;
 }
 
 void settings_create(String &name, String &ssid, String &password, String &basestation)
 {
-    /* Erase EEPROM */
-    for (int i = 0; i < EEPROM_LEN; ++i)
-        EEPROM.write(i, 0xFF);
-    EEPROM.commit();
+    struct settings_t s;
+    memset(&s, 0, sizeof(s));
+    name.toCharArray(s.name, sizeof(s.name));
+    ssid.toCharArray(s.ssid, sizeof(s.ssid));
+    password.toCharArray(s.password, sizeof(s.password));
+    basestation.toCharArray(s.basestation, sizeof(s.basestation));
 
-    /* Init settings */
-    memset(&settings, 0, sizeof(settings));
-    settings.magic0 = MAGIC0;
-    settings.magic1 = MAGIC1;
-
-    name.toCharArray(settings.name, sizeof(settings.name));
-    ssid.toCharArray(settings.ssid, sizeof(settings.ssid));
-    password.toCharArray(settings.password, sizeof(settings.password));
-    basestation.toCharArray(settings.basestation, sizeof(settings.basestation));
-
-    /* Write settings */
-    uint8_t *src = (uint8_t *)&settings;
-    int addr = 0;
-    while (addr < sizeof(settings)) {
-      EEPROM.write(addr, *src++);
-      addr++;
-    }
-    EEPROM.commit();
+    valid = save(&s);
 }
 
 void settings_get_name(char *name)
 {
-    if (is_valid())
+    if (valid)
         memcpy(name, settings.name, sizeof(settings.name));
     else
         memset(name, 0, sizeof(settings.name));
@@ -83,7 +236,7 @@ void settings_get_name(char *name)
 
 void settings_get_ssid(char *ssid)
 {
-    if (is_valid())
+    if (valid)
         memcpy(ssid, settings.ssid, sizeof(settings.ssid));
     else
         memset(ssid, 0, sizeof(settings.ssid));
@@ -91,7 +244,7 @@ void settings_get_ssid(char *ssid)
 
 void settings_get_password(char *password)
 {
-    if (is_valid())
+    if (valid)
         memcpy(password, settings.password, sizeof(settings.password));
     else
         memset(password, 0, sizeof(settings.password));
@@ -99,19 +252,42 @@ void settings_get_password(char *password)
 
 void settings_get_basestation(char *basestation)
 {
-    if (is_valid())
+    if (valid)
         memcpy(basestation, settings.basestation, sizeof(settings.basestation));
     else
         memset(basestation, 0, sizeof(settings.basestation));
 }
 
+bool settings_get_wifi_cache(struct wifi_cache_t *cache)
+{
+    if (!valid || settings.wifi_cache.channel == 0)
+        return false;
+
+    memcpy(cache, &settings.wifi_cache, sizeof(*cache));
+    return true;
+}
+
+void settings_set_wifi_cache(const struct wifi_cache_t *cache)
+{
+    if (!valid)
+        return;
+
+    struct settings_t s;
+    memcpy(&s, &settings, sizeof(s));
+    if (cache)
+        memcpy(&s.wifi_cache, cache, sizeof(s.wifi_cache));
+    else
+        memset(&s.wifi_cache, 0, sizeof(s.wifi_cache));
+
+    save(&s);
+}
 
 bool settings_check()
 {
     if (strlen(settings.name) == 0 || strlen(settings.ssid) == 0 || strlen(settings.basestation) == 0)
         return false;
 
-    for (int i = 0; i < strlen(settings.name); ++i) {
+    for (unsigned int i = 0; i < strlen(settings.name); ++i) {
         bool is_char_valid = ('a' <= settings.name[i] && settings.name[i] <= 'z')
                           || ('A' <= settings.name[i] && settings.name[i] <= 'Z')
                           || ('0' <= settings.name[i] && settings.name[i] <= '9');
@@ -121,5 +297,5 @@ bool settings_check()
 
     /* Note that empty password is allowed to support open wifi */
 
-    return is_valid();
+    return valid;
 }
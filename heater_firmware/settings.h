@@ -4,20 +4,33 @@
 #include "Arduino.h"
 #include <stdint.h>
 
+/* Last WiFi connection, to join again without scan nor DHCP */
+struct __attribute__((packed)) wifi_cache_t {
+    uint8_t bssid[6];
+    uint8_t channel;        /* 0 if unknown */
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+};
+
+/*
+ * Settings saved in flash. New fields must be added at the end: records
+ * written by older firmwares are shorter and missing fields are loaded
+ * as zero.
+ */
 struct __attribute__((packed)) settings_t {
-    uint32_t magic0;
     char name[32];
     char ssid[64];
     char password[64];
     char basestation[32];
-    uint32_t magic1;
+    struct wifi_cache_t wifi_cache;
 };
 
 /**
- * @brief Load settings from EEPROM
+ * @brief Load settings from flash
  *
- * Note that EEPROM must be initialized before
- * calling this function.
+ * Settings saved by older firmwares are migrated.
  *
  * @return True if it contains a valid, false otherwise
  */
@@ -29,7 +42,7 @@ bool settings_load(void);
 void settings_erase(void);
 
 /**
- * @brief Create and save it to EEPROM
+ * @brief Create and save it to flash
  *
  * @param[in] name
  * @param[in] ssid
@@ -66,6 +79,23 @@ void settings_get_password(char *password);
  */
 void settings_get_basestation(char *basestation);
 
+/**
+ * @brief Get last WiFi connection
+ *
+ * @param[out] cache
+ * @return True if a connection was saved, false otherwise
+ */
+bool settings_get_wifi_cache(struct wifi_cache_t *cache);
+
+/**
+ * @brief Save last WiFi connection to flash
+ *
+ * Nothing is written if it did not change.
+ *
+ * @param[in] cache Connection, or NULL to forget it
+ */
+void settings_set_wifi_cache(const struct wifi_cache_t *cache);
+
 /**
  * @brief Quick settings check
  *
@@ -1,9 +1,9 @@
 #include "board.h"
 #include "uncommissioned.h"
+#include "rtc_state.h"
 #include "settings.h"
 #include "Arduino.h"
 #include "Ticker.h"
-#include "uptime_formatter.h"
 #include "version.h"
 #include "webpages.h"
 #include <DNSServer.h>
@@ -16,7 +16,6 @@
 
 #define DNS_PORT              (53)
 
-static char webpage_buffer[2048];
 static AsyncWebServer server(80);
 static DNSServer dns_server;
 
@@ -52,6 +51,20 @@ static bool check_params(void)
     return true;
 }
 
+static void send_info_json(AsyncWebServerRequest *request)
+{
+    AsyncResponseStream *response = request->beginResponseStream("application/json");
+    response->printf("{\"chip_id\":\"%08X\",\"firmware\":", ESP.getChipId());
+    print_json_string(response, FW_VERSION);
+    response->printf(",\"mac\":\"%s\",\"uptime\":%lu}", WiFi.softAPmacAddress().c_str(), millis() / 1000);
+    request->send(response);
+}
+
+static void send_index(AsyncWebServerRequest *request)
+{
+    send_gzipped_webpage(request, "text/html", uncommissioned_index_html_gz, uncommissioned_index_html_gz_len);
+}
+
 void setup_uncommissioned(void)
 {
     pinMode(LED1_PIN, OUTPUT);
@@ -67,6 +80,9 @@ void setup_uncommissioned(void)
     pinMode(POSITIVE_OUTPUT_PIN, INPUT);
     pinMode(NEGATIVE_OUTPUT_PIN, INPUT);
 
+    /* State of a previous commissioning must not be restored */
+    rtc_state_clear();
+
     /* Create Wifi AP */
     byte mac[6];
     WiFi.macAddress(mac);
@@ -88,19 +104,12 @@ void setup_uncommissioned(void)
     dns_server.start(DNS_PORT, "www.heater.local", apIP);
 
     /* Spawn web server */
-    server.on("/", HTTP_GET, [](AsyncWebServerRequest *request){
-            byte mac[6];
-            WiFi.softAPmacAddress(mac);
-
-            /* Build webpage */
-            sprintf(webpage_buffer, uncommissioned_index_html,
-                    ESP.getChipId(),
-                    FW_VERSION,
-                    mac[0], mac[1], mac[2], mac[3], mac[4], mac[5],
-                    uptime_formatter::getUptime().c_str());
-            request->send_P(200, "text/html", webpage_buffer);
+    server.on("/", HTTP_GET, send_index);
+    server.on("/common.js", HTTP_GET, [](AsyncWebServerRequest *request){
+            send_gzipped_webpage(request, "application/javascript", common_js_gz, common_js_gz_len);
         }
     );
+    server.on("/info.json", HTTP_GET, send_info_json);
 
     server.on("/register", HTTP_POST, [] (AsyncWebServerRequest *request) {
       if (request->hasParam("name", true)
@@ -116,11 +125,11 @@ void setup_uncommissioned(void)
                 joining_wifi_network_start = millis();
                 joining_wifi_network = true;
             } else {
-                request->send_P(200, "text/html", webpage_buffer);
+                send_index(request);
             }
         }
     } else {
-        request->send_P(200, "text/html", webpage_buffer);
+        send_index(request);
       }
     }
     );
@@ -5,13 +5,16 @@
 #define str(s) #s
 
 #ifndef GIT_HASH
-#define GIT_HASH    "unknown"
+#define GIT_HASH    unknown
 #endif
 
 #ifndef BUILD_TIME
-#define BUILD_TIME  "unknown"
+#define BUILD_TIME  unknown
 #endif
 
 #define FW_VERSION xstr(GIT_HASH) " - " xstr(BUILD_TIME)
 
+/* Sent to the base station in telemetry */
+#define FW_SHORT_VERSION xstr(GIT_HASH)
+
 #endif
@@ -1,8 +1,45 @@
 #ifndef WEBPAGES_H
-#define WEB_PAGES_H
+#define WEBPAGES_H
 
-extern const char uncommissioned_index_html[];
+#include <Arduino.h>
+#include <stddef.h>
+#include <stdint.h>
 
-extern const char commissioned_index_html[];
+class AsyncResponseStream;
+class AsyncWebServerRequest;
+
+/*
+ * Gzipped files of html/, generated by gen_webpages.sh in
+ * webpages_data.cpp. They must be sent with "Content-Encoding: gzip".
+ */
+
+extern const uint8_t uncommissioned_index_html_gz[];
+extern const size_t uncommissioned_index_html_gz_len;
+
+extern const uint8_t commissioned_index_html_gz[];
+extern const size_t commissioned_index_html_gz_len;
+
+extern const uint8_t common_js_gz[];
+extern const size_t common_js_gz_len;
+
+/**
+ * @brief Send a gzipped file of html/
+ *
+ * @param[in] request
+ * @param[in] content_type
+ * @param[in] data Gzipped file, in flash
+ * @param[in] len Length of data in bytes
+ */
+void send_gzipped_webpage(AsyncWebServerRequest *request, const char *content_type, const uint8_t *data, size_t len);
+
+/**
+ * @brief Print a JSON string, escaping quotes, backslashes and control characters
+ *
+ * Without GIT_HASH, the firmware version contains quotes.
+ *
+ * @param[in] response
+ * @param[in] str
+ */
+void print_json_string(AsyncResponseStream *response, const char *str);
 
 #endif
@@ -0,0 +1,134 @@
+/* Generated by gen_webpages.sh from html/, do not edit */
+
+#include "webpages.h"
+
+/* html/commissioned_index.html: 2289 bytes, 929 bytes gzipped */
+const uint8_t commissioned_index_html_gz[] PROGMEM = {
+   0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x75, 0x56, 0x4b, 0x6f, 0xdb, 0x38,
+   0x10, 0xbe, 0xe7, 0x57, 0xcc, 0xea, 0x64, 0xa3, 0x89, 0xdd, 0xe6, 0x50, 0x2c, 0xb6, 0x92, 0x81,
+   0x8d, 0xe3, 0xa0, 0x01, 0xfa, 0x08, 0x92, 0x2c, 0x16, 0x7b, 0x12, 0x68, 0x69, 0x2c, 0xb1, 0xa5,
+   0x48, 0x2d, 0x49, 0x39, 0x09, 0x8a, 0xfd, 0xef, 0x3b, 0x24, 0x65, 0x8b, 0x72, 0x14, 0x5f, 0x28,
+   0xcd, 0x7c, 0x33, 0xf3, 0xcd, 0x43, 0x43, 0xa7, 0xbf, 0x5d, 0x7f, 0x5f, 0x3f, 0xfe, 0x73, 0xb7,
+   0x81, 0xcf, 0x8f, 0x5f, 0xbf, 0xac, 0xce, 0xd2, 0xda, 0x36, 0xc2, 0x1d, 0xc8, 0xca, 0xd5, 0x19,
+   0x40, 0xda, 0xa0, 0x65, 0x20, 0x59, 0x83, 0x59, 0xb2, 0xe7, 0xf8, 0xd4, 0x2a, 0x6d, 0x13, 0x28,
+   0x94, 0xb4, 0x28, 0x6d, 0x96, 0x3c, 0xf1, 0xd2, 0xd6, 0x59, 0x89, 0x7b, 0x5e, 0xe0, 0x85, 0x7f,
+   0x39, 0x07, 0x2e, 0xb9, 0xe5, 0x4c, 0x5c, 0x98, 0x82, 0x09, 0xcc, 0x3e, 0x24, 0xde, 0x8d, 0xe5,
+   0x56, 0xe0, 0xea, 0x33, 0x32, 0x8b, 0x3a, 0x5d, 0x86, 0xb7, 0xb3, 0x74, 0x19, 0xc2, 0xa4, 0x5b,
+   0x55, 0xbe, 0x78, 0x58, 0xfd, 0xa1, 0xc7, 0xf8, 0x10, 0x5a, 0x09, 0x41, 0x8f, 0x17, 0x90, 0x9a,
+   0x96, 0x49, 0xe0, 0x65, 0x96, 0x38, 0x26, 0xc9, 0x2a, 0x5d, 0x3a, 0x01, 0x1d, 0x84, 0xf7, 0x66,
+   0x97, 0xab, 0x6b, 0xcf, 0x81, 0x82, 0xef, 0x94, 0x6e, 0x98, 0xe5, 0x4a, 0x92, 0xf6, 0xd2, 0x69,
+   0x37, 0x0f, 0x77, 0xbf, 0x5f, 0x7e, 0xfc, 0x08, 0x45, 0xcd, 0x5b, 0xb8, 0xbd, 0xfe, 0x23, 0xf2,
+   0xe6, 0x44, 0x39, 0x2f, 0x8f, 0x0e, 0x9d, 0xaf, 0xad, 0x76, 0xc7, 0x0d, 0xd7, 0xcd, 0x13, 0xd3,
+   0x08, 0x7b, 0xd4, 0x86, 0x9c, 0xc5, 0x56, 0xbb, 0x5e, 0x37, 0x61, 0xf6, 0xf5, 0xcf, 0x35, 0xb0,
+   0xb2, 0xd4, 0x68, 0x4c, 0x6c, 0xd1, 0xb0, 0x62, 0x02, 0xfc, 0x57, 0x6b, 0x79, 0x83, 0x31, 0xae,
+   0xf3, 0x92, 0x09, 0xe8, 0x17, 0x66, 0x2c, 0x90, 0x57, 0xb4, 0x31, 0xdc, 0x0b, 0x72, 0x8d, 0xcc,
+   0x28, 0x79, 0x34, 0x82, 0x19, 0x71, 0x6b, 0x02, 0x78, 0x44, 0xc2, 0x89, 0xf3, 0x20, 0x3e, 0x82,
+   0xe7, 0x43, 0x88, 0x47, 0x8a, 0x0c, 0x56, 0x01, 0x65, 0x47, 0xb1, 0x5a, 0x2a, 0x3d, 0xb0, 0x9d,
+   0xeb, 0xc4, 0x56, 0x29, 0x7b, 0x92, 0xbe, 0xb1, 0xb9, 0x03, 0xe4, 0x23, 0xb6, 0xd0, 0x18, 0x98,
+   0x4d, 0xc2, 0x7e, 0x28, 0x2e, 0xa7, 0x42, 0xfe, 0xcd, 0x6f, 0x38, 0x18, 0x5e, 0x49, 0x26, 0xc0,
+   0x58, 0x8d, 0xb2, 0xb2, 0x35, 0xcc, 0xee, 0x1f, 0x1e, 0x6e, 0xe7, 0xa3, 0x34, 0x8d, 0xe1, 0x43,
+   0x94, 0xf2, 0xaa, 0x89, 0xc3, 0x3c, 0xf1, 0x1d, 0xcf, 0x05, 0xee, 0x51, 0x4c, 0x45, 0xb8, 0x62,
+   0x06, 0xc9, 0xb5, 0x9f, 0x07, 0xdf, 0x98, 0xd8, 0xef, 0x96, 0x94, 0xbd, 0x2e, 0x77, 0xba, 0xa8,
+   0x84, 0xd3, 0x20, 0xde, 0x4e, 0xc5, 0xe8, 0x07, 0xd6, 0x81, 0x46, 0xcd, 0xac, 0xbd, 0x3c, 0xf7,
+   0xf2, 0xb7, 0x5a, 0x5a, 0x47, 0xb6, 0xd4, 0xb2, 0x56, 0xbc, 0xc0, 0x4e, 0xab, 0x06, 0xb6, 0x11,
+   0xef, 0xd8, 0xa7, 0x20, 0xa3, 0xdc, 0xe3, 0x26, 0x3c, 0xde, 0xb9, 0x9e, 0xb5, 0xa8, 0xb9, 0x2a,
+   0x63, 0x1b, 0xdf, 0x82, 0x20, 0x1e, 0x32, 0x1c, 0xb5, 0x2a, 0x42, 0xe4, 0x46, 0x75, 0xba, 0xc0,
+   0xa9, 0x3c, 0x37, 0x5a, 0x2b, 0xf7, 0x5d, 0x76, 0xd2, 0x52, 0xd3, 0x24, 0x7d, 0x6c, 0xaf, 0x26,
+   0x83, 0x71, 0xd1, 0xd1, 0x84, 0x4d, 0x70, 0xbb, 0x67, 0x25, 0x57, 0x40, 0x4d, 0x70, 0x23, 0xf3,
+   0x86, 0xb9, 0x76, 0x98, 0x9c, 0xea, 0xfc, 0x7a, 0xac, 0x44, 0x98, 0xff, 0x7f, 0x3b, 0xea, 0xc5,
+   0xab, 0x7a, 0xe0, 0x73, 0x51, 0x33, 0x59, 0x8d, 0x4c, 0x22, 0xde, 0x6b, 0x25, 0x25, 0x16, 0xae,
+   0x92, 0xc6, 0xcd, 0x77, 0x5c, 0xda, 0x37, 0x88, 0x14, 0x83, 0xc5, 0x54, 0xe3, 0x94, 0x6a, 0xe1,
+   0xf4, 0xcb, 0x15, 0x24, 0xf4, 0xbc, 0x73, 0xb6, 0xaf, 0x06, 0x22, 0x9d, 0x71, 0x39, 0x33, 0x5a,
+   0x22, 0xac, 0xc2, 0xf3, 0x49, 0x7c, 0xc3, 0x9e, 0x47, 0x78, 0x7a, 0x8f, 0x7b, 0xe3, 0x81, 0x3a,
+   0x1e, 0x21, 0xe0, 0x34, 0x32, 0x2c, 0xe4, 0x43, 0x4d, 0x83, 0x86, 0xcb, 0xce, 0x62, 0x94, 0xf0,
+   0x8d, 0x46, 0x74, 0x93, 0xd5, 0x8e, 0x7a, 0x43, 0xc2, 0xdc, 0x09, 0x07, 0x3f, 0xdb, 0x17, 0x8b,
+   0xbe, 0xb6, 0xba, 0xa2, 0xb2, 0xc2, 0x56, 0xa8, 0xe2, 0xe7, 0x78, 0x6b, 0x3d, 0xe7, 0xde, 0xcc,
+   0x6b, 0x4e, 0xec, 0xa2, 0x78, 0x87, 0xc3, 0x6d, 0x5e, 0x60, 0xbe, 0x6e, 0x59, 0xb2, 0xec, 0xa4,
+   0xc6, 0x8a, 0x1b, 0xe2, 0x9a, 0x00, 0x5d, 0x22, 0xb5, 0xf2, 0x83, 0x66, 0xac, 0xbf, 0x0f, 0xdc,
+   0x2f, 0xdd, 0x76, 0xd6, 0x52, 0x75, 0xc2, 0xe5, 0x12, 0xc3, 0xf7, 0x4c, 0x74, 0x63, 0xd1, 0xea,
+   0xde, 0xed, 0x2d, 0x77, 0x29, 0xec, 0x78, 0xd5, 0xe9, 0x7e, 0xbf, 0x07, 0x07, 0x3e, 0xf6, 0xd2,
+   0x05, 0x3f, 0xdc, 0x05, 0x7e, 0x52, 0xcd, 0x61, 0xff, 0xa7, 0x25, 0xdf, 0xfb, 0x7c, 0xd0, 0x8b,
+   0x5d, 0x1e, 0x24, 0xf1, 0x1a, 0x53, 0x68, 0xde, 0xd2, 0x34, 0xeb, 0x82, 0x08, 0x17, 0xaa, 0x69,
+   0x94, 0x5c, 0xfc, 0x08, 0x3d, 0xf7, 0x9a, 0x08, 0x14, 0x58, 0x0b, 0xc5, 0xca, 0x59, 0xb2, 0x74,
+   0xe3, 0xd3, 0x19, 0x82, 0xd2, 0xde, 0x3d, 0x87, 0x5d, 0x27, 0x7d, 0xd2, 0x30, 0x33, 0x73, 0xf8,
+   0xd5, 0x67, 0x57, 0xaa, 0xa2, 0x6b, 0xe8, 0x8e, 0x5c, 0xf8, 0xbb, 0x0e, 0x32, 0x48, 0xfa, 0x3d,
+   0x71, 0x01, 0x09, 0xbc, 0x03, 0xb3, 0x70, 0x69, 0x7f, 0xea, 0xc1, 0x7b, 0xa6, 0x21, 0xb0, 0x23,
+   0xe0, 0xd1, 0xb2, 0x42, 0xbb, 0x11, 0xe8, 0x1e, 0xaf, 0x5e, 0x6e, 0x29, 0x6c, 0xcf, 0x7f, 0x7e,
+   0xb0, 0xe2, 0x3b, 0x8a, 0xb8, 0x08, 0xd2, 0x85, 0x08, 0xdb, 0x33, 0xcb, 0xe0, 0xfd, 0xbc, 0xd7,
+   0x43, 0xef, 0x73, 0x61, 0xf1, 0xd9, 0xae, 0xc3, 0x95, 0xed, 0x88, 0x7c, 0x53, 0xbd, 0x22, 0x39,
+   0x78, 0x3a, 0x7a, 0xa1, 0x2a, 0x6e, 0x58, 0x51, 0xcf, 0x86, 0x94, 0x70, 0x48, 0x29, 0xf0, 0x14,
+   0x5c, 0x62, 0xcc, 0xb2, 0xd0, 0x2e, 0xaf, 0x9e, 0xe8, 0x2c, 0xa1, 0xd2, 0x0e, 0x0c, 0xc1, 0xa3,
+   0x4f, 0xe2, 0xe3, 0xa2, 0xc4, 0x50, 0x53, 0x17, 0xe0, 0x1d, 0x50, 0x05, 0xdd, 0x87, 0x40, 0x35,
+   0x6d, 0xda, 0xcc, 0xd5, 0x86, 0x0c, 0x0e, 0xef, 0x9f, 0x4e, 0x53, 0x61, 0x6d, 0x8b, 0xb2, 0x5c,
+   0xd7, 0x5c, 0x94, 0x33, 0xe7, 0xfb, 0x18, 0xea, 0xbf, 0xfe, 0x29, 0x9c, 0x43, 0x03, 0x69, 0x4a,
+   0xfc, 0x9f, 0x0b, 0x9a, 0x06, 0xff, 0xcf, 0xe6, 0x7f, 0xaa, 0xb3, 0xd8, 0x96, 0xf1, 0x08, 0x00,
+   0x00,
+};
+const size_t commissioned_index_html_gz_len = sizeof(commissioned_index_html_gz);
+
+/* html/common.js: 775 bytes, 394 bytes gzipped */
+const uint8_t common_js_gz[] PROGMEM = {
+   0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x75, 0x92, 0x4f, 0x4f, 0x83, 0x40,
+   0x10, 0xc5, 0xef, 0x7c, 0x8a, 0x27, 0x89, 0x0d, 0xb4, 0x0d, 0x6d, 0xb4, 0x21, 0x26, 0x4d, 0x2f,
+   0x9a, 0x9a, 0x68, 0xa2, 0x1e, 0x8c, 0x27, 0xe3, 0x81, 0xc2, 0x20, 0x54, 0xd8, 0x6d, 0xf6, 0x4f,
+   0x95, 0x98, 0x7e, 0x77, 0x77, 0x17, 0x68, 0xad, 0xa6, 0x27, 0x86, 0x99, 0xdf, 0xbc, 0x99, 0x79,
+   0x30, 0x19, 0xe2, 0xb6, 0xac, 0x2a, 0x50, 0x45, 0x35, 0x31, 0x25, 0xf1, 0x59, 0x70, 0x49, 0x28,
+   0x33, 0x94, 0x12, 0x09, 0x3e, 0xa8, 0x01, 0xcf, 0xa1, 0x0a, 0xc2, 0xfd, 0xf3, 0xd3, 0x23, 0xf8,
+   0x6a, 0x4d, 0xa9, 0x82, 0x24, 0xb1, 0xa5, 0x0c, 0x89, 0x82, 0x16, 0x15, 0x86, 0x13, 0x2f, 0xd7,
+   0x2c, 0x55, 0x25, 0x67, 0xa8, 0x78, 0x92, 0x05, 0x26, 0x39, 0x46, 0xc6, 0x19, 0x85, 0xf8, 0xf6,
+   0x80, 0x9c, 0x54, 0x5a, 0xd8, 0x64, 0x18, 0x19, 0x21, 0x16, 0xec, 0xe1, 0x40, 0xb4, 0x00, 0x20,
+   0x48, 0x69, 0xc1, 0x20, 0xa2, 0xb5, 0xe4, 0x2c, 0x08, 0xe7, 0x26, 0xb9, 0xfb, 0x47, 0x6f, 0x93,
+   0x4a, 0x93, 0xec, 0x5b, 0xca, 0x1c, 0x81, 0x6a, 0x36, 0x64, 0xd6, 0x6b, 0x0b, 0x91, 0xde, 0xa8,
+   0xb2, 0x26, 0x2c, 0x16, 0xf0, 0x99, 0xae, 0x57, 0x24, 0xfc, 0xd0, 0x91, 0xf8, 0x0b, 0x20, 0xe7,
+   0xa2, 0x4e, 0xd4, 0x8b, 0x7b, 0x0d, 0x8e, 0x8a, 0x6e, 0x34, 0xf0, 0xe4, 0xee, 0x8c, 0xcc, 0xf9,
+   0xb2, 0x1f, 0x1b, 0x99, 0xa6, 0x65, 0x62, 0x0e, 0x39, 0x2c, 0x64, 0xca, 0xfd, 0x36, 0x76, 0x86,
+   0x80, 0xd5, 0xce, 0x78, 0xaa, 0xad, 0x95, 0xd1, 0x3b, 0xa9, 0x65, 0xeb, 0xea, 0x75, 0x73, 0x97,
+   0x39, 0x78, 0xde, 0xb1, 0x76, 0x77, 0xc2, 0x60, 0x80, 0xa3, 0x03, 0x5e, 0x0d, 0xf2, 0x86, 0x33,
+   0xb3, 0x7e, 0x6b, 0xf3, 0x7e, 0x7d, 0x80, 0x22, 0x45, 0x5f, 0xea, 0x86, 0x33, 0x65, 0xe4, 0xcc,
+   0x90, 0x5f, 0x0d, 0xad, 0xe6, 0xae, 0xd3, 0xb6, 0xca, 0xce, 0xf9, 0xae, 0xd5, 0xc6, 0xfd, 0x05,
+   0xad, 0xab, 0x73, 0x6f, 0xe7, 0x1d, 0xbe, 0xd7, 0x91, 0x13, 0x92, 0x52, 0xce, 0xb2, 0xce, 0x61,
+   0x7b, 0x4f, 0x96, 0x34, 0xd2, 0x4c, 0x7b, 0x48, 0x54, 0x11, 0xe5, 0x15, 0xe7, 0xa2, 0x47, 0x30,
+   0xc1, 0x55, 0x3c, 0x9b, 0x4e, 0x9d, 0xa6, 0x25, 0x0b, 0xae, 0xc5, 0x49, 0xf4, 0x32, 0x36, 0x24,
+   0xce, 0x71, 0x31, 0xeb, 0xf1, 0xba, 0x64, 0x5a, 0xd1, 0xc9, 0x86, 0xd8, 0xe1, 0xf1, 0xd4, 0xe2,
+   0xdd, 0xaf, 0xe1, 0x56, 0x19, 0xc1, 0x77, 0xc1, 0xd8, 0x3c, 0x47, 0xdd, 0x4c, 0x9b, 0x73, 0x51,
+   0x9b, 0xec, 0x95, 0x6d, 0xba, 0x8b, 0xdb, 0x42, 0xaf, 0x6e, 0x75, 0x5d, 0xb5, 0x4b, 0xf8, 0xd6,
+   0x90, 0x1f, 0xcb, 0x8c, 0x8a, 0x5f, 0x07, 0x03, 0x00, 0x00,
+};
+const size_t common_js_gz_len = sizeof(common_js_gz);
+
+/* html/uncommissioned_index.html: 1149 bytes, 508 bytes gzipped */
+const uint8_t uncommissioned_index_html_gz[] PROGMEM = {
+   0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x8d, 0x54, 0x6d, 0x6f, 0xd3, 0x30,
+   0x10, 0xfe, 0xde, 0x5f, 0x71, 0xf8, 0x13, 0x08, 0x42, 0xe8, 0x26, 0x55, 0x30, 0x92, 0x48, 0x65,
+   0xdd, 0xb4, 0x49, 0x1b, 0x54, 0x63, 0x08, 0x01, 0x42, 0xc8, 0x8d, 0x6f, 0x8b, 0x51, 0x12, 0x07,
+   0xfb, 0xd2, 0x6e, 0xfc, 0x7a, 0xce, 0x79, 0xe9, 0x92, 0x89, 0x4e, 0xcd, 0x87, 0xc4, 0xbe, 0x97,
+   0xe7, 0xb9, 0xf3, 0x73, 0x4e, 0xf4, 0x6c, 0xf1, 0xe9, 0xf8, 0xfa, 0xdb, 0xf2, 0x04, 0xce, 0xae,
+   0x2f, 0x2f, 0x92, 0x49, 0x94, 0x51, 0x91, 0xfb, 0x0f, 0x4a, 0x95, 0x4c, 0x80, 0x9f, 0xa8, 0x40,
+   0x92, 0x50, 0xca, 0x02, 0x63, 0xb1, 0xd6, 0xb8, 0xa9, 0x8c, 0x25, 0x01, 0xa9, 0x29, 0x09, 0x4b,
+   0x8a, 0xc5, 0x46, 0x2b, 0xca, 0x62, 0x85, 0x6b, 0x9d, 0x62, 0xd0, 0x6c, 0x5e, 0x81, 0x2e, 0x35,
+   0x69, 0x99, 0x07, 0x2e, 0x95, 0x39, 0xc6, 0x53, 0xd1, 0x01, 0x91, 0xa6, 0x1c, 0x93, 0x33, 0x94,
+   0x84, 0x16, 0x2c, 0xde, 0x6a, 0x47, 0x56, 0x92, 0x36, 0x65, 0x14, 0xb6, 0xae, 0x49, 0x14, 0xb6,
+   0xbc, 0xd1, 0xca, 0xa8, 0xfb, 0x2e, 0x2b, 0x9b, 0xf6, 0x29, 0x9e, 0xd3, 0x9a, 0x3c, 0x47, 0xcb,
+   0x71, 0xd3, 0xde, 0x7d, 0x90, 0x2c, 0x1a, 0x72, 0x66, 0xbd, 0x31, 0xb6, 0xe8, 0x00, 0xd9, 0xdc,
+   0xf8, 0x4f, 0x3e, 0x2f, 0xdf, 0x1e, 0xcc, 0x66, 0x90, 0x66, 0xba, 0x82, 0xf3, 0xc5, 0x11, 0x44,
+   0xae, 0x92, 0x25, 0x68, 0x15, 0x0b, 0x6f, 0xfa, 0xa5, 0x95, 0x48, 0xa2, 0xd0, 0xdb, 0x3a, 0xbc,
+   0x95, 0x6d, 0x17, 0xa7, 0xda, 0x16, 0x1b, 0x69, 0x11, 0xd6, 0x68, 0x1d, 0x43, 0x0e, 0x33, 0x6f,
+   0x3a, 0xdf, 0x8e, 0xd4, 0xf9, 0x12, 0x2e, 0xe7, 0xc7, 0x20, 0x95, 0xb2, 0xe8, 0xdc, 0x30, 0xb1,
+   0x90, 0xe9, 0x8e, 0x9c, 0x2f, 0x15, 0xe9, 0x02, 0x87, 0xb1, 0x75, 0x63, 0x79, 0x14, 0xce, 0x6d,
+   0x5d, 0x8d, 0x0e, 0xae, 0xef, 0x33, 0xf2, 0xbd, 0x83, 0x4c, 0xbd, 0x35, 0x16, 0x61, 0x7b, 0xba,
+   0x68, 0x05, 0xb0, 0x7a, 0x99, 0x61, 0xb8, 0xca, 0x38, 0xea, 0x84, 0xf0, 0xcf, 0x47, 0xd6, 0xf3,
+   0x68, 0xcb, 0xde, 0x20, 0xe8, 0xb2, 0xaa, 0x09, 0xe8, 0xbe, 0x62, 0xa1, 0x09, 0xef, 0x58, 0xe4,
+   0x56, 0x74, 0xff, 0x66, 0x1c, 0x79, 0x97, 0x63, 0x79, 0xcb, 0x5a, 0x8b, 0xc3, 0xa9, 0x60, 0xf9,
+   0xfe, 0xd4, 0xda, 0x22, 0x03, 0xf7, 0x2b, 0x01, 0x95, 0x24, 0xa6, 0x64, 0xfa, 0x1f, 0xf3, 0xe0,
+   0xbb, 0x0c, 0xfe, 0xbe, 0x09, 0xde, 0xfd, 0x7c, 0x39, 0xe0, 0x1c, 0xd1, 0x7d, 0xd5, 0xa7, 0xba,
+   0x21, 0xd8, 0xb3, 0x0a, 0xe7, 0x58, 0xaa, 0x61, 0x15, 0xb3, 0xc3, 0xff, 0x56, 0xf1, 0x14, 0x5d,
+   0x25, 0x9d, 0xdb, 0x18, 0xab, 0x9e, 0xa0, 0xec, 0x43, 0x7a, 0xda, 0x87, 0xfd, 0x98, 0x7a, 0x07,
+   0xcd, 0x07, 0xe9, 0x10, 0x1c, 0x35, 0xe2, 0x40, 0xc6, 0x47, 0xee, 0x51, 0xc2, 0xf3, 0xe5, 0x76,
+   0x18, 0xf6, 0x6b, 0x76, 0xc5, 0x30, 0x1d, 0x8a, 0x80, 0xb5, 0xcc, 0xeb, 0xc7, 0xb6, 0xbd, 0x8a,
+   0x19, 0xc1, 0xbb, 0x7a, 0x55, 0x68, 0xda, 0xa2, 0x5d, 0xf5, 0x03, 0xd2, 0x8d, 0x4f, 0xe8, 0xe7,
+   0xa7, 0x5b, 0xbb, 0xd4, 0xea, 0x8a, 0xc0, 0xd9, 0x94, 0x27, 0x29, 0x35, 0x45, 0x61, 0xca, 0xd7,
+   0xbf, 0x5d, 0x33, 0x89, 0x8d, 0x67, 0x14, 0xf6, 0x40, 0x97, 0x1b, 0xa9, 0x9e, 0x8b, 0xd0, 0x5f,
+   0x43, 0x0e, 0xe7, 0x2a, 0x5f, 0xbc, 0xef, 0xb0, 0xfb, 0xc8, 0x28, 0x6c, 0xef, 0x35, 0x8f, 0x6d,
+   0xf3, 0x97, 0xf9, 0x07, 0x1a, 0xda, 0x39, 0xf1, 0x7d, 0x04, 0x00, 0x00,
+};
+const size_t uncommissioned_index_html_gz_len = sizeof(uncommissioned_index_html_gz);